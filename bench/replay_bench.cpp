@@ -0,0 +1,364 @@
+// Times the whole dump() path over a corpus of replays, for example
+//
+//   edith_replay_bench --runs 5 bench/baseline.json a.dem b.dem
+//
+// parses every replay 5 times and prints the median throughput along with peak memory and
+// allocations, as JSON. Each number is compared against the baseline file, and the exit status
+// is 1 if any is more than --threshold (10% by default) worse. --write-baseline stores the
+// numbers as the new baseline instead. Baselines only mean something on the machine and build
+// type they were made with, so build with -DCMAKE_BUILD_TYPE=Release and write your own.
+//
+// The baseline also records the name and checksum of each replay and how the parser was built
+// and run, and nothing is compared unless those all match.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "edith.h"
+#include "visitor.h"
+
+std::atomic<uint64_t> allocations(0);
+
+void *operator new(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+
+  void *p = malloc(size ? size : 1);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+
+  return p;
+}
+
+void operator delete(void *p) noexcept {
+  free(p);
+}
+
+class CountingVisitor : public Visitor {
+public:
+  CountingVisitor() : frames(0), ticks(0), updates(0), last_tick(-1) {
+  }
+
+  void visit_tick(uint32_t tick) {
+    ++frames;
+
+    if (tick != last_tick) {
+      ++ticks;
+      last_tick = tick;
+    }
+  }
+
+  void visit_entity_updated(const Entity&) {
+    ++updates;
+  }
+
+  uint64_t frames;
+  uint64_t ticks;
+  uint64_t updates;
+
+private:
+  uint32_t last_tick;
+};
+
+struct Metric {
+  const char *name;
+  // Whether a bigger value is better.
+  bool higher_is_better;
+  double value;
+};
+
+std::string json_string(const std::string &value) {
+  std::string quoted("\"");
+  for (auto iter = value.begin(); iter != value.end(); ++iter) {
+    if (*iter == '"' || *iter == '\\') {
+      quoted.push_back('\\');
+    }
+    quoted.push_back(*iter);
+  }
+
+  return quoted + "\"";
+}
+
+std::string json_strings(const std::vector<std::string> &values) {
+  std::string list("[");
+  for (size_t i = 0; i < values.size(); ++i) {
+    list += (i ? ", " : "") + json_string(values[i]);
+  }
+
+  return list + "]";
+}
+
+// Returns the JSON text of the string or list of strings after "name": in a flat JSON object, or
+// an empty string if it's not there.
+std::string find_text(const std::string &json, const std::string &name) {
+  size_t at = json.find("\"" + name + "\"");
+  if (at == std::string::npos || (at = json.find(':', at)) == std::string::npos) {
+    return "";
+  }
+
+  size_t start = json.find_first_not_of(" ", at + 1);
+  if (start == std::string::npos) {
+    return "";
+  }
+
+  bool quoted = false;
+  for (size_t i = start; i < json.size(); ++i) {
+    if (quoted && json[i] == '\\') {
+      ++i;
+    } else if (json[i] == '"') {
+      quoted = !quoted;
+
+      if (!quoted && json[start] == '"') {
+        return json.substr(start, i + 1 - start);
+      }
+    } else if (!quoted && json[i] == ']') {
+      return json.substr(start, i + 1 - start);
+    }
+  }
+
+  return "";
+}
+
+// FNV-1a over the whole file.
+std::string checksum(std::ifstream &in) {
+  uint64_t hash = 14695981039346656037ull;
+
+  char buffer[1 << 16];
+  while (in.read(buffer, sizeof(buffer)) || in.gcount()) {
+    for (std::streamsize i = 0; i < in.gcount(); ++i) {
+      hash = (hash ^ (uint8_t) buffer[i]) * 1099511628211ull;
+    }
+  }
+
+  char hex[17];
+  snprintf(hex, sizeof(hex), "%016llx", (unsigned long long) hash);
+  return hex;
+}
+
+// What the numbers depend on besides the machine and the replays.
+std::string build_description(const ParseOptions &options) {
+#if defined(__GNUC__) && !defined(__clang__)
+  std::string build("gcc " __VERSION__);
+#else
+  std::string build(__VERSION__);
+#endif
+
+#ifdef __OPTIMIZE__
+  build += ", optimized";
+#else
+  build += ", unoptimized";
+#endif
+#ifdef NDEBUG
+  build += ", NDEBUG";
+#endif
+#ifdef EDITH_STATS
+  build += ", EDITH_STATS";
+#endif
+
+  if (options.pipeline) {
+    build += ", --pipeline";
+  }
+  if (options.batch_floats) {
+    build += ", --batch-floats";
+  }
+
+  return build;
+}
+
+// Reads the number after "name": in a flat JSON object, or returns false if it's not there.
+bool find_number(const std::string &json, const std::string &name, double *value) {
+  size_t at = json.find("\"" + name + "\"");
+  if (at == std::string::npos) {
+    return false;
+  }
+
+  at = json.find(':', at);
+  if (at == std::string::npos) {
+    return false;
+  }
+
+  *value = strtod(json.c_str() + at + 1, 0);
+  return true;
+}
+
+double median(std::vector<double> values) {
+  std::sort(values.begin(), values.end());
+  return values[values.size() / 2];
+}
+
+int main(int argc, char **argv) {
+  ParseOptions options;
+  size_t runs = 5;
+  double threshold = 0.1;
+  bool write_baseline = false;
+
+  int arg = 1;
+  while (arg < argc && argv[arg][0] == '-') {
+    std::string flag(argv[arg]);
+
+    if (flag == "--runs" && arg + 1 < argc) {
+      runs = std::max(1, atoi(argv[arg + 1]));
+      arg += 2;
+    } else if (flag == "--threshold" && arg + 1 < argc) {
+      threshold = atof(argv[arg + 1]);
+      arg += 2;
+    } else if (flag == "--pipeline") {
+      options.pipeline = true;
+      arg += 1;
+    } else if (flag == "--batch-floats") {
+      options.batch_floats = true;
+      arg += 1;
+    } else if (flag == "--write-baseline") {
+      write_baseline = true;
+      arg += 1;
+    } else {
+      break;
+    }
+  }
+
+  if (argc - arg < 2) {
+    std::cerr << "Usage: " << argv[0] << " [--runs n] [--threshold fraction] [--pipeline] " <<
+        "[--batch-floats] [--write-baseline] baseline.json something.dem..." << std::endl;
+    return 1;
+  }
+
+  const char *baseline_file = argv[arg];
+  std::vector<const char *> replays(argv + arg + 1, argv + argc);
+
+  uint64_t bytes = 0;
+  std::vector<std::string> names;
+  std::vector<std::string> checksums;
+  for (auto iter = replays.begin(); iter != replays.end(); ++iter) {
+    std::ifstream replay(*iter, std::ifstream::in | std::ifstream::binary | std::ifstream::ate);
+    if (!replay.is_open()) {
+      std::cerr << "Can't open " << *iter << std::endl;
+      return 1;
+    }
+
+    bytes += replay.tellg();
+    replay.seekg(0);
+
+    std::string name(*iter);
+    names.push_back(name.substr(name.find_last_of('/') + 1));
+    checksums.push_back(checksum(replay));
+  }
+
+  std::vector<double> mb_per_s;
+  std::vector<double> frames_per_s;
+  std::vector<double> updates_per_s;
+  std::vector<double> allocations_per_tick;
+
+  for (size_t run = 0; run < runs; ++run) {
+    CountingVisitor visitor;
+    allocations = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (auto iter = replays.begin(); iter != replays.end(); ++iter) {
+      dump(*iter, visitor, options);
+    }
+    double seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    mb_per_s.push_back(bytes / 1e6 / seconds);
+    frames_per_s.push_back(visitor.frames / seconds);
+    updates_per_s.push_back(visitor.updates / seconds);
+    allocations_per_tick.push_back((double) allocations / std::max<uint64_t>(visitor.ticks, 1));
+  }
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+
+  Metric metrics[] = {
+    {"mb_per_s", true, median(mb_per_s)},
+    {"frames_per_s", true, median(frames_per_s)},
+    {"entity_updates_per_s", true, median(updates_per_s)},
+    // Linux reports this in kilobytes.
+    {"peak_rss_kb", false, (double) usage.ru_maxrss},
+    {"allocations_per_tick", false, median(allocations_per_tick)},
+  };
+  size_t metric_count = sizeof(metrics) / sizeof(metrics[0]);
+
+  const char *described[] = {"replays", "checksums", "build"};
+  std::string descriptions[] = {
+    json_strings(names),
+    json_strings(checksums),
+    json_string(build_description(options)),
+  };
+  size_t described_count = sizeof(described) / sizeof(described[0]);
+
+  std::ostringstream report;
+  report << "{";
+  for (size_t i = 0; i < described_count; ++i) {
+    report << "\"" << described[i] << "\": " << descriptions[i] << ", ";
+  }
+  for (size_t i = 0; i < metric_count; ++i) {
+    report << (i ? ", " : "") << "\"" << metrics[i].name << "\": " << metrics[i].value;
+  }
+  report << "}";
+
+  std::cout << report.str() << std::endl;
+
+  if (write_baseline) {
+    std::ofstream out(baseline_file);
+    out << report.str() << std::endl;
+    return out ? 0 : 1;
+  }
+
+  std::ifstream in(baseline_file);
+  if (!in.is_open()) {
+    std::cerr << "Can't open " << baseline_file << ", use --write-baseline to make one." <<
+        std::endl;
+    return 1;
+  }
+
+  std::stringstream contents;
+  contents << in.rdbuf();
+  std::string baseline = contents.str();
+
+  for (size_t i = 0; i < described_count; ++i) {
+    std::string expected = find_text(baseline, described[i]);
+    if (expected.empty()) {
+      std::cerr << "The baseline doesn't record its " << described[i] << ", so nothing is " <<
+          "compared. Use --write-baseline to make a new one." << std::endl;
+      return 1;
+    } else if (expected != descriptions[i]) {
+      std::cerr << "The baseline has " << described[i] << " " << expected << " but this run " <<
+          "has " << descriptions[i] << ", so nothing is compared. Use --write-baseline to make " <<
+          "a new one." << std::endl;
+      return 1;
+    }
+  }
+
+  bool regressed = false;
+  for (size_t i = 0; i < metric_count; ++i) {
+    const Metric &metric = metrics[i];
+
+    double expected;
+    if (!find_number(baseline, metric.name, &expected) || expected <= 0) {
+      continue;
+    }
+
+    double change = metric.value / expected - 1;
+    bool worse = metric.higher_is_better ? change < -threshold : change > threshold;
+
+    std::cerr << metric.name << ": " << metric.value << " vs " << expected << " (" <<
+        (change >= 0 ? "+" : "") << 100 * change << "%)" << (worse ? " REGRESSED" : "") <<
+        std::endl;
+
+    regressed = regressed || worse;
+  }
+
+  return regressed ? 1 : 0;
+}
@@ -0,0 +1,29 @@
+// Converts a replay to the pre-decoded native format, for example
+//
+//   convert_native something.dem something.edn
+//
+// Reading something.edn back with dump_native makes the same visitor calls as parsing
+// something.dem without decoding anything. See src/native.h for the file format.
+
+#include <iostream>
+
+#include "edith.h"
+#include "native.h"
+
+int main(int argc, char **argv) {
+  if (argc != 3) {
+    std::cerr << "Usage: " << argv[0] << " something.dem out.edn" << std::endl;
+    return 1;
+  }
+
+  ParseOptions options;
+  options.recover_errors = true;
+
+  ParseError error;
+  if (!convert_to_native(argv[1], argv[2], options, &error)) {
+    std::cerr << error.what() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
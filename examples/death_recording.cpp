@@ -3,14 +3,19 @@
 //
 // This shows an example usage of this API but is hilariously inefficient and terrible.
 
-#include <stdexcept>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
 #include <string>
 #include <array>
 #include <map>
 
+#include "class_dispatcher.h"
 #include "debug.h"
-#include "property.h"
+#include "entity_view.h"
+#include "spatial_index.h"
+#include "trace.h"
+#include "trigger.h"
 #include "visitor.h"
 #include "edith.h"
 
@@ -19,130 +24,216 @@ const size_t NUM_PLAYERS_TO_TRACK = 10;
 
 uint32_t tick = 0;
 
-std::array<std::string, NUM_PLAYERS_TO_TRACK> player_name_prop_names;
-std::array<std::string, NUM_PLAYERS_TO_TRACK> selected_hero_prop_names;
+// The props of CDOTA_PlayerResource we want. These are the send props from the
+// m_iszPlayerNames table named 0000-0023 that contain the names of the (up to) 24 people
+// connected and the send props from m_hSelectedHero that contain the entity ID of the
+// heroes they selected.
+struct PlayerResource {
+  std::string names[NUM_PLAYERS_TO_TRACK];
+  uint32_t selected_heroes[NUM_PLAYERS_TO_TRACK];
+};
+
+// The props of CDOTA_Unit_Hero_* we want.
+struct Hero {
+  int32_t health;
+  std::array<float, 2> origin;
+  uint32_t cell_x;
+  uint32_t cell_y;
+  uint32_t cell_z;
+};
+
+EntityView<PlayerResource> player_resource_view("CDOTA_PlayerResource");
+EntityView<Hero> hero_view("CDOTA_Unit_Hero_");
+
+// Fires when a hero's health drops to zero. Corpses keep getting updates (think of someone
+// dying from the hook, its corpse gets carried along) but this only fires at the death
+// moment.
+TriggerSet triggers;
+uint32_t hero_died = triggers.on_fall("CDOTA_Unit_Hero_", "DT_DOTA_BaseNPC.m_iHealth", 0);
+
+// Where every unit is, to count the heroes within near_radius of each death with --near.
+SpatialIndex positions;
+float near_radius = 0;
+std::vector<uint32_t> nearby;
 
 std::map<uint32_t, std::string> hero_to_playername;
-std::map<uint32_t, int> hero_previous_life;
 
-// This generates the prop names we're interested in. These are formatted like
+// This binds the prop names we're interested in. The player ones are formatted like
 // m_iszPlayerNames.0000 and m_hSelectedHero.0000
-void generate_prop_names() {
+void bind_views() {
   for (size_t i = 0; i < NUM_PLAYERS_TO_TRACK; ++i) {
     char as_string[30];
 
     sprintf(as_string, "m_iszPlayerNames.%04lu", i);
-    player_name_prop_names[i] = as_string;
+    player_resource_view.field(as_string, &PlayerResource::names, i);
 
     sprintf(as_string, "m_hSelectedHero.%04lu", i);
-    selected_hero_prop_names[i] = as_string;
+    player_resource_view.field(as_string, &PlayerResource::selected_heroes, i);
   }
+
+  hero_view
+      .field("DT_DOTA_BaseNPC.m_iHealth", &Hero::health)
+      .field("DT_DOTA_BaseNPC.m_vecOrigin", &Hero::origin)
+      .field("DT_DOTA_BaseNPC.m_cellX", &Hero::cell_x)
+      .field("DT_DOTA_BaseNPC.m_cellY", &Hero::cell_y)
+      .field("DT_DOTA_BaseNPC.m_cellZ", &Hero::cell_z);
 }
 
 // This handles the CDOTA_PlayerResource entitiy.
-// We want the 24 send props from the m_iszPlayerNames table named 0000-0023
-// that contain the names of the (up to) 24 people connected and we want the 24
-// send props from m_hSelectedHero that contain the entity ID of the heroes they
-// selected.
-void update_name_map(const Entity &player_resource) {
-  for (size_t iPlayer = 0; iPlayer < NUM_PLAYERS_TO_TRACK; ++iPlayer) {
-    auto name_prop = player_resource.properties.at(player_name_prop_names[iPlayer]);
-    auto selected_prop = player_resource.properties.at(selected_hero_prop_names[iPlayer]);
+void update_name_map(const Entity &entity) {
+  const PlayerResource &player_resource = player_resource_view.get(entity);
 
+  for (size_t iPlayer = 0; iPlayer < NUM_PLAYERS_TO_TRACK; ++iPlayer) {
     // Valve packs some additional data in the upper bits, we only care about the lower
     // ones.
-    int heroid = selected_prop->value_as<IntProperty>() & 0x7FF;
-    hero_to_playername[heroid] = name_prop->value_as<StringProperty>();
+    int heroid = player_resource.selected_heroes[iPlayer] & 0x7FF;
+    hero_to_playername[heroid] = player_resource.names[iPlayer];
   }
 }
 
-// This handles CDOTA_Unit_Hero_* entities.
+// This handles a CDOTA_Unit_Hero_* entity dying.
 // We first check if it's in our name map, and if it isn't then it must be an illusion
-// or something. After that we make sure the hero has 0 health and if it does we output
-// it.
-void update_hero(const Entity &hero) {
-  using std::dynamic_pointer_cast;
+// or something.
+void record_death(const Entity &entity) {
   using std::cout;
   using std::endl;
 
-  if (hero_to_playername.count(hero.id) == 0) {
+  if (hero_to_playername.count(entity.id) == 0) {
     // An illusion.
     return;
   }
 
-  try {
-    int life = hero.properties.at("DT_DOTA_BaseNPC.m_iHealth")->value_as<IntProperty>();
-    // Note that we get multiple entity updates even when it died, but we
-    // only want one output per death. That's why we only output stuff when
-    // the life drops below zero for the first time.
-    // (Think of someone dying from the hook, its corpse gets carried along but
-    //  we are only interested in the death moment!)
-    if (life > 0 || hero_previous_life[hero.id] <= 0) {
-      hero_previous_life[hero.id] = life;
-      return;
+  const Hero &hero = hero_view.get(entity);
+
+  cout << tick << "," << entity.id << "," << entity.clazz->name << ",";
+  cout << "\"" << hero_to_playername[entity.id] << "\",";
+  cout << hero.health << ",";
+  cout << hero.origin[0] << ",";
+  cout << hero.origin[1] << ",";
+  cout << (int) hero.cell_x << ",";
+  cout << (int) hero.cell_y << ",";
+  cout << (int) hero.cell_z;
+
+  if (near_radius > 0) {
+    size_t nearby_heroes = 0;
+    float x;
+    float y;
+
+    if (positions.position(entity.id, x, y)) {
+      positions.query_radius(x, y, near_radius, nearby);
+
+      for (auto iter = nearby.begin(); iter != nearby.end(); ++iter) {
+        if (*iter != entity.id && hero_to_playername.count(*iter)) {
+          ++nearby_heroes;
+        }
+      }
     }
-    hero_previous_life[hero.id] = life;
-
-    int cell_x = hero.properties.at("DT_DOTA_BaseNPC.m_cellX")->value_as<IntProperty>();
-    int cell_y = hero.properties.at("DT_DOTA_BaseNPC.m_cellY")->value_as<IntProperty>();
-    int cell_z = hero.properties.at("DT_DOTA_BaseNPC.m_cellZ")->value_as<IntProperty>();
-    auto origin_prop = dynamic_pointer_cast<VectorXYProperty>(hero.properties.at("DT_DOTA_BaseNPC.m_vecOrigin"));
-
-    cout << tick << "," << hero.id << "," << hero.clazz->name << ",";
-    cout << "\"" << hero_to_playername[hero.id] << "\",";
-    cout << life << ",";
-    cout << origin_prop->values[0] << ",";
-    cout << origin_prop->values[1] << ",";
-    cout << cell_x << ",";
-    cout << cell_y << ",";
-    cout << cell_z << endl;
-  } catch(const std::out_of_range& e) {
-    XERROR("%s", e.what());
-  } catch(const std::bad_cast& e) {
-    XERROR("%s", e.what());
-  }
-}
 
-void handle_entity(const Entity &entity) {
-  if (entity.clazz->name == "CDOTA_PlayerResource") {
-    update_name_map(entity);
-  } else if (entity.clazz->name.find("CDOTA_Unit_Hero_") == 0) {
-    update_hero(entity);
+    cout << "," << nearby_heroes;
   }
+
+  cout << endl;
 }
 
-class DeathRecordingVisitor : public Visitor {
+class DeathRecordingVisitor : public ClassDispatcher {
 public:
   DeathRecordingVisitor() {
-    std::cout << "tick,entity_id,class_name,player_name,health,x,y,cx,cy,cz" << std::endl;
+    std::cout << "tick,entity_id,class_name,player_name,health,x,y,cx,cy,cz" <<
+        (near_radius > 0 ? ",nearby_heroes" : "") << std::endl;
 
-    generate_prop_names();
+    on_class("CDOTA_PlayerResource", update_name_map);
   }
 
   virtual void visit_tick(uint32_t t) {
     tick = t;
   }
 
-  virtual void visit_entity_created(const Entity &entity) {
-    handle_entity(entity);
-  }
-
-  virtual void visit_entity_updated(const Entity &entity) {
-    handle_entity(entity);
-  }
-
-  virtual void visit_entity_deleted(const Entity &entity) {
+  virtual void visit_trigger(uint32_t trigger, const Entity &entity) {
+    if (trigger == hero_died) {
+      record_death(entity);
+    }
   }
 };
 
 int main(int argc, char **argv) {
-    if (argc <= 1) {
-        std::cerr << "Usage: " << argv[0] << " something.dem" << std::endl;
+    ParseOptions options;
+    bool print_stats = false;
+    std::string trace_file;
+
+    int arg = 1;
+    while (arg < argc - 1) {
+        std::string flag(argv[arg]);
+
+        if (flag == "--schema-cache" && arg + 2 < argc) {
+            options.schema_cache_dir = argv[arg + 1];
+            arg += 2;
+        } else if (flag == "--pipeline") {
+            options.pipeline = true;
+            arg += 1;
+        } else if (flag == "--follow") {
+            options.follow = true;
+            arg += 1;
+        } else if (flag == "--trace" && arg + 2 < argc) {
+            trace_file = argv[arg + 1];
+            arg += 2;
+        } else if (flag == "--memory-limit" && arg + 2 < argc) {
+            options.memory_limit = strtoull(argv[arg + 1], 0, 10);
+            arg += 2;
+        } else if (flag == "--near" && arg + 2 < argc) {
+            near_radius = strtof(argv[arg + 1], 0);
+            arg += 2;
+        } else if (flag == "--stats") {
+            print_stats = true;
+            arg += 1;
+        } else {
+            break;
+        }
+    }
+
+    if (arg != argc - 1) {
+        std::cerr << "Usage: " << argv[0] <<
+            " [--schema-cache dir] [--pipeline] [--follow] [--memory-limit bytes] [--stats]" <<
+            " [--near radius] [--trace out.json] something.dem" << std::endl;
         return 1;
     }
 
+    bind_views();
+
     DeathRecordingVisitor visitor;
-    dump(argv[1], visitor);
+
+    Parser parser(options);
+    parser.add_view(player_resource_view);
+    parser.add_view(hero_view);
+    parser.add_triggers(triggers);
+    if (near_radius > 0) {
+        parser.add_spatial_index(positions);
+    }
+
+    Tracer tracer;
+    if (!trace_file.empty()) {
+        parser.set_tracer(&tracer);
+    }
+
+    parser.parse(argv[arg], visitor);
+
+    if (!trace_file.empty()) {
+        std::ofstream out(trace_file.c_str());
+        tracer.write_json(out);
+    }
+
+    // JSON on stderr so it doesn't mix with the CSV.
+    if (print_stats) {
+        parser.stats().write_json(std::cerr);
+        std::cerr << std::endl;
+        parser.memory_usage().write_json(std::cerr);
+        std::cerr << std::endl;
+    }
+
+    if (parser.exceeded_memory_limit()) {
+        std::cerr << "Stopped early, over the memory limit." << std::endl;
+        return 2;
+    }
+
     return 0;
 }
 
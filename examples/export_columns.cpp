@@ -0,0 +1,48 @@
+// Exports the values of some props over time to a columnar file, for example
+//
+//   export_columns heroes.edc something.dem CDOTA_Unit_Hero_:DT_DOTA_BaseNPC.m_iHealth
+//
+// exports the health of every hero. See src/column_export.h for the file format.
+
+#include <iostream>
+#include <string>
+
+#include "column_export.h"
+#include "edith.h"
+
+int main(int argc, char **argv) {
+  if (argc < 4) {
+    std::cerr << "Usage: " << argv[0] << " out.edc something.dem class_prefix:prop..." <<
+        std::endl;
+    return 1;
+  }
+
+  ColumnExporter exporter(argv[1]);
+
+  for (int i = 3; i < argc; ++i) {
+    std::string series(argv[i]);
+    size_t colon = series.find(':');
+
+    if (colon == std::string::npos) {
+      std::cerr << "Expected class_prefix:prop but got " << series << std::endl;
+      return 1;
+    }
+
+    exporter.add_series(series.substr(0, colon), series.substr(colon + 1));
+  }
+
+  dump(argv[2], exporter);
+  bool written = exporter.close();
+
+  const std::vector<std::string> &errors = exporter.errors();
+  for (auto iter = errors.begin(); iter != errors.end(); ++iter) {
+    std::cerr << *iter << std::endl;
+  }
+
+  if (!written) {
+    std::cerr << "Can't write all of " << argv[1] << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,867 @@
+// Generates a synthetic replay, for example
+//
+//   generate_replay --ticks 54000 --creeps 400 --update-rate 0.5 big.dem
+//
+// writes half an hour of 10 heroes and up to 400 creeps, each updated on about half the ticks.
+// The send tables cover every prop type and float encoding the parser can read, including
+// arrays, excludes and a collapsible table. The replay starts the way real ones do, with the
+// server info, send tables, class info and instance baselines, and a full packet is written
+// every --full-packet-interval ticks so it can be split into segments. The same --seed always
+// gives the same file.
+//
+// With --verify the replay is parsed back afterwards, with --pipeline and --batch-floats if
+// they're given, and every entity left at the end is checked against what was written. The exit
+// status is 1 if anything differs.
+
+#include <stdlib.h>
+
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "bitstream.h"
+#include "debug.h"
+#include "edith.h"
+#include "property.h"
+#include "replay_writer.h"
+#include "schema.h"
+#include "state.h"
+#include "visitor.h"
+
+#define MAX_CLASSES 4
+// What State works out from MAX_CLASSES.
+#define CLASS_BITS 2
+#define MAX_PLAYERS 24
+#define PLAYER_RESOURCE_ID 1
+#define FIRST_HERO_ID 2
+#define FIRST_CREEP_ID 64
+// Ids after the entries of a delta packet are 11 bits.
+#define MAX_ENTITY_ID 0x7FF
+#define HERO_HEALTH 600
+
+struct Options {
+  Options() :
+      ticks(1800),
+      heroes(10),
+      creeps(40),
+      update_rate(0.33),
+      props(4),
+      full_packet_interval(1800),
+      seed(1),
+      verify(false) {
+  }
+
+  uint32_t ticks;
+  uint32_t heroes;
+  uint32_t creeps;
+  double update_rate;
+  uint32_t props;
+  uint32_t full_packet_interval;
+  uint32_t seed;
+  bool verify;
+  ParseOptions parse;
+};
+
+enum ClassIndex {
+  CI_PlayerResource,
+  CI_Axe,
+  CI_Lina,
+  CI_Creep,
+};
+
+const char *PLAYER_NAMES[] = {
+  "Dendi", "Puppey", "XBOCT", "LightOfHeaven", "ArtStyle", "Funn1k", "KuroKy", "Mania",
+  "Sockshka", "Misery", "s4", "",
+};
+const size_t PLAYER_NAME_COUNT = sizeof(PLAYER_NAMES) / sizeof(PLAYER_NAMES[0]);
+
+typedef std::map<uint32_t, std::shared_ptr<Property>> PropMap;
+
+struct SyntheticEntity {
+  uint32_t class_i;
+  uint32_t serial;
+
+  // Everything set since the entity entered, by flat index. Its baseline fills in the rest.
+  PropMap props;
+};
+
+ChangedProps changed_props(const PropMap &props) {
+  ChangedProps changed;
+  for (auto iter = props.begin(); iter != props.end(); ++iter) {
+    changed.push_back(std::make_pair(iter->first, iter->second.get()));
+  }
+
+  return changed;
+}
+
+void add_prop(CSVCMsg_SendTable &table, SP_Types type, const char *name, uint32_t flags,
+    uint32_t num_bits, const char *dt_name = "", uint32_t priority = 128, float low = 0,
+    float high = 0, uint32_t num_elements = 0) {
+  CSVCMsg_SendTable_sendprop_t *prop = table.add_props();
+
+  prop->set_type(type);
+  prop->set_var_name(name);
+  prop->set_flags(flags);
+  prop->set_priority(priority);
+  prop->set_dt_name(dt_name);
+  prop->set_num_elements(num_elements);
+  prop->set_low_value(low);
+  prop->set_high_value(high);
+  prop->set_num_bits(num_bits);
+}
+
+CSVCMsg_SendTable &add_table(std::vector<CSVCMsg_SendTable> &tables, const char *name) {
+  tables.push_back(CSVCMsg_SendTable());
+  tables.back().set_net_table_name(name);
+  tables.back().set_needs_decoder(true);
+
+  return tables.back();
+}
+
+// Array props follow the prop describing their elements, which has SP_InsideArray set.
+void make_send_tables(std::vector<CSVCMsg_SendTable> &tables) {
+  // Tables are filled in through references, so the vector can't move them.
+  tables.reserve(10);
+
+  CSVCMsg_SendTable &base = add_table(tables, "DT_BaseEntity");
+  add_prop(base, SP_Int, "m_iTeamNum", SP_Unsigned, 6);
+  add_prop(base, SP_Float, "m_flSimulationTime", 0, 16, "", 1, 0, 100);
+  add_prop(base, SP_Int, "m_nModelIndex", SP_EncodedAgainstTickcount, 32);
+  add_prop(base, SP_Int, "m_nSpawnTick", SP_EncodedAgainstTickcount | SP_Unsigned, 32);
+  add_prop(base, SP_String, "m_iName", 0, 0);
+  add_prop(base, SP_Float, "m_flRaw", SP_NoScale, 32);
+  add_prop(base, SP_Vector, "m_angRotation", SP_Coord, 0);
+  add_prop(base, SP_Vector, "m_vecNormal", SP_Normal, 11);
+  add_prop(base, SP_Int, "m_iExcluded", 0, 8);
+
+  CSVCMsg_SendTable &npc = add_table(tables, "DT_DOTA_BaseNPC");
+  add_prop(npc, SP_DataTable, "baseclass", 0, 0, "DT_BaseEntity", 0);
+  add_prop(npc, SP_Int, "m_iExcluded", SP_Exclude, 0, "DT_BaseEntity");
+  add_prop(npc, SP_Int, "m_iHealth", SP_Unsigned | SP_ChangesOften, 20, "", 64);
+  add_prop(npc, SP_Int, "m_cellX", SP_Unsigned, 8);
+  add_prop(npc, SP_Int, "m_cellY", SP_Unsigned, 8);
+  add_prop(npc, SP_Int, "m_cellZ", SP_Unsigned, 8);
+  add_prop(npc, SP_VectorXY, "m_vecOrigin", SP_CellCoord, 7);
+  add_prop(npc, SP_Float, "m_flMana", SP_CellCoordLowPrecision, 10, "", 20);
+  add_prop(npc, SP_Float, "m_flCellIntegral", SP_CellCoordIntegral, 10);
+  add_prop(npc, SP_Float, "m_flCoordMp", SP_CoordMpIntegral, 0);
+  add_prop(npc, SP_Int64, "m_nXP", SP_Unsigned, 40);
+  add_prop(npc, SP_Int64, "m_nSigned64", 0, 48);
+  add_prop(npc, SP_Int, "m_iKills", SP_InsideArray | SP_Unsigned, 10);
+  add_prop(npc, SP_Array, "m_iKills", 0, 0, "", 128, 0, 0, 24);
+  add_prop(npc, SP_Float, "m_flCooldowns", SP_InsideArray, 12, "", 128, 0, 300);
+  add_prop(npc, SP_Array, "m_flCooldowns", 0, 0, "", 128, 0, 0, 6);
+  add_prop(npc, SP_String, "m_szItems", SP_InsideArray, 0);
+  add_prop(npc, SP_Array, "m_szItems", 0, 0, "", 128, 0, 0, 4);
+  add_prop(npc, SP_Vector, "m_vecWaypoints", SP_InsideArray | SP_Coord, 0);
+  add_prop(npc, SP_Array, "m_vecWaypoints", 0, 0, "", 128, 0, 0, 3);
+  add_prop(npc, SP_VectorXY, "m_vecTargets", SP_InsideArray | SP_CellCoordIntegral, 10);
+  add_prop(npc, SP_Array, "m_vecTargets", 0, 0, "", 128, 0, 0, 2);
+  add_prop(npc, SP_Int64, "m_nStamps", SP_InsideArray | SP_Unsigned, 36);
+  add_prop(npc, SP_Array, "m_nStamps", 0, 0, "", 128, 0, 0, 2);
+
+  CSVCMsg_SendTable &local = add_table(tables, "DT_LocalData");
+  add_prop(local, SP_Int, "m_iLocalVal", 0, 12);
+  add_prop(local, SP_Float, "m_flLocalFloat", 0, 10, "", 30, -10, 10);
+
+  CSVCMsg_SendTable &axe = add_table(tables, "DT_DOTA_Unit_Hero_Axe");
+  add_prop(axe, SP_DataTable, "baseclass", 0, 0, "DT_DOTA_BaseNPC");
+  add_prop(axe, SP_DataTable, "m_local", SP_Collapsible, 0, "DT_LocalData");
+  add_prop(axe, SP_Int, "m_iAxeSpecific", SP_Unsigned, 4);
+
+  CSVCMsg_SendTable &lina = add_table(tables, "DT_DOTA_Unit_Hero_Lina");
+  add_prop(lina, SP_DataTable, "baseclass", 0, 0, "DT_DOTA_BaseNPC");
+
+  CSVCMsg_SendTable &creep = add_table(tables, "DT_DOTA_BaseNPC_Creep");
+  add_prop(creep, SP_DataTable, "baseclass", 0, 0, "DT_DOTA_BaseNPC");
+  add_prop(creep, SP_Int, "m_iHealth", SP_Exclude, 0, "DT_DOTA_BaseNPC");
+
+  CSVCMsg_SendTable &names = add_table(tables, "m_iszPlayerNames");
+  CSVCMsg_SendTable &selected = add_table(tables, "m_hSelectedHero");
+  for (uint32_t i = 0; i < MAX_PLAYERS; ++i) {
+    char name[8];
+    sprintf(name, "%04u", i);
+
+    add_prop(names, SP_String, name, 0, 0);
+    add_prop(selected, SP_Int, name, SP_Unsigned, 21);
+  }
+
+  CSVCMsg_SendTable &resource = add_table(tables, "DT_DOTA_PlayerResource");
+  add_prop(resource, SP_DataTable, "baseclass", 0, 0, "DT_BaseEntity");
+  add_prop(resource, SP_DataTable, "m_iszPlayerNames", 0, 0, "m_iszPlayerNames");
+  add_prop(resource, SP_DataTable, "m_hSelectedHero", 0, 0, "m_hSelectedHero");
+
+  // No class uses this one.
+  CSVCMsg_SendTable &unused = add_table(tables, "DT_Unused");
+  add_prop(unused, SP_Int, "m_iNope", 0, 3);
+}
+
+void make_classes(CDemoClassInfo &info) {
+  const char *classes[MAX_CLASSES][2] = {
+    {"DT_DOTA_PlayerResource", "CDOTA_PlayerResource"},
+    {"DT_DOTA_Unit_Hero_Axe", "CDOTA_Unit_Hero_Axe"},
+    {"DT_DOTA_Unit_Hero_Lina", "CDOTA_Unit_Hero_Lina"},
+    {"DT_DOTA_BaseNPC_Creep", "CDOTA_BaseNPC_Creep"},
+  };
+
+  for (uint32_t i = 0; i < MAX_CLASSES; ++i) {
+    CDemoClassInfo_class_t *clazz = info.add_classes();
+    clazz->set_class_id(i);
+    clazz->set_table_name(classes[i][0]);
+    clazz->set_network_name(classes[i][1]);
+  }
+}
+
+class Generator {
+public:
+  Generator(const Options &_options, const Schema &_schema) :
+      options(_options),
+      schema(_schema),
+      rng(_options.seed) {
+  }
+
+  void generate(const char *path);
+
+  // Checks what a parse ended up with against what was written.
+  bool verify(const std::map<uint32_t, Entity> &parsed) const;
+
+private:
+  uint32_t random_below(uint32_t n);
+  bool chance(double p);
+
+  uint32_t random_int(const SendProp *prop);
+  float random_float(const SendProp *prop);
+  void random_vector(const SendProp *prop, float *out);
+  void random_vector_xy(const SendProp *prop, float *out);
+  uint64_t random_int64();
+  std::string random_string();
+
+  template<typename P, typename T, size_t C>
+  Property *random_packed_array(const SendProp *prop,
+      void (Generator::*random_element)(const SendProp *, T *));
+  void random_int_element(const SendProp *prop, uint32_t *out);
+  void random_float_element(const SendProp *prop, float *out);
+  void random_int64_element(const SendProp*, uint64_t *out);
+  Property *random_value(const SendProp *prop);
+
+  std::shared_ptr<Property> snap(const SendProp *prop, const Property &value);
+  std::shared_ptr<Property> random_prop(const SendProp *prop);
+  std::shared_ptr<Property> int_prop(const SendProp *prop, uint32_t value);
+  std::shared_ptr<Property> string_prop(const SendProp *prop, const std::string &value);
+
+  const FlatSendTable &table(uint32_t class_i) const;
+  uint32_t prop_index(uint32_t class_i, const std::string &qualified_name) const;
+  void set_random_props(uint32_t class_i, uint32_t count, PropMap &props);
+
+  void write_signon(ReplayWriter &writer);
+  void write_packet(ReplayWriter &writer, uint32_t tick);
+  void write_full_packet(ReplayWriter &writer, uint32_t tick);
+
+  void enter(PacketEntitiesWriter &packet, uint32_t id, uint32_t class_i, const PropMap &props);
+  void update(PacketEntitiesWriter &packet, uint32_t id, const PropMap &props);
+  void update_hero(PacketEntitiesWriter &packet, uint32_t id);
+  void update_creep(PacketEntitiesWriter &packet, uint32_t id);
+
+  const Options &options;
+  const Schema &schema;
+
+  std::mt19937 rng;
+  InternTable strings;
+
+  std::vector<PropMap> baselines;
+  std::vector<StringTableEntry> baseline_entries;
+
+  std::map<uint32_t, SyntheticEntity> entities;
+  std::map<uint32_t, int32_t> health;
+};
+
+uint32_t Generator::random_below(uint32_t n) {
+  return rng() % n;
+}
+
+bool Generator::chance(double p) {
+  return std::uniform_real_distribution<double>(0, 1)(rng) < p;
+}
+
+// Any bit pattern works since values get snapped to what the encoding can hold.
+uint32_t Generator::random_int(const SendProp *prop) {
+  if (prop->flags & SP_EncodedAgainstTickcount) {
+    return (prop->flags & SP_Unsigned) ? random_below(100000) : random_below(2001) - 1000;
+  } else {
+    return rng();
+  }
+}
+
+float Generator::random_float(const SendProp *prop) {
+  float sign = random_below(2) ? -1 : 1;
+
+  if (prop->flags & SP_Coord) {
+    return sign * (random_below(4000) + random_below(32) / 32.0f);
+  } else if (prop->flags & SP_CoordMpIntegral) {
+    return sign * random_below(2000);
+  } else if (prop->flags & SP_NoScale) {
+    return sign * random_below(100000) / 7.0f;
+  } else if (prop->flags & SP_Normal) {
+    return sign * random_below(2048) / 2047.0f;
+  } else if (prop->flags & SP_CellCoordIntegral) {
+    return random_below(1 << prop->num_bits);
+  } else if (prop->flags & (SP_CellCoord | SP_CellCoordLowPrecision)) {
+    return random_below(1 << prop->num_bits) + random_below(8) / 8.0f;
+  } else {
+    return prop->low_value + (prop->high_value - prop->low_value) * random_below(1001) / 1000;
+  }
+}
+
+// Normals only send the sign of z, which is worked out from x and y.
+void Generator::random_vector(const SendProp *prop, float *out) {
+  if (prop->flags & SP_Normal) {
+    double angle = random_below(3600) / 3600.0 * 2 * M_PI;
+    double length = random_below(1001) / 1000.0;
+
+    out[0] = length * cos(angle);
+    out[1] = length * sin(angle);
+    out[2] = random_below(2) ? -1 : 1;
+  } else {
+    out[0] = random_float(prop);
+    out[1] = random_float(prop);
+    out[2] = random_float(prop);
+  }
+}
+
+void Generator::random_vector_xy(const SendProp *prop, float *out) {
+  out[0] = random_float(prop);
+  out[1] = random_float(prop);
+}
+
+uint64_t Generator::random_int64() {
+  return (uint64_t) rng() << 32 | rng();
+}
+
+std::string Generator::random_string() {
+  return PLAYER_NAMES[random_below(PLAYER_NAME_COUNT)];
+}
+
+void Generator::random_int_element(const SendProp *prop, uint32_t *out) {
+  *out = random_int(prop);
+}
+
+void Generator::random_float_element(const SendProp *prop, float *out) {
+  *out = random_float(prop);
+}
+
+// Takes the prop like the other element generators, though every int64 is fully random.
+void Generator::random_int64_element(const SendProp*, uint64_t *out) {
+  *out = random_int64();
+}
+
+template<typename P, typename T, size_t C>
+Property *Generator::random_packed_array(const SendProp *prop,
+    void (Generator::*random_element)(const SendProp *, T *)) {
+  P *array = new P(prop->num_elements);
+  array->count = random_below(prop->num_elements + 1);
+
+  for (size_t i = 0; i < array->count; ++i) {
+    (this->*random_element)(prop->array_prop, &array->values[i * C]);
+  }
+
+  return array;
+}
+
+Property *Generator::random_value(const SendProp *prop) {
+  if (prop->type == SP_Int) {
+    return new IntProperty(random_int(prop));
+  } else if (prop->type == SP_Float) {
+    return new FloatProperty(random_float(prop));
+  } else if (prop->type == SP_Vector) {
+    float values[3];
+    random_vector(prop, values);
+
+    return new VectorProperty(values);
+  } else if (prop->type == SP_VectorXY) {
+    float values[2];
+    random_vector_xy(prop, values);
+
+    return new VectorXYProperty(values);
+  } else if (prop->type == SP_String) {
+    return new StringProperty(strings.intern(random_string()));
+  } else if (prop->type == SP_Int64) {
+    return new Int64Property(random_int64());
+  }
+
+  XASSERT(prop->type == SP_Array, "Unknown send prop type %d", prop->type);
+
+  SP_Types element_type = prop->array_prop->type;
+  if (element_type == SP_Int) {
+    return random_packed_array<IntArrayProperty, uint32_t, 1>(prop,
+        &Generator::random_int_element);
+  } else if (element_type == SP_Float) {
+    return random_packed_array<FloatArrayProperty, float, 1>(prop,
+        &Generator::random_float_element);
+  } else if (element_type == SP_Vector) {
+    return random_packed_array<VectorArrayProperty, float, 3>(prop, &Generator::random_vector);
+  } else if (element_type == SP_VectorXY) {
+    return random_packed_array<VectorXYArrayProperty, float, 2>(prop,
+        &Generator::random_vector_xy);
+  } else if (element_type == SP_Int64) {
+    return random_packed_array<Int64ArrayProperty, uint64_t, 1>(prop,
+        &Generator::random_int64_element);
+  } else {
+    std::vector<ArrayPropertyElement> elements(random_below(prop->num_elements + 1));
+    for (auto iter = elements.begin(); iter != elements.end(); ++iter) {
+      iter->reset(random_value(prop->array_prop));
+    }
+
+    return new ArrayProperty(elements, element_type);
+  }
+}
+
+// Rounds value to what prop's encoding can hold by encoding and decoding it, so what's
+// remembered is exactly what a parse should give back.
+std::shared_ptr<Property> Generator::snap(const SendProp *prop, const Property &value) {
+  BitWriter writer;
+  Property::write_prop(writer, prop, value);
+
+  Bitstream reader(writer.get_bytes());
+  return Property::read_prop(reader, prop, strings, 0);
+}
+
+std::shared_ptr<Property> Generator::random_prop(const SendProp *prop) {
+  std::unique_ptr<Property> value(random_value(prop));
+  return snap(prop, *value);
+}
+
+std::shared_ptr<Property> Generator::int_prop(const SendProp *prop, uint32_t value) {
+  return snap(prop, IntProperty(value));
+}
+
+std::shared_ptr<Property> Generator::string_prop(const SendProp *prop,
+    const std::string &value) {
+  return snap(prop, StringProperty(strings.intern(value)));
+}
+
+const FlatSendTable &Generator::table(uint32_t class_i) const {
+  return *schema.get_class(class_i).flat_table;
+}
+
+uint32_t Generator::prop_index(uint32_t class_i, const std::string &qualified_name) const {
+  const std::vector<const SendProp*> &props = table(class_i).props;
+
+  for (uint32_t i = 0; i < props.size(); ++i) {
+    if (props[i]->qualified_name == qualified_name) {
+      return i;
+    }
+  }
+
+  XERROR("%s has no prop %s.", table(class_i).net_table_name.c_str(), qualified_name.c_str());
+}
+
+void Generator::set_random_props(uint32_t class_i, uint32_t count, PropMap &props) {
+  const std::vector<const SendProp*> &table_props = table(class_i).props;
+
+  for (uint32_t i = 0; i < count; ++i) {
+    uint32_t index = random_below(table_props.size());
+    props[index] = random_prop(table_props[index]);
+  }
+}
+
+void Generator::enter(PacketEntitiesWriter &packet, uint32_t id, uint32_t class_i,
+    const PropMap &props) {
+  SyntheticEntity &entity = entities[id];
+  entity.class_i = class_i;
+  entity.serial = random_below(1 << 10);
+  entity.props = props;
+
+  ChangedProps changed = changed_props(props);
+  packet.enter(id, class_i, entity.serial, table(class_i), changed);
+}
+
+void Generator::update(PacketEntitiesWriter &packet, uint32_t id, const PropMap &props) {
+  SyntheticEntity &entity = entities[id];
+  for (auto iter = props.begin(); iter != props.end(); ++iter) {
+    entity.props[iter->first] = iter->second;
+  }
+
+  ChangedProps changed = changed_props(props);
+  packet.update(id, table(entity.class_i), changed);
+}
+
+// Heroes lose health until they die and then come back at full health.
+void Generator::update_hero(PacketEntitiesWriter &packet, uint32_t id) {
+  uint32_t class_i = entities[id].class_i;
+
+  PropMap props;
+  set_random_props(class_i, 1 + random_below(options.props), props);
+
+  uint32_t health_index = prop_index(class_i, "DT_DOTA_BaseNPC.m_iHealth");
+  if (props.count(health_index) || chance(0.5)) {
+    int32_t &left = health[id];
+    left = left <= 0 ? HERO_HEALTH : std::max(0, left - (int32_t) random_below(250));
+
+    props[health_index] = int_prop(table(class_i).props[health_index], left);
+  }
+
+  update(packet, id, props);
+}
+
+void Generator::update_creep(PacketEntitiesWriter &packet, uint32_t id) {
+  PropMap props;
+  set_random_props(CI_Creep, 1 + random_below(options.props), props);
+
+  update(packet, id, props);
+}
+
+void Generator::write_signon(ReplayWriter &writer) {
+  CSVCMsg_ServerInfo info;
+  info.set_max_classes(MAX_CLASSES);
+
+  CDemoPacket server_info;
+  append_packet_message(*server_info.mutable_data(), svc_ServerInfo, info);
+  writer.write_frame(DEM_SignonPacket, 0, server_info, false);
+
+  std::vector<CSVCMsg_SendTable> tables;
+  make_send_tables(tables);
+
+  CDemoSendTables send_tables;
+  encode_send_tables(tables, send_tables);
+  writer.write_frame(DEM_SendTables, 0, send_tables, true);
+
+  CDemoClassInfo classes;
+  make_classes(classes);
+  writer.write_frame(DEM_ClassInfo, 0, classes, false);
+
+  // Every class gets a baseline with all of its props set.
+  for (uint32_t class_i = 0; class_i < MAX_CLASSES; ++class_i) {
+    const std::vector<const SendProp*> &props = table(class_i).props;
+
+    baselines.push_back(PropMap());
+    for (uint32_t i = 0; i < props.size(); ++i) {
+      baselines.back()[i] = random_prop(props[i]);
+    }
+
+    BitWriter stream;
+    ChangedProps changed = changed_props(baselines.back());
+    write_entity_props(stream, table(class_i), changed);
+
+    baseline_entries.push_back(StringTableEntry(std::to_string(class_i), stream.get_bytes()));
+  }
+
+  CSVCMsg_CreateStringTable baseline_table;
+  baseline_table.set_name("instancebaseline");
+  baseline_table.set_max_entries(64);
+  baseline_table.set_num_entries(baseline_entries.size());
+  baseline_table.set_string_data(encode_string_table(baseline_entries, 0, 6));
+
+  CDemoPacket baseline_packet;
+  append_packet_message(*baseline_packet.mutable_data(), svc_CreateStringTable, baseline_table);
+  writer.write_frame(DEM_SignonPacket, 0, baseline_packet, true);
+
+  CDemoSyncTick sync;
+  writer.write_frame(DEM_SyncTick, 0, sync, false);
+}
+
+// The first packet sets up the player resource and heroes, and later ones are deltas. Creeps
+// come and go, half of them deleted in the entries and half after them.
+void Generator::write_packet(ReplayWriter &writer, uint32_t tick) {
+  PacketEntitiesWriter packet(CLASS_BITS);
+  bool delta = tick > 1;
+
+  if (!delta) {
+    PropMap props;
+    for (uint32_t i = 0; i < std::min<uint32_t>(options.heroes, MAX_PLAYERS); ++i) {
+      char name[32];
+
+      sprintf(name, "m_iszPlayerNames.%04u", i);
+      uint32_t index = prop_index(CI_PlayerResource, name);
+      props[index] = string_prop(table(CI_PlayerResource).props[index],
+          PLAYER_NAMES[i % PLAYER_NAME_COUNT]);
+
+      // Which hero was selected is in the lower 11 bits, the upper ones get noise.
+      sprintf(name, "m_hSelectedHero.%04u", i);
+      index = prop_index(CI_PlayerResource, name);
+      props[index] = int_prop(table(CI_PlayerResource).props[index],
+          (FIRST_HERO_ID + i) | random_below(1 << 10) << 11);
+    }
+
+    enter(packet, PLAYER_RESOURCE_ID, CI_PlayerResource, props);
+
+    for (uint32_t i = 0; i < options.heroes; ++i) {
+      uint32_t id = FIRST_HERO_ID + i;
+      uint32_t class_i = i % 2 ? CI_Lina : CI_Axe;
+      uint32_t health_index = prop_index(class_i, "DT_DOTA_BaseNPC.m_iHealth");
+
+      health[id] = HERO_HEALTH;
+
+      PropMap hero_props;
+      hero_props[health_index] = int_prop(table(class_i).props[health_index], HERO_HEALTH);
+      enter(packet, id, class_i, hero_props);
+    }
+  } else {
+    if (tick % 50 == 0) {
+      char name[32];
+      sprintf(name, "m_iszPlayerNames.%04u", random_below(MAX_PLAYERS));
+
+      PropMap props;
+      uint32_t index = prop_index(CI_PlayerResource, name);
+      props[index] = string_prop(table(CI_PlayerResource).props[index], random_string());
+
+      update(packet, PLAYER_RESOURCE_ID, props);
+    }
+
+    for (uint32_t i = 0; i < options.heroes; ++i) {
+      if (chance(options.update_rate)) {
+        update_hero(packet, FIRST_HERO_ID + i);
+      }
+    }
+
+    for (uint32_t id = FIRST_CREEP_ID; id < FIRST_CREEP_ID + options.creeps; ++id) {
+      if (!chance(options.update_rate)) {
+        continue;
+      }
+
+      if (!entities.count(id)) {
+        PropMap props;
+        set_random_props(CI_Creep, random_below(options.props + 1), props);
+
+        enter(packet, id, CI_Creep, props);
+      } else if (chance(0.1)) {
+        if (chance(0.5)) {
+          packet.leave(id, true);
+        } else {
+          packet.remove(id);
+        }
+
+        entities.erase(id);
+      } else {
+        update_creep(packet, id);
+      }
+    }
+  }
+
+  CSVCMsg_PacketEntities entities_message;
+  packet.finish(delta, MAX_ENTITY_ID + 1, entities_message);
+
+  CDemoPacket frame;
+  append_packet_message(*frame.mutable_data(), svc_PacketEntities, entities_message);
+
+  // Half of the packets are compressed so both ways of reading them get used.
+  writer.write_frame(DEM_Packet, tick, frame, tick % 2 == 0);
+}
+
+// A snapshot of the string tables and every entity, which is where segments can start.
+void Generator::write_full_packet(ReplayWriter &writer, uint32_t tick) {
+  PacketEntitiesWriter packet(CLASS_BITS);
+
+  for (auto iter = entities.begin(); iter != entities.end(); ++iter) {
+    const SyntheticEntity &entity = iter->second;
+
+    ChangedProps changed = changed_props(entity.props);
+    packet.enter(iter->first, entity.class_i, entity.serial, table(entity.class_i), changed);
+  }
+
+  CSVCMsg_PacketEntities entities_message;
+  packet.finish(false, MAX_ENTITY_ID + 1, entities_message);
+
+  CDemoFullPacket full;
+  append_packet_message(*full.mutable_packet()->mutable_data(), svc_PacketEntities,
+      entities_message);
+
+  CDemoStringTables_table_t *snapshot = full.mutable_string_table()->add_tables();
+  snapshot->set_table_name("instancebaseline");
+  for (auto iter = baseline_entries.begin(); iter != baseline_entries.end(); ++iter) {
+    CDemoStringTables_items_t *item = snapshot->add_items();
+    item->set_str(iter->key);
+    item->set_data(iter->value);
+  }
+
+  writer.write_frame(DEM_FullPacket, tick, full, true);
+}
+
+void Generator::generate(const char *path) {
+  ReplayWriter writer(path);
+
+  write_signon(writer);
+
+  for (uint32_t tick = 1; tick <= options.ticks; ++tick) {
+    write_packet(writer, tick);
+
+    if (options.full_packet_interval && tick % options.full_packet_interval == 0) {
+      write_full_packet(writer, tick);
+    }
+  }
+
+  writer.close(options.ticks + 1);
+}
+
+// Props are compared by their encodings, which is exact without having to care about types.
+bool Generator::verify(const std::map<uint32_t, Entity> &parsed) const {
+  size_t errors = 0;
+
+  if (parsed.size() != entities.size()) {
+    std::cerr << "Expected " << entities.size() << " entities but the parse ended with " <<
+        parsed.size() << "." << std::endl;
+    ++errors;
+  }
+
+  for (auto iter = entities.begin(); iter != entities.end(); ++iter) {
+    const SyntheticEntity &expected = iter->second;
+
+    auto found = parsed.find(iter->first);
+    if (found == parsed.end() || found->second.clazz->id != expected.class_i) {
+      std::cerr << "Entity " << iter->first << " is missing or has the wrong class." << std::endl;
+      ++errors;
+      continue;
+    }
+
+    const Entity &entity = found->second;
+
+    PropMap props = baselines[expected.class_i];
+    for (auto prop = expected.props.begin(); prop != expected.props.end(); ++prop) {
+      props[prop->first] = prop->second;
+    }
+
+    if (entity.properties.size() != props.size()) {
+      std::cerr << "Entity " << iter->first << " has " << entity.properties.size() <<
+          " props instead of " << props.size() << "." << std::endl;
+      ++errors;
+    }
+
+    for (auto prop = props.begin(); prop != props.end(); ++prop) {
+      const SendProp *send_prop = entity.table->props[prop->first];
+
+      auto value = entity.properties.find(send_prop->qualified_name);
+      if (value == entity.properties.end()) {
+        std::cerr << "Entity " << iter->first << " has no " << send_prop->qualified_name <<
+            "." << std::endl;
+        ++errors;
+        continue;
+      }
+
+      BitWriter want;
+      Property::write_prop(want, send_prop, *prop->second);
+      BitWriter got;
+      Property::write_prop(got, send_prop, *value->second);
+
+      if (want.get_bytes() != got.get_bytes()) {
+        std::cerr << "Entity " << iter->first << " has the wrong " <<
+            send_prop->qualified_name << "." << std::endl;
+        ++errors;
+      }
+    }
+  }
+
+  return errors == 0;
+}
+
+// Remembers the last state of every entity and checks them at the end, while the strings
+// they point to are still around.
+class VerifyingVisitor : public Visitor {
+public:
+  VerifyingVisitor(const Generator &_generator) : generator(_generator), verified(false) {
+  }
+
+  virtual void visit_entity_created(const Entity &entity) {
+    entities[entity.id] = entity;
+  }
+
+  virtual void visit_entity_updated(const Entity &entity) {
+    entities[entity.id] = entity;
+  }
+
+  virtual void visit_entity_deleted(const Entity &entity) {
+    entities.erase(entity.id);
+  }
+
+  virtual void visit_replay_end(const char*) {
+    verified = generator.verify(entities);
+  }
+
+  const Generator &generator;
+  std::map<uint32_t, Entity> entities;
+  bool verified;
+};
+
+int main(int argc, char **argv) {
+  Options options;
+
+  int arg = 1;
+  while (arg < argc - 1) {
+    std::string flag(argv[arg]);
+
+    if (flag == "--ticks" && arg + 2 < argc) {
+      options.ticks = atoi(argv[arg + 1]);
+      arg += 2;
+    } else if (flag == "--heroes" && arg + 2 < argc) {
+      options.heroes = atoi(argv[arg + 1]);
+      arg += 2;
+    } else if (flag == "--creeps" && arg + 2 < argc) {
+      options.creeps = atoi(argv[arg + 1]);
+      arg += 2;
+    } else if (flag == "--update-rate" && arg + 2 < argc) {
+      options.update_rate = atof(argv[arg + 1]);
+      arg += 2;
+    } else if (flag == "--props" && arg + 2 < argc) {
+      options.props = atoi(argv[arg + 1]);
+      arg += 2;
+    } else if (flag == "--full-packet-interval" && arg + 2 < argc) {
+      options.full_packet_interval = atoi(argv[arg + 1]);
+      arg += 2;
+    } else if (flag == "--seed" && arg + 2 < argc) {
+      options.seed = atoi(argv[arg + 1]);
+      arg += 2;
+    } else if (flag == "--verify") {
+      options.verify = true;
+      arg += 1;
+    } else if (flag == "--pipeline") {
+      options.parse.pipeline = true;
+      arg += 1;
+    } else if (flag == "--batch-floats") {
+      options.parse.batch_floats = true;
+      arg += 1;
+    } else {
+      break;
+    }
+  }
+
+  if (arg != argc - 1) {
+    std::cerr << "Usage: " << argv[0] << " [--ticks n] [--heroes n] [--creeps n] " <<
+        "[--update-rate fraction] [--props n] [--full-packet-interval ticks] [--seed n] " <<
+        "[--verify [--pipeline] [--batch-floats]] out.dem" << std::endl;
+    return 1;
+  }
+
+  if (options.heroes < 1 || options.heroes > FIRST_CREEP_ID - FIRST_HERO_ID ||
+      FIRST_CREEP_ID + options.creeps > MAX_ENTITY_ID + 1 || options.props < 1) {
+    std::cerr << "Between 1 and " << FIRST_CREEP_ID - FIRST_HERO_ID << " heroes, at most " <<
+        MAX_ENTITY_ID + 1 - FIRST_CREEP_ID << " creeps and at least 1 prop please." <<
+        std::endl;
+    return 1;
+  }
+
+  std::vector<CSVCMsg_SendTable> tables;
+  make_send_tables(tables);
+  CDemoClassInfo classes;
+  make_classes(classes);
+
+  Schema schema;
+  build_schema(tables, classes, schema);
+
+  Generator generator(options, schema);
+  generator.generate(argv[arg]);
+
+  if (options.verify) {
+    VerifyingVisitor visitor(generator);
+    dump(argv[arg], visitor, options.parse);
+
+    if (!visitor.verified) {
+      return 1;
+    }
+
+    std::cerr << "Verified " << visitor.entities.size() << " entities." << std::endl;
+  }
+
+  return 0;
+}
@@ -0,0 +1,234 @@
+#include "aggregate.h"
+
+#include <algorithm>
+
+#include "debug.h"
+#include "property.h"
+#include "schema.h"
+#include "visitor.h"
+
+#define NO_SLOT ((uint32_t) -1)
+
+bool is_aggregatable_type(SP_Types type) {
+  return type == SP_Int || type == SP_Float || type == SP_Int64;
+}
+
+double aggregate_number(const SendProp &prop, const Property &property) {
+  if (prop.type == SP_Int) {
+    uint32_t value = static_cast<const IntProperty&>(property).value;
+    return (prop.flags & SP_Unsigned) ? (double) value : (double) (int32_t) value;
+  } else if (prop.type == SP_Float) {
+    return static_cast<const FloatProperty&>(property).value;
+  } else {
+    uint64_t value = static_cast<const Int64Property&>(property).value;
+    return (prop.flags & SP_Unsigned) ? (double) value : (double) (int64_t) value;
+  }
+}
+
+AggregateSet::AggregateSet() {
+}
+
+uint32_t AggregateSet::add(const std::string &class_prefix, const std::string &prop,
+    uint32_t window, AggregateKind kind) {
+  XASSERT(window > 0, "Aggregate windows have to be at least a tick long.");
+
+  Aggregate aggregate = {class_prefix, prop, window, kind};
+  aggregates.push_back(aggregate);
+
+  return aggregates.size() - 1;
+}
+
+// Like triggers, failures are reported per aggregate rather than per class.
+std::vector<std::string> AggregateSet::bind(const Schema &schema) {
+  std::vector<std::string> errors;
+
+  uint32_t max_id = 0;
+  for (auto iter = schema.classes.begin(); iter != schema.classes.end(); ++iter) {
+    max_id = std::max(max_id, iter->id);
+  }
+
+  bindings.assign(max_id + 1, std::vector<std::vector<uint32_t>>());
+  Window empty;
+  empty.first_tick = 0;
+  windows.assign(aggregates.size(), empty);
+
+  for (uint32_t i = 0; i < aggregates.size(); ++i) {
+    const Aggregate &aggregate = aggregates[i];
+
+    std::string error;
+    bool matched = false;
+
+    for (auto iter = schema.classes.begin(); iter != schema.classes.end(); ++iter) {
+      const Class &clazz = *iter;
+      if (clazz.name.compare(0, aggregate.class_prefix.size(), aggregate.class_prefix) != 0 ||
+          !clazz.flat_table) {
+        continue;
+      }
+
+      matched = true;
+
+      const std::vector<const SendProp*> &props = clazz.flat_table->props;
+      size_t index = 0;
+      while (index < props.size() && props[index]->qualified_name != aggregate.prop) {
+        ++index;
+      }
+
+      if (index == props.size()) {
+        if (error.empty()) {
+          error = "isn't a prop of " + clazz.name;
+        }
+        continue;
+      }
+
+      if (!is_aggregatable_type(props[index]->type)) {
+        if (error.empty()) {
+          error = "has send prop type " + std::to_string(props[index]->type) + " in " +
+              clazz.name + ", which isn't a number";
+        }
+        continue;
+      }
+
+      std::vector<std::vector<uint32_t>> &bound = bindings[clazz.id];
+      if (bound.empty()) {
+        bound.resize(props.size());
+      }
+
+      bound[index].push_back(i);
+    }
+
+    if (!matched) {
+      error = "has no class starting with " + aggregate.class_prefix;
+    }
+
+    if (!error.empty()) {
+      errors.push_back("Aggregate of " + aggregate.prop + " " + error + ".");
+    }
+  }
+
+  return errors;
+}
+
+bool AggregateSet::binds(uint32_t class_id) const {
+  return class_id < bindings.size() && !bindings[class_id].empty();
+}
+
+void AggregateSet::reset(uint32_t entity_id) {
+  for (auto iter = windows.begin(); iter != windows.end(); ++iter) {
+    if (entity_id < iter->slots.size()) {
+      iter->slots[entity_id] = NO_SLOT;
+    }
+  }
+}
+
+void AggregateSet::update(const Entity &entity, const ChangedProps &changed) {
+  const std::vector<std::vector<uint32_t>> &bound = bindings[entity.clazz->id];
+
+  for (auto iter = changed.begin(); iter != changed.end(); ++iter) {
+    const std::vector<uint32_t> &watching = bound[iter->first];
+    if (watching.empty()) {
+      continue;
+    }
+
+    double value = aggregate_number(*entity.table->props[iter->first], *iter->second);
+
+    for (auto aggregate = watching.begin(); aggregate != watching.end(); ++aggregate) {
+      Window &window = windows[*aggregate];
+      if (entity.id >= window.slots.size()) {
+        window.slots.resize(entity.id + 1, NO_SLOT);
+      }
+
+      uint32_t &slot = window.slots[entity.id];
+      if (slot == NO_SLOT) {
+        Accumulator accumulator = {entity.id, entity.clazz, 1, 1, value, value};
+        slot = window.open.size();
+        window.open.push_back(accumulator);
+        continue;
+      }
+
+      Accumulator &accumulator = window.open[slot];
+      ++accumulator.samples;
+      ++accumulator.count;
+      accumulator.last = value;
+
+      switch (aggregates[*aggregate].kind) {
+        case AK_Min:
+          accumulator.value = std::min(accumulator.value, value);
+          break;
+        case AK_Max:
+          accumulator.value = std::max(accumulator.value, value);
+          break;
+        case AK_Last:
+          accumulator.value = value;
+          break;
+        case AK_Mean:
+          accumulator.value += value;
+          break;
+      }
+    }
+  }
+}
+
+// Windows the ticks skip over still get records for the values carried through them, though
+// once nothing is carried the rest are skipped.
+void AggregateSet::advance(uint32_t tick, Visitor &visitor) {
+  for (uint32_t i = 0; i < windows.size(); ++i) {
+    Window &window = windows[i];
+    uint32_t length = aggregates[i].window;
+    uint32_t first_tick = tick - tick % length;
+
+    if (first_tick < window.first_tick) {
+      close(i, visitor);
+      window.first_tick = first_tick;
+    }
+
+    while (window.first_tick != first_tick) {
+      close(i, visitor);
+      window.first_tick = window.open.empty() ? first_tick : window.first_tick + length;
+    }
+  }
+}
+
+void AggregateSet::finish(Visitor &visitor) {
+  for (uint32_t i = 0; i < windows.size(); ++i) {
+    close(i, visitor);
+  }
+}
+
+void AggregateSet::close(uint32_t aggregate, Visitor &visitor) {
+  Window &window = windows[aggregate];
+
+  for (auto iter = window.open.begin(); iter != window.open.end(); ++iter) {
+    AggregateRecord record = {aggregate, iter->entity_id, iter->clazz, window.first_tick,
+        iter->samples, iter->value};
+
+    if (aggregates[aggregate].kind == AK_Mean) {
+      record.value /= iter->count;
+    }
+
+    visitor.visit_aggregate(record);
+  }
+
+  // Accumulators an entity was reset away from aren't carried on.
+  std::vector<Accumulator> &carried = window.next;
+  carried.clear();
+
+  for (uint32_t i = 0; i < window.open.size(); ++i) {
+    const Accumulator &accumulator = window.open[i];
+
+    if (window.slots[accumulator.entity_id] == i) {
+      Accumulator next = {accumulator.entity_id, accumulator.clazz, 0, 1, accumulator.last,
+          accumulator.last};
+      carried.push_back(next);
+    }
+  }
+
+  for (auto iter = window.open.begin(); iter != window.open.end(); ++iter) {
+    window.slots[iter->entity_id] = NO_SLOT;
+  }
+
+  for (uint32_t i = 0; i < carried.size(); ++i) {
+    window.slots[carried[i].entity_id] = i;
+  }
+
+  window.open.swap(carried);
+}
@@ -0,0 +1,122 @@
+#ifndef _AGGREGATE_H
+#define _AGGREGATE_H
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "entity.h"
+
+class Class;
+class Schema;
+class Visitor;
+
+enum AggregateKind {
+  AK_Min,
+  AK_Max,
+  AK_Last,
+  AK_Mean,
+};
+
+// One entity's aggregate over one window, passed to Visitor::visit_aggregate.
+struct AggregateRecord {
+  // The id the aggregate was registered under.
+  uint32_t aggregate;
+  uint32_t entity_id;
+  const Class *clazz;
+
+  // The window is the ticks from first_tick up to but not including first_tick plus the
+  // aggregate's window.
+  uint32_t first_tick;
+
+  // How many values were written in the window, and what they aggregate to along with the value
+  // carried into it, if any. Samples is 0 for a window the entity's prop wasn't written in.
+  uint32_t samples;
+  double value;
+};
+
+// Numeric props of the entities of some classes, reduced to one value per entity per window of
+// ticks as the parser writes them, so consumers that only want per-second or per-minute numbers
+// don't have to look at every update. Attach sets with Parser::add_aggregates.
+//
+// Windows are aligned to multiples of their length in ticks, and a window's records are passed
+// to Visitor::visit_aggregate before visit_tick for the first tick after it, or before
+// visit_replay_end. Every entity that has a value for the prop gets a record for each window
+// it's alive in, even windows its prop isn't written in. Each window starts from the value the
+// prop had when it began and adds every value written during it, including the values an
+// entity is created with but not the baseline values they replace, so the mean of a prop that
+// doesn't change is that value. Like triggers, props are named by qualified name, a set covers
+// every class whose name starts with class_prefix, and ints are signed unless the prop is
+// unsigned.
+class AggregateSet {
+public:
+  AggregateSet();
+
+  uint32_t add(const std::string &class_prefix, const std::string &prop, uint32_t window,
+      AggregateKind kind);
+
+  // Returns a message for each aggregate that couldn't be bound. Those never produce records.
+  std::vector<std::string> bind(const Schema &schema);
+  bool binds(uint32_t class_id) const;
+
+  // Starts a new aggregate for an entity, for when it's deleted or a new one takes its id. What
+  // the old one had so far is still passed on when its window ends, but it isn't carried into
+  // the next.
+  void reset(uint32_t entity_id);
+
+  // Adds the changed props of an entity to its aggregates in the current window.
+  void update(const Entity &entity, const ChangedProps &changed);
+
+  // Passes on the records of every window that ends before tick.
+  void advance(uint32_t tick, Visitor &visitor);
+
+  // Passes on the records of the current windows, for the end of a replay.
+  void finish(Visitor &visitor);
+
+private:
+  struct Aggregate {
+    std::string class_prefix;
+    std::string prop;
+    uint32_t window;
+    AggregateKind kind;
+  };
+
+  // Count is how many values are in the aggregate, which is one more than samples if the window
+  // started with a carried value. Last is the latest of them, for carrying into the next window.
+  struct Accumulator {
+    uint32_t entity_id;
+    const Class *clazz;
+    uint32_t samples;
+    uint32_t count;
+    double value;
+    double last;
+  };
+
+  // The accumulators of one aggregate in its current window, and which one each entity id is
+  // adding to, or -1. Closing a window starts the next with the last value of each entity that's
+  // still adding to its accumulator.
+  struct Window {
+    uint32_t first_tick;
+    std::vector<Accumulator> open;
+    std::vector<uint32_t> slots;
+
+    // Where the next window's accumulators are gathered, kept to reuse its memory.
+    std::vector<Accumulator> next;
+  };
+
+  AggregateSet(const AggregateSet&);
+  AggregateSet &operator=(const AggregateSet&);
+
+  void close(uint32_t aggregate, Visitor &visitor);
+
+  std::vector<Aggregate> aggregates;
+
+  // For each class id, the aggregates on each flat prop index. Empty for classes that aren't
+  // covered.
+  std::vector<std::vector<std::vector<uint32_t>>> bindings;
+
+  std::vector<Window> windows;
+};
+
+#endif
@@ -0,0 +1,183 @@
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "debug.h"
+#include "demo.h"
+#include "edith.h"
+#include "visitor.h"
+
+// Each worker starts with its own share of the files and takes from the front of it. Once that
+// runs out it steals from the back of someone else's, so one long replay doesn't leave the
+// files queued behind it waiting.
+class WorkQueue {
+public:
+  void push(size_t item) {
+    std::lock_guard<std::mutex> guard(lock);
+    items.push_back(item);
+  }
+
+  bool pop(size_t *item) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (items.empty()) {
+      return false;
+    }
+
+    *item = items.front();
+    items.pop_front();
+    return true;
+  }
+
+  bool steal(size_t *item) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (items.empty()) {
+      return false;
+    }
+
+    *item = items.back();
+    items.pop_back();
+    return true;
+  }
+
+private:
+  std::mutex lock;
+  std::deque<size_t> items;
+};
+
+bool next_file(std::vector<WorkQueue> &queues, size_t worker, size_t *item) {
+  if (queues[worker].pop(item)) {
+    return true;
+  }
+
+  // Nothing is ever added once the workers start, so finding every queue empty means we're done.
+  for (size_t i = 1; i < queues.size(); ++i) {
+    if (queues[(worker + i) % queues.size()].steal(item)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Failures are appended to errors as they happen, so they're in no particular order.
+void run_worker(const std::vector<std::string> &files, std::vector<WorkQueue> &queues,
+    size_t worker, Visitor *visitor, const ParseOptions &options,
+    std::vector<ParseError> &errors, std::mutex &errors_lock) {
+  Parser parser(options);
+
+  size_t item;
+  while (next_file(queues, worker, &item)) {
+    if (!parser.parse(files[item].c_str(), *visitor)) {
+      std::lock_guard<std::mutex> guard(errors_lock);
+      errors.push_back(parser.error());
+    }
+  }
+}
+
+std::vector<ParseError> dump_batch(const std::vector<std::string> &files,
+    const std::vector<Visitor*> &visitors, const ParseOptions &options) {
+  XASSERT(!visitors.empty(), "Need at least one visitor.");
+
+  std::vector<WorkQueue> queues(visitors.size());
+  for (size_t i = 0; i < files.size(); ++i) {
+    queues[i % queues.size()].push(i);
+  }
+
+  std::vector<ParseError> errors;
+  std::mutex errors_lock;
+
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < visitors.size(); ++i) {
+    workers.push_back(std::thread(run_worker, std::cref(files), std::ref(queues), i,
+        visitors[i], std::cref(options), std::ref(errors), std::ref(errors_lock)));
+  }
+
+  run_worker(files, queues, 0, visitors[0], options, errors, errors_lock);
+
+  for (auto iter = workers.begin(); iter != workers.end(); ++iter) {
+    iter->join();
+  }
+
+  return errors;
+}
+
+std::vector<size_t> find_full_packets(const char *file) {
+  std::vector<size_t> offsets;
+
+  Demo demo(file);
+  while (!demo.eof()) {
+    size_t offset = demo.tell();
+
+    int tick;
+    bool compressed;
+    if (demo.get_message_type(&tick, &compressed) == DEM_FullPacket) {
+      offsets.push_back(offset);
+    }
+
+    demo.skip_message();
+  }
+
+  return offsets;
+}
+
+std::vector<ParseError> dump_segmented(const char *file, const std::function<Visitor *()> &create,
+    const std::function<void (Visitor&)> &merge, const ParseOptions &options,
+    size_t threads) {
+  // Segment i runs from starts[i] to starts[i + 1], and the last one to the end of the file.
+  std::vector<size_t> starts = find_full_packets(file);
+  starts.insert(starts.begin(), 0);
+  starts.push_back(-1);
+
+  std::vector<std::unique_ptr<Visitor>> visitors;
+  for (size_t i = 0; i + 1 < starts.size(); ++i) {
+    visitors.push_back(std::unique_ptr<Visitor>(create()));
+  }
+
+  if (threads == 0) {
+    threads = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+  threads = std::min(threads, visitors.size());
+
+  // Each piece only writes its own slot.
+  std::vector<ParseError> errors(visitors.size());
+  std::vector<char> ok(visitors.size());
+
+  std::atomic<size_t> next(0);
+  auto run = [&]() {
+    Parser parser(options);
+
+    size_t i;
+    while ((i = next++) < visitors.size()) {
+      ok[i] = parser.parse_segment(file, starts[i], starts[i + 1], *visitors[i]);
+      if (!ok[i]) {
+        errors[i] = parser.error();
+      }
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < threads; ++i) {
+    workers.push_back(std::thread(run));
+  }
+
+  run();
+
+  for (auto iter = workers.begin(); iter != workers.end(); ++iter) {
+    iter->join();
+  }
+
+  std::vector<ParseError> failures;
+  for (size_t i = 0; i < visitors.size(); ++i) {
+    if (ok[i]) {
+      merge(*visitors[i]);
+    } else {
+      failures.push_back(errors[i]);
+    }
+  }
+
+  return failures;
+}
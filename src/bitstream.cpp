@@ -101,3 +101,59 @@ uint32_t Bitstream::read_var_uint() {
   return value;
 }
 
+
+BitWriter::BitWriter() : position(0) {
+}
+
+size_t BitWriter::get_position() const {
+  return position;
+}
+
+const std::string &BitWriter::get_bytes() const {
+  return bytes;
+}
+
+void BitWriter::put_bits(uint32_t value, size_t n) {
+  XASSERT(n <= 32, "Only 32 or fewer bits are supported.");
+
+  for (size_t i = 0; i < n; ++i) {
+    if (position % 8 == 0) {
+      bytes.push_back(0);
+    }
+
+    if ((value >> i) & 1) {
+      bytes[position / 8] |= 1 << (position % 8);
+    }
+
+    ++position;
+  }
+}
+
+void BitWriter::write_bits(const void *buffer, size_t bit_length) {
+  const unsigned char *data = reinterpret_cast<const unsigned char *>(buffer);
+
+  size_t i = 0;
+  while (bit_length >= 8) {
+    put_bits(data[i++], 8);
+    bit_length -= 8;
+  }
+
+  if (bit_length > 0) {
+    put_bits(data[i], bit_length);
+  }
+}
+
+void BitWriter::write_string(const char *string) {
+  do {
+    put_bits((unsigned char) *string, 8);
+  } while (*string++);
+}
+
+void BitWriter::write_var_uint(uint32_t value) {
+  do {
+    uint32_t lower = value & 0x7F;
+    value >>= 7;
+
+    put_bits(lower | (value ? 0x80 : 0), 8);
+  } while (value);
+}
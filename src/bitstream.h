@@ -28,4 +28,23 @@ class Bitstream {
     size_t end;
 };
 
+// The inverse of Bitstream: bits are packed from the lowest bit of each byte up.
+class BitWriter {
+  public:
+    BitWriter();
+
+    size_t get_position() const;
+    const std::string &get_bytes() const;
+
+    void put_bits(uint32_t value, size_t n);
+    void write_bits(const void *buffer, size_t bit_length);
+    // Writes up to and including the terminating null, like read_string reads.
+    void write_string(const char *string);
+    void write_var_uint(uint32_t value);
+
+  private:
+    std::string bytes;
+    size_t position;
+};
+
 #endif
@@ -0,0 +1,80 @@
+#include "class_dispatcher.h"
+
+#include <algorithm>
+
+#include "entity.h"
+#include "schema.h"
+
+void ClassDispatcher::on_class(const std::string &name, const Handler &handler,
+    unsigned events) {
+  on_classes([name](const Class &clazz) {
+    return clazz.name == name;
+  }, handler, events);
+}
+
+void ClassDispatcher::on_class_prefix(const std::string &prefix, const Handler &handler,
+    unsigned events) {
+  on_classes([prefix](const Class &clazz) {
+    return clazz.name.compare(0, prefix.size(), prefix) == 0;
+  }, handler, events);
+}
+
+void ClassDispatcher::on_classes(const ClassPredicate &predicate, const Handler &handler,
+    unsigned events) {
+  Registration registration = {predicate, handler, events};
+  registrations.push_back(registration);
+}
+
+void ClassDispatcher::visit_schema(const Schema &schema) {
+  uint32_t max_id = 0;
+  for (auto iter = schema.classes.begin(); iter != schema.classes.end(); ++iter) {
+    max_id = std::max(max_id, iter->id);
+  }
+
+  for (size_t event = 0; event < 3; ++event) {
+    handlers[event].assign(max_id + 1, std::vector<size_t>());
+  }
+
+  for (auto iter = schema.classes.begin(); iter != schema.classes.end(); ++iter) {
+    for (size_t i = 0; i < registrations.size(); ++i) {
+      if (!registrations[i].matches(*iter)) {
+        continue;
+      }
+
+      for (size_t event = 0; event < 3; ++event) {
+        if (registrations[i].events & (1 << event)) {
+          handlers[event][iter->id].push_back(i);
+        }
+      }
+    }
+  }
+}
+
+void ClassDispatcher::dispatch(size_t event, const Entity &entity) {
+  // Deletes are also reported for ids that were never set up.
+  if (entity.id == (uint32_t) -1 || !entity.clazz) {
+    return;
+  }
+
+  const std::vector<std::vector<size_t>> &by_class = handlers[event];
+  if (entity.clazz->id >= by_class.size()) {
+    return;
+  }
+
+  const std::vector<size_t> &indices = by_class[entity.clazz->id];
+  for (auto iter = indices.begin(); iter != indices.end(); ++iter) {
+    registrations[*iter].handler(entity);
+  }
+}
+
+void ClassDispatcher::visit_entity_created(const Entity &entity) {
+  dispatch(0, entity);
+}
+
+void ClassDispatcher::visit_entity_updated(const Entity &entity) {
+  dispatch(1, entity);
+}
+
+void ClassDispatcher::visit_entity_deleted(const Entity &entity) {
+  dispatch(2, entity);
+}
@@ -0,0 +1,58 @@
+#ifndef _CLASS_DISPATCHER_H
+#define _CLASS_DISPATCHER_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "visitor.h"
+
+class Class;
+
+// A visitor that only passes on entity events for the classes something registered for. Which
+// handlers go with which class is worked out once per replay when its schema shows up, so an
+// event costs a table lookup by class id instead of comparing class names. Register everything
+// before parsing. Subclasses that override visit_schema or visit_entity_* have to call the
+// versions here.
+class ClassDispatcher : public Visitor {
+public:
+  typedef std::function<void (const Entity&)> Handler;
+  typedef std::function<bool (const Class&)> ClassPredicate;
+
+  enum EntityEvent {
+    EE_Created = 1 << 0,
+    EE_Updated = 1 << 1,
+    EE_Deleted = 1 << 2,
+  };
+
+  // Handlers get the events in the events mask for every matching class, in the order they
+  // were registered.
+  void on_class(const std::string &name, const Handler &handler,
+      unsigned events = EE_Created | EE_Updated);
+  void on_class_prefix(const std::string &prefix, const Handler &handler,
+      unsigned events = EE_Created | EE_Updated);
+  void on_classes(const ClassPredicate &predicate, const Handler &handler,
+      unsigned events = EE_Created | EE_Updated);
+
+  virtual void visit_schema(const Schema &schema);
+
+  virtual void visit_entity_created(const Entity &entity);
+  virtual void visit_entity_updated(const Entity &entity);
+  virtual void visit_entity_deleted(const Entity &entity);
+
+private:
+  struct Registration {
+    ClassPredicate matches;
+    Handler handler;
+    unsigned events;
+  };
+
+  void dispatch(size_t event, const Entity &entity);
+
+  std::vector<Registration> registrations;
+
+  // For each event and then each class id, indices into registrations.
+  std::vector<std::vector<size_t>> handlers[3];
+};
+
+#endif
@@ -0,0 +1,484 @@
+#include "column_export.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "debug.h"
+#include "entity.h"
+#include "property.h"
+
+#define COLUMN_MAGIC "EDITHCOL"
+
+enum ColumnEncoding {
+  CE_PackedInts = 0,
+  CE_Floats = 1,
+};
+
+enum RowKind {
+  RK_Value = 0,
+  RK_End = 1,
+};
+
+void put_u8(std::string &out, uint8_t value) {
+  out.push_back((char) value);
+}
+
+void put_u32(std::string &out, uint32_t value) {
+  for (size_t i = 0; i < 4; ++i) {
+    out.push_back((char) (value >> (8 * i)));
+  }
+}
+
+void put_string(std::string &out, const std::string &value) {
+  uint32_t length = value.size();
+  do {
+    uint8_t b = length & 0x7F;
+    length >>= 7;
+    out.push_back((char) (length ? b | 0x80 : b));
+  } while (length);
+
+  out.append(value);
+}
+
+void put_record(std::ostream &out, char type, const std::string &payload) {
+  std::string header;
+  put_u8(header, type);
+  put_u32(header, payload.size());
+
+  out.write(header.data(), header.size());
+  out.write(payload.data(), payload.size());
+}
+
+void put_packed_ints(std::string &out, const std::vector<uint64_t> &values) {
+  std::vector<uint64_t> zigzag(values.size());
+
+  uint64_t previous = 0;
+  uint64_t all = 0;
+  for (size_t i = 0; i < values.size(); ++i) {
+    uint64_t delta = values[i] - previous;
+    zigzag[i] = (delta << 1) ^ (uint64_t) ((int64_t) delta >> 63);
+    all |= zigzag[i];
+    previous = values[i];
+  }
+
+  uint8_t width = 0;
+  while (width < 64 && (all >> width)) {
+    ++width;
+  }
+
+  std::string data;
+  put_u8(data, width);
+
+  uint8_t byte = 0;
+  size_t used = 0;
+  for (size_t i = 0; i < zigzag.size(); ++i) {
+    for (size_t bit = 0; bit < width; ) {
+      size_t take = std::min<size_t>(width - bit, 8 - used);
+
+      byte |= ((zigzag[i] >> bit) & ((1u << take) - 1)) << used;
+      used += take;
+      bit += take;
+
+      if (used == 8) {
+        put_u8(data, byte);
+        byte = 0;
+        used = 0;
+      }
+    }
+  }
+
+  if (used) {
+    put_u8(data, byte);
+  }
+
+  put_u8(out, CE_PackedInts);
+  put_u32(out, data.size());
+  out.append(data);
+}
+
+void put_floats(std::string &out, const std::vector<float> &values) {
+  put_u8(out, CE_Floats);
+  put_u32(out, values.size() * 4);
+
+  for (size_t i = 0; i < values.size(); ++i) {
+    uint32_t bits;
+    memcpy(&bits, &values[i], sizeof(bits));
+    put_u32(out, bits);
+  }
+}
+
+size_t float_components(int type) {
+  if (type == SP_Float) {
+    return 1;
+  } else if (type == SP_VectorXY) {
+    return 2;
+  } else if (type == SP_Vector) {
+    return 3;
+  } else {
+    return 0;
+  }
+}
+
+ColumnExporter::ColumnExporter(const std::string &path, size_t _chunk_rows) :
+    chunk_rows(_chunk_rows), tick(0), closed(false), write_failed(false) {
+  out.open(path.c_str(), std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+  XASSERT(out.is_open(), "Can't open %s.", path.c_str());
+
+  std::string header(COLUMN_MAGIC);
+  put_u32(header, COLUMN_FORMAT_VERSION);
+  out.write(header.data(), header.size());
+
+  writer = std::thread(&ColumnExporter::run_writer, this);
+}
+
+ColumnExporter::~ColumnExporter() {
+  close();
+}
+
+void ColumnExporter::add_series(const std::string &class_prefix, const std::string &prop) {
+  Series added;
+  added.class_prefix = class_prefix;
+  added.prop = prop;
+  added.type = -1;
+  added.is_signed = false;
+  added.count = 0;
+
+  series.push_back(added);
+}
+
+bool ColumnExporter::close() {
+  if (closed) {
+    return !write_failed;
+  }
+
+  flush_all();
+
+  Job *end = new Job();
+  end->type = 'E';
+  submit(end);
+
+  writer.join();
+  out.close();
+
+  write_failed |= out.fail();
+  closed = true;
+
+  return !write_failed;
+}
+
+const std::vector<std::string> &ColumnExporter::errors() const {
+  return series_errors;
+}
+
+void ColumnExporter::visit_replay_start(const char *file) {
+  flush_all();
+
+  Job *job = new Job();
+  job->type = 'R';
+  put_string(job->payload, file);
+  submit(job);
+
+  class_series.clear();
+  for (auto iter = series.begin(); iter != series.end(); ++iter) {
+    iter->last.clear();
+  }
+}
+
+// Problems are reported once per series rather than per class.
+void ColumnExporter::visit_schema(const Schema &schema) {
+  uint32_t max_id = 0;
+  for (auto iter = schema.classes.begin(); iter != schema.classes.end(); ++iter) {
+    max_id = std::max(max_id, iter->id);
+  }
+
+  class_series.assign(max_id + 1, std::vector<uint32_t>());
+  series_errors.clear();
+
+  for (uint32_t i = 0; i < series.size(); ++i) {
+    Series &s = series[i];
+
+    std::string error;
+    bool matched = false;
+
+    for (auto iter = schema.classes.begin(); iter != schema.classes.end(); ++iter) {
+      const Class &clazz = *iter;
+      if (clazz.name.compare(0, s.class_prefix.size(), s.class_prefix) != 0 ||
+          !clazz.flat_table) {
+        continue;
+      }
+
+      matched = true;
+
+      const SendProp *prop = 0;
+      const std::vector<const SendProp*> &props = clazz.flat_table->props;
+      for (size_t j = 0; j < props.size() && !prop; ++j) {
+        if (props[j]->qualified_name == s.prop) {
+          prop = props[j];
+        }
+      }
+
+      if (!prop) {
+        if (error.empty()) {
+          error = "isn't a prop of " + clazz.name;
+        }
+        continue;
+      } else if (prop->type == SP_Array) {
+        if (error.empty()) {
+          error = "is an array";
+        }
+        continue;
+      }
+
+      bool is_signed = (prop->type == SP_Int || prop->type == SP_Int64) &&
+          !(prop->flags & SP_Unsigned);
+
+      if (s.type == -1) {
+        s.type = prop->type;
+        s.is_signed = is_signed;
+
+        Job *job = new Job();
+        job->type = 'S';
+        put_u32(job->payload, i);
+        put_string(job->payload, s.class_prefix);
+        put_string(job->payload, s.prop);
+        put_u8(job->payload, s.type);
+        put_u8(job->payload, s.is_signed ? 1 : 0);
+        submit(job);
+      } else if (s.type != prop->type || s.is_signed != is_signed) {
+        if (error.empty()) {
+          error = "has a different type in " + clazz.name;
+        }
+        continue;
+      }
+
+      class_series[clazz.id].push_back(i);
+    }
+
+    if (!matched) {
+      error = "has no class starting with " + s.class_prefix;
+    }
+
+    if (!error.empty()) {
+      series_errors.push_back("Can't export " + s.prop + ", it " + error + ".");
+    }
+  }
+}
+
+void ColumnExporter::visit_tick(uint32_t _tick) {
+  tick = _tick;
+}
+
+void ColumnExporter::visit_entity_created(const Entity &entity) {
+  record(entity, true);
+}
+
+void ColumnExporter::visit_entity_updated(const Entity &entity) {
+  record(entity, false);
+}
+
+// Ends the entity's series so a reader can tell it apart from a new entity that gets its id.
+void ColumnExporter::visit_entity_deleted(const Entity &entity) {
+  // Deletes are also reported for ids that were never set up.
+  if (entity.id == (uint32_t) -1 || entity.clazz->id >= class_series.size()) {
+    return;
+  }
+
+  const std::vector<uint32_t> &covering = class_series[entity.clazz->id];
+  for (auto iter = covering.begin(); iter != covering.end(); ++iter) {
+    Series &s = series[*iter];
+    if (entity.id >= s.last.size() || !s.last[entity.id].set) {
+      continue;
+    }
+
+    add_row(*iter, entity.id, RK_End, s.last[entity.id]);
+    s.last[entity.id].set = false;
+  }
+}
+
+void ColumnExporter::record(const Entity &entity, bool created) {
+  if (entity.clazz->id >= class_series.size()) {
+    return;
+  }
+
+  const std::vector<uint32_t> &covering = class_series[entity.clazz->id];
+  for (auto iter = covering.begin(); iter != covering.end(); ++iter) {
+    Series &s = series[*iter];
+
+    auto found = entity.properties.find(s.prop);
+    if (found == entity.properties.end()) {
+      continue;
+    }
+
+    const Property &property = *found->second;
+
+    LastValue value = {true, {0, 0}};
+    size_t components = float_components(s.type);
+
+    if (components) {
+      float floats[3] = {0, 0, 0};
+      if (s.type == SP_Float) {
+        floats[0] = static_cast<const FloatProperty&>(property).value;
+      } else if (s.type == SP_VectorXY) {
+        std::copy(static_cast<const VectorXYProperty&>(property).values,
+            static_cast<const VectorXYProperty&>(property).values + 2, floats);
+      } else {
+        std::copy(static_cast<const VectorProperty&>(property).values,
+            static_cast<const VectorProperty&>(property).values + 3, floats);
+      }
+
+      uint32_t bits[3] = {0, 0, 0};
+      memcpy(bits, floats, components * sizeof(float));
+      value.key[0] = ((uint64_t) bits[1] << 32) | bits[0];
+      value.key[1] = bits[2];
+    } else if (s.type == SP_Int) {
+      uint32_t bits = static_cast<const IntProperty&>(property).value;
+      value.key[0] = s.is_signed ? (uint64_t) (int64_t) (int32_t) bits : bits;
+    } else if (s.type == SP_Int64) {
+      value.key[0] = static_cast<const Int64Property&>(property).value;
+    } else if (s.type == SP_String) {
+      const std::string &string = static_cast<const StringProperty&>(property).value;
+
+      auto entry = s.dictionary.find(string);
+      if (entry == s.dictionary.end()) {
+        entry = s.dictionary.insert(std::make_pair(string, (uint32_t) s.dictionary.size())).first;
+        s.new_strings.push_back(string);
+      }
+
+      value.key[0] = entry->second;
+    }
+
+    if (entity.id >= s.last.size()) {
+      LastValue unset = {false, {0, 0}};
+      s.last.resize(entity.id + 1, unset);
+    }
+
+    LastValue &last = s.last[entity.id];
+    if (!created && last.set && last.key[0] == value.key[0] && last.key[1] == value.key[1]) {
+      continue;
+    }
+
+    last = value;
+    add_row(*iter, entity.id, RK_Value, value);
+  }
+}
+
+// Floats are stored in the value's key as their bits.
+void ColumnExporter::add_row(uint32_t series_id, uint32_t entity_id, uint64_t kind,
+    const LastValue &value) {
+  Series &s = series[series_id];
+
+  s.rows.ticks.push_back(tick);
+  s.rows.entities.push_back(entity_id);
+  s.rows.kinds.push_back(kind);
+
+  size_t components = float_components(s.type);
+  if (components) {
+    uint32_t bits[3] = {(uint32_t) value.key[0], (uint32_t) (value.key[0] >> 32),
+        (uint32_t) value.key[1]};
+    float floats[3];
+    memcpy(floats, bits, sizeof(floats));
+
+    for (size_t i = 0; i < components; ++i) {
+      s.rows.floats[i].push_back(floats[i]);
+    }
+  } else {
+    s.rows.ints.push_back(value.key[0]);
+  }
+
+  if (++s.count == chunk_rows) {
+    flush(series_id);
+  }
+}
+
+void ColumnExporter::flush(uint32_t series_id) {
+  Series &s = series[series_id];
+  if (s.count == 0) {
+    return;
+  }
+
+  Job *job = new Job();
+  job->type = 'C';
+  job->series = series_id;
+  job->value_type = s.type;
+  job->count = s.count;
+  std::swap(job->rows, s.rows);
+  std::swap(job->new_strings, s.new_strings);
+  submit(job);
+
+  s.count = 0;
+}
+
+void ColumnExporter::flush_all() {
+  for (uint32_t i = 0; i < series.size(); ++i) {
+    flush(i);
+  }
+}
+
+void ColumnExporter::submit(Job *job) {
+  XASSERT(!closed, "Exporter is closed.");
+
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    jobs.push_back(std::unique_ptr<Job>(job));
+  }
+
+  ready.notify_one();
+}
+
+void ColumnExporter::run_writer() {
+  while (true) {
+    std::unique_ptr<Job> job;
+
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      ready.wait(guard, [this]() { return !jobs.empty(); });
+
+      job = std::move(jobs.front());
+      jobs.pop_front();
+    }
+
+    write_job(*job);
+    write_failed |= !out;
+
+    if (job->type == 'E') {
+      break;
+    }
+  }
+}
+
+void ColumnExporter::write_job(const Job &job) {
+  if (job.type != 'C') {
+    put_record(out, job.type, job.payload);
+    return;
+  }
+
+  if (!job.new_strings.empty()) {
+    std::string dictionary;
+    put_u32(dictionary, job.series);
+    put_u32(dictionary, job.new_strings.size());
+    for (auto iter = job.new_strings.begin(); iter != job.new_strings.end(); ++iter) {
+      put_string(dictionary, *iter);
+    }
+
+    put_record(out, 'D', dictionary);
+  }
+
+  std::string chunk;
+  put_u32(chunk, job.series);
+  put_u32(chunk, job.count);
+  put_packed_ints(chunk, job.rows.ticks);
+  put_packed_ints(chunk, job.rows.entities);
+  put_packed_ints(chunk, job.rows.kinds);
+
+  size_t components = float_components(job.value_type);
+  if (components) {
+    for (size_t i = 0; i < components; ++i) {
+      put_floats(chunk, job.rows.floats[i]);
+    }
+  } else {
+    put_packed_ints(chunk, job.rows.ints);
+  }
+
+  put_record(out, 'C', chunk);
+}
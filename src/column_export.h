@@ -0,0 +1,145 @@
+#ifndef _COLUMN_EXPORT_H
+#define _COLUMN_EXPORT_H
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "schema.h"
+#include "visitor.h"
+
+#define COLUMN_CHUNK_ROWS 65536
+#define COLUMN_FORMAT_VERSION 2
+
+// Writes the values of chosen (class, prop) series to a columnar file as the replay is parsed.
+// A row is written when an entity of a matching class is created, when an update changes a
+// series' value, and to end the series when the entity is deleted. Rows are buffered per series
+// and handed to a writer thread in chunks, which encodes and writes them, so the parse never
+// waits on the disk.
+//
+// The file starts with the 8 bytes "EDITHCOL" and a uint32 format version, followed by records.
+// Integers are little-endian, strings are a varint length followed by the bytes, and each record
+// is a one byte type, a uint32 payload length and the payload:
+//
+//   'R' replay: string file. Everything up to the next 'R' is from this replay.
+//   'S' series: uint32 series id, string class prefix, string prop, uint8 SP_Types of the prop,
+//       uint8 1 if integers are signed and 0 if not.
+//   'D' dictionary: uint32 series id, uint32 count, then count strings. String series store
+//       indices into a dictionary per series, which these are appended to.
+//   'C' chunk: uint32 series id, uint32 rows, then the columns tick, entity id, row kind and the
+//       value's columns (x, y and z for vectors, x and y for VectorXY, dictionary indices for
+//       strings). Kind 0 is a value, kind 1 ends the entity's series because it was deleted and
+//       repeats its last value. Rows after that for the same id are from a new entity.
+//   'E' end of file.
+//
+// Each column is a uint8 encoding, a uint32 byte length and the data. Encoding 0 is integers:
+// a uint8 bit width, then for each row the difference from the previous row's value (starting
+// from 0), zigzag encoded and packed into that many bits starting from the low bit of each
+// byte. Values are taken as 64 bit two's complement, so signed ints are sign extended and the
+// differences wrap. Encoding 1 is raw 32 bit floats.
+class ColumnExporter : public Visitor {
+public:
+  ColumnExporter(const std::string &path, size_t _chunk_rows = COLUMN_CHUNK_ROWS);
+  ~ColumnExporter();
+
+  // Exports prop, a qualified prop name, for every class whose name starts with class_prefix.
+  // Add every series before parsing.
+  void add_series(const std::string &class_prefix, const std::string &prop);
+
+  // Writes out everything buffered and waits for the writer to finish. Returns false if any of
+  // the file couldn't be written. Nothing can be exported afterwards.
+  bool close();
+
+  // Why series couldn't be exported for the last schema. Those have no rows for that replay.
+  const std::vector<std::string> &errors() const;
+
+  virtual void visit_replay_start(const char *file);
+  virtual void visit_schema(const Schema &schema);
+  virtual void visit_tick(uint32_t tick);
+
+  virtual void visit_entity_created(const Entity &entity);
+  virtual void visit_entity_updated(const Entity &entity);
+  virtual void visit_entity_deleted(const Entity &entity);
+
+private:
+  // What a row's value was for an entity, to tell whether an update changed it.
+  struct LastValue {
+    bool set;
+    uint64_t key[2];
+  };
+
+  struct Rows {
+    std::vector<uint64_t> ticks;
+    std::vector<uint64_t> entities;
+    std::vector<uint64_t> kinds;
+    std::vector<uint64_t> ints;
+    std::vector<float> floats[3];
+  };
+
+  struct Series {
+    std::string class_prefix;
+    std::string prop;
+    int type;
+    bool is_signed;
+
+    Rows rows;
+    size_t count;
+
+    std::unordered_map<std::string, uint32_t> dictionary;
+    std::vector<std::string> new_strings;
+
+    std::vector<LastValue> last;
+  };
+
+  // A record for the writer thread. Chunks are encoded there, everything else is ready to go.
+  struct Job {
+    char type;
+    std::string payload;
+
+    uint32_t series;
+    int value_type;
+    size_t count;
+    Rows rows;
+    std::vector<std::string> new_strings;
+  };
+
+  ColumnExporter(const ColumnExporter&);
+  ColumnExporter &operator=(const ColumnExporter&);
+
+  void record(const Entity &entity, bool created);
+  void add_row(uint32_t series_id, uint32_t entity_id, uint64_t kind, const LastValue &value);
+  void flush(uint32_t series_id);
+  void flush_all();
+  void submit(Job *job);
+  void run_writer();
+  void write_job(const Job &job);
+
+  size_t chunk_rows;
+  uint32_t tick;
+  bool closed;
+
+  // Set by the writer thread, and only read once it's finished.
+  bool write_failed;
+
+  std::vector<Series> series;
+
+  // For each class id, the series covering it.
+  std::vector<std::vector<uint32_t>> class_series;
+  std::vector<std::string> series_errors;
+
+  std::ofstream out;
+  std::mutex lock;
+  std::condition_variable ready;
+  std::deque<std::unique_ptr<Job>> jobs;
+  std::thread writer;
+};
+
+#endif
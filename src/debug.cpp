@@ -4,16 +4,43 @@
 #include <cstdio>
 #include <cstdlib>
 
-void xassert_error(const char *message, ...) {
+thread_local bool RecoverErrors::current = false;
+
+void xassert_error(const char *file, uint32_t line, const char *message, ...) {
   va_list parameters;
   va_start(parameters, message);
 
   char error[2000];
-  vsprintf(error, message, parameters);
+  vsnprintf(error, sizeof(error), message, parameters);
 
   va_end(parameters);
 
+  if (RecoverErrors::current) {
+    throw ParseError(error, file, line);
+  }
+
   printf("%s\n", error);
   exit(1);
 }
 
+ParseError::ParseError() : line(0) {
+}
+
+ParseError::ParseError(const std::string &_message, const char *_file, uint32_t _line) :
+    message(_message), file(_file), line(_line) {
+}
+
+ParseError::~ParseError() throw() {
+}
+
+const char *ParseError::what() const throw() {
+  return message.c_str();
+}
+
+RecoverErrors::RecoverErrors(bool recover) : previous(current) {
+  current = recover;
+}
+
+RecoverErrors::~RecoverErrors() {
+  current = previous;
+}
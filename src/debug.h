@@ -1,18 +1,54 @@
 #ifndef _DEBUG_H
 #define _DEBUG_H
 
-void xassert_error(const char *message, ...) __attribute__((noreturn));
+#include <stdint.h>
+
+#include <exception>
+#include <string>
+
+void xassert_error(const char *file, uint32_t line, const char *message, ...)
+    __attribute__((noreturn));
 
 #define XASSERT(test, msg, ...) do { \
   if (!(test)) { \
-    xassert_error("\nAssertion at %s:%u failed: %s\n" msg, __FILE__, __LINE__, (#test), \
-      ##__VA_ARGS__); \
+    xassert_error(__FILE__, __LINE__, "\nAssertion at %s:%u failed: %s\n" msg, __FILE__, \
+      __LINE__, (#test), ##__VA_ARGS__); \
   } \
 } while (0);
 
 #define XERROR(msg, ...) do { \
-  xassert_error("\nError at %s:%u: \n" msg, __FILE__, __LINE__, ##__VA_ARGS__); \
+  xassert_error(__FILE__, __LINE__, "\nError at %s:%u: \n" msg, __FILE__, __LINE__, \
+    ##__VA_ARGS__); \
 } while (0);
 
-#endif
+// What a failed XASSERT or XERROR throws while errors are being recovered from, see
+// RecoverErrors. replay is filled in by the parser that catches it.
+class ParseError : public std::exception {
+public:
+  ParseError();
+  ParseError(const std::string &_message, const char *_file, uint32_t _line);
+  virtual ~ParseError() throw();
+
+  virtual const char *what() const throw();
+
+  std::string message;
+  std::string file;
+  uint32_t line;
+  std::string replay;
+};
 
+// While one of these is alive with recover set, failed XASSERTs and XERRORs on this thread throw
+// a ParseError instead of printing the error and exiting. Nothing is checked until something
+// fails, so this costs nothing on the way through.
+class RecoverErrors {
+public:
+  RecoverErrors(bool recover);
+  ~RecoverErrors();
+
+  static thread_local bool current;
+
+private:
+  bool previous;
+};
+
+#endif
@@ -2,7 +2,22 @@
 
 #include <snappy.h>
 
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
 #include "debug.h"
+#include "stats.h"
+#include "trace.h"
 
 #define PROTODEMO_HEADER_ID "PBUFDEM"
 
@@ -29,7 +44,18 @@ uint32_t read_var_int(std::istream &stream) {
   return result;
 }
 
-Demo::Demo(const char *file) : buffer_len(0), scratch_len(0) {
+Demo::Demo(const char *file) :
+    buffer_len(0),
+    scratch_len(0),
+    path(file),
+    following(false),
+    poll_ms(0),
+    timeout_ms(0),
+    watch_fd(-1),
+    stopped(false),
+    stop(0),
+    read_fd(-1),
+    known_length(0) {
   using namespace std;
 
   stream.open(file, ifstream::in | ifstream::binary);
@@ -45,6 +71,131 @@ Demo::~Demo() {
   if (stream.is_open()) {
     stream.close();
   }
+
+  if (watch_fd != -1) {
+    close(watch_fd);
+  }
+
+  if (read_fd != -1) {
+    close(read_fd);
+  }
+}
+
+void Demo::follow(uint32_t _poll_ms, uint32_t _timeout_ms) {
+  following = true;
+  poll_ms = std::max<uint32_t>(_poll_ms, 1);
+  timeout_ms = _timeout_ms;
+
+  read_fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  XASSERT(read_fd != -1, "Can't open %s.", path.c_str());
+
+#ifdef __linux__
+  // Without inotify we just poll.
+  watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (watch_fd != -1 && inotify_add_watch(watch_fd, path.c_str(), IN_MODIFY) == -1) {
+    close(watch_fd);
+    watch_fd = -1;
+  }
+#endif
+}
+
+void Demo::stop_when(const std::atomic<bool> *_stop) {
+  stop = _stop;
+}
+
+size_t Demo::file_length() {
+  struct stat info;
+  XASSERT(!stat(path.c_str(), &info), "Can't stat %s.", path.c_str());
+
+  known_length = info.st_size;
+  return known_length;
+}
+
+// Whether the frame at the current offset has been written in full: its command, tick and size
+// varints and then size bytes. The file only grows, so it's only looked at again once a frame
+// runs past where it ended last time.
+bool Demo::frame_written() {
+  size_t start = tell();
+
+  char header[15];
+  ssize_t read_length = pread(read_fd, header, sizeof(header), start);
+  XASSERT(read_length != -1, "Can't read %s.", path.c_str());
+
+  size_t header_length = read_length;
+  if (header_length == 0) {
+    return false;
+  }
+
+  size_t offset = 0;
+  uint32_t size = 0;
+  for (int varint = 0; varint < 3; ++varint) {
+    uint32_t value = 0;
+    int count = 0;
+    uint8_t b;
+
+    do {
+      if (offset == header_length) {
+        return false;
+      }
+
+      XASSERT(count != 5, "Corrupt data.");
+
+      b = header[offset++];
+      value |= (uint32_t) (b & 0x7F) << (7 * count);
+      ++count;
+    } while (b & 0x80);
+
+    size = value;
+  }
+
+  size_t end = start + offset + size;
+  return end <= known_length || end <= file_length();
+}
+
+void Demo::wait_for_growth() {
+  TraceSpan span("follow_wait");
+
+#ifdef __linux__
+  if (watch_fd != -1) {
+    struct pollfd watched = {watch_fd, POLLIN, 0};
+
+    if (poll(&watched, 1, poll_ms) > 0) {
+      char events[4096];
+      while (read(watch_fd, events, sizeof(events)) > 0) {
+      }
+    }
+
+    return;
+  }
+#endif
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(poll_ms));
+}
+
+bool Demo::wait_for_frame() {
+  auto last_growth = std::chrono::steady_clock::now();
+  size_t last_length = 0;
+
+  while (!frame_written()) {
+    if (stop && *stop) {
+      return false;
+    }
+
+    wait_for_growth();
+
+    size_t length = file_length();
+
+    auto now = std::chrono::steady_clock::now();
+    if (length != last_length) {
+      last_length = length;
+      last_growth = now;
+    } else if (timeout_ms &&
+        now - last_growth >= std::chrono::milliseconds(timeout_ms)) {
+      return false;
+    }
+  }
+
+  return true;
 }
 
 char *Demo::expose_buffer() {
@@ -52,6 +203,12 @@ char *Demo::expose_buffer() {
 }
 
 bool Demo::eof() {
+  if (stop && *stop) {
+    return true;
+  } else if (following) {
+    return stopped || !wait_for_frame();
+  }
+
   return stream.peek() == EOF;
 }
 
@@ -66,6 +223,8 @@ EDemoCommands Demo::get_message_type(int *tick, bool *compressed) {
 
   *compressed = !!(command & DEM_IsCompressed);
   command = (command & ~DEM_IsCompressed);
+  stopped = command == DEM_Stop;
+  STATS_ADD(frames[std::min<uint32_t>(command, STATS_MAX_COMMANDS)], 1);
 
   *tick = read_var_int(stream);
 
@@ -81,18 +240,49 @@ void Demo::read_message(bool compressed, size_t *size, size_t *uncompressed_size
   XASSERT(*size <= DEMO_BUFFER_SIZE, "Message longer than buffer size.");
 
   if (compressed) {
-    stream.read(scratch, *size);
+    {
+      STATS_TIME(PS_Read);
+      TraceSpan span("read");
+      stream.read(scratch, *size);
+    }
+    XASSERT(!stream.fail(), "Premature end of stream.");
     scratch_len = *size;
 
+    STATS_TIME(PS_Decompress);
+    TraceSpan span("decompress");
     XASSERT(snappy::IsValidCompressedBuffer(scratch, scratch_len), "Invalid Snappy compression.");
     XASSERT(snappy::GetUncompressedLength(scratch, scratch_len, uncompressed_size), "Can't get length.");
     XASSERT(*uncompressed_size <= DEMO_BUFFER_SIZE, "Uncompressed message is longer than buffer.");
     XASSERT(snappy::RawUncompress(scratch, scratch_len, buffer), "Can't decompress.");
     buffer_len = *uncompressed_size;
   } else {
+    STATS_TIME(PS_Read);
+    TraceSpan span("read");
     stream.read(buffer, *size);
+    XASSERT(!stream.fail(), "Premature end of stream.");
     buffer_len = *size;
     *uncompressed_size = *size;
   }
+
+  STATS_ADD(compressed_bytes, *size);
+  STATS_ADD(uncompressed_bytes, *uncompressed_size);
 }
 
+
+void Demo::skip_message() {
+  size_t size = read_var_int(stream);
+  stream.seekg(size, std::ios_base::cur);
+  XASSERT(!stream.fail(), "Premature end of stream.");
+}
+
+size_t Demo::tell() {
+  // Peeking at the end of the file sets eofbit, which would make tellg fail.
+  stream.clear(stream.rdstate() & ~std::ios_base::eofbit);
+  return stream.tellg();
+}
+
+void Demo::seek(size_t offset) {
+  stream.clear();
+  stream.seekg(offset);
+  XASSERT(!stream.fail(), "Can't seek to %lu.", offset);
+}
@@ -3,7 +3,9 @@
 
 #include <stdint.h>
 
+#include <atomic>
 #include <fstream>
+#include <string>
 
 #include "demo.pb.h"
 
@@ -14,20 +16,53 @@ class Demo {
     Demo(const char *file);
     ~Demo();
 
+    // Reads a replay that's still being written. Instead of ending where the file currently
+    // ends, eof waits for the whole of the next frame to be written, polling every poll_ms (or
+    // sooner, when inotify says the file changed). It's only true after DEM_Stop, or once the
+    // file hasn't grown for timeout_ms if that isn't 0.
+    void follow(uint32_t poll_ms, uint32_t timeout_ms);
+
+    // Makes eof true as soon as stop is set, rather than after waiting for the next frame when
+    // following. Stop has to outlive the demo or be replaced with 0.
+    void stop_when(const std::atomic<bool> *stop);
+
     bool eof();
     EDemoCommands get_message_type(int *tick, bool *compressed);
     void read_message(bool compressed, size_t *size, size_t *uncompressed_size);
+    void skip_message();
+
+    // Offsets are of the start of a message, before its type.
+    size_t tell();
+    void seek(size_t offset);
 
     char *expose_buffer();
     size_t get_buffer_len();
 
   private:
+    bool frame_written();
+    bool wait_for_frame();
+    void wait_for_growth();
+    size_t file_length();
+
     char buffer[DEMO_BUFFER_SIZE];
     size_t buffer_len;
     char scratch[DEMO_BUFFER_SIZE];
     size_t scratch_len;
 
     std::ifstream stream;
+
+    std::string path;
+    bool following;
+    uint32_t poll_ms;
+    uint32_t timeout_ms;
+    int watch_fd;
+    bool stopped;
+    const std::atomic<bool> *stop;
+
+    // For following: a second descriptor to look at frame headers without disturbing stream,
+    // and how long the file was when we last checked.
+    int read_fd;
+    size_t known_length;
 };
 
 #endif
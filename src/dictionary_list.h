@@ -1,8 +1,13 @@
 #ifndef _DICTIONARY_LIST_H
 #define _DICTIONARY_LIST_H
 
-#include <map>
+#include <stdint.h>
+
+#include <cstring>
+#include <deque>
+#include <functional>
 #include <string>
+#include <vector>
 
 #include "debug.h"
 
@@ -11,6 +16,67 @@ struct GetKey {
   const K &operator()(const T &element);
 };
 
+// Hashes keys for DictionaryList. Strings can also be looked up by C string or by a
+// (pointer, length) pair without building a std::string first.
+template<typename K>
+struct DictionaryKey {
+  static size_t hash(const K &key) {
+    return std::hash<K>()(key);
+  }
+
+  static bool equal(const K &key, const K &other) {
+    return key == other;
+  }
+};
+
+struct StringRef {
+  StringRef(const char *_data, size_t _length) : data(_data), length(_length) {
+  }
+
+  const char *data;
+  size_t length;
+};
+
+template<>
+struct DictionaryKey<std::string> {
+  static size_t hash(const char *data, size_t length) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (size_t i = 0; i < length; ++i) {
+      hash ^= (unsigned char) data[i];
+      hash *= 0x100000001b3ULL;
+    }
+
+    return (size_t) hash;
+  }
+
+  static size_t hash(const std::string &key) {
+    return hash(key.data(), key.size());
+  }
+
+  static size_t hash(const char *key) {
+    return hash(key, strlen(key));
+  }
+
+  static size_t hash(const StringRef &key) {
+    return hash(key.data, key.length);
+  }
+
+  static bool equal(const std::string &key, const std::string &other) {
+    return key == other;
+  }
+
+  static bool equal(const std::string &key, const char *other) {
+    return key == other;
+  }
+
+  static bool equal(const std::string &key, const StringRef &other) {
+    return key.size() == other.length && !memcmp(key.data(), other.data, other.length);
+  }
+};
+
+// A list that can also be indexed by a key taken from each element. Elements are never
+// moved once added, so references to them stay valid as the list grows.
 template<typename T,
          typename K = std::string,
          typename KF = GetKey<K, T>
@@ -26,15 +92,24 @@ public:
 
   size_t size() const;
 
+  // Bytes the list itself holds, not counting anything its elements point to.
+  size_t memory() const;
+
   T &add(T element);
   bool has(size_t index) const;
-  bool has(K key) const;
+  bool has(const K &key) const;
+
+  // Returns null if nothing has this key. Q is anything DictionaryKey<K> can hash.
+  template<typename Q>
+  const T *find(const Q &key) const;
+  template<typename Q>
+  T *find(const Q &key);
 
   const T &operator[](size_t index) const;
   T &operator[](size_t index);
 
-  const T &operator[](K key) const;
-  T &operator[](K key);
+  const T &operator[](const K &key) const;
+  T &operator[](const K &key);
 
   class const_iterator;
   const_iterator begin() const;
@@ -45,8 +120,22 @@ public:
   iterator end();
 
 private:
-  std::vector<T> array;
-  std::map<K, size_t> dictionary;
+  // An open addressing table of indices into array, probed linearly. It's kept at most
+  // half full.
+  struct Slot {
+    size_t hash;
+    size_t index;
+  };
+
+  static const size_t EMPTY = (size_t) -1;
+
+  template<typename Q>
+  size_t lookup(const Q &key) const;
+  void insert(size_t hash, size_t index);
+  void grow();
+
+  std::deque<T> array;
+  std::vector<Slot> slots;
   size_t count;
 
 public:
@@ -80,7 +169,7 @@ public:
     using std::swap;
 
     swap(first.array, second.array);
-    swap(first.dictionary, second.dictionary);
+    swap(first.slots, second.slots);
     swap(first.count, second.count);
   }
 };
@@ -92,12 +181,12 @@ DictionaryList<T, K, KF>::DictionaryList() : count(0) {
 template<typename T, typename K, typename KF>
 DictionaryList<T, K, KF>::DictionaryList(const DictionaryList<T, K, KF> &that) {
   array = that.array;
-  dictionary = that.dictionary;
+  slots = that.slots;
   count = that.count;
 }
 
 template<typename T, typename K, typename KF>
-DictionaryList<T, K, KF>::DictionaryList(DictionaryList<T, K, KF> &&that) {
+DictionaryList<T, K, KF>::DictionaryList(DictionaryList<T, K, KF> &&that) : count(0) {
   swap(*this, that);
 }
 
@@ -117,17 +206,33 @@ size_t DictionaryList<T, K, KF>::size() const {
   return count;
 }
 
+template<typename T, typename K, typename KF>
+size_t DictionaryList<T, K, KF>::memory() const {
+  return array.size() * sizeof(T) + slots.capacity() * sizeof(Slot);
+}
+
 template<typename T, typename K, typename KF>
 T &DictionaryList<T, K, KF>::add(T element) {
   size_t index = count;
   array.push_back(element);
+  ++count;
 
   KF get_key;
-  dictionary[get_key(element)] = index;
-
-  ++count;
+  const K &key = get_key(array.back());
+
+  // Like the map this replaced, a repeated key now refers to the newest element.
+  size_t existing = lookup(key);
+  if (existing != EMPTY) {
+    slots[existing].index = index;
+  } else {
+    if (2 * count > slots.size()) {
+      grow();
+    }
+
+    insert(DictionaryKey<K>::hash(key), index);
+  }
 
-  return array.at(index);
+  return array.back();
 }
 
 template<typename T, typename K, typename KF>
@@ -136,30 +241,97 @@ bool DictionaryList<T, K, KF>::has(size_t index) const {
 }
 
 template<typename T, typename K, typename KF>
-bool DictionaryList<T, K, KF>::has(K key) const {
-  return dictionary.count(key) > 0;
+bool DictionaryList<T, K, KF>::has(const K &key) const {
+  return lookup(key) != EMPTY;
+}
+
+template<typename T, typename K, typename KF>
+template<typename Q>
+const T *DictionaryList<T, K, KF>::find(const Q &key) const {
+  size_t slot = lookup(key);
+  return slot == EMPTY ? 0 : &array[slots[slot].index];
+}
+
+template<typename T, typename K, typename KF>
+template<typename Q>
+T *DictionaryList<T, K, KF>::find(const Q &key) {
+  size_t slot = lookup(key);
+  return slot == EMPTY ? 0 : &array[slots[slot].index];
 }
 
 template<typename T, typename K, typename KF>
 const T &DictionaryList<T, K, KF>::operator[](size_t index) const {
   XASSERT(index < count, "Requested index out of bounds.");
-  return array.at(index);
+  return array[index];
 }
 
 template<typename T, typename K, typename KF>
 T &DictionaryList<T, K, KF>::operator[](size_t index) {
   XASSERT(index < count, "Requested index out of bounds.");
-  return array.at(index);
+  return array[index];
+}
+
+template<typename T, typename K, typename KF>
+const T &DictionaryList<T, K, KF>::operator[](const K &key) const {
+  const T *found = find(key);
+  XASSERT(found, "Requested key does not exist.");
+  return *found;
+}
+
+template<typename T, typename K, typename KF>
+T &DictionaryList<T, K, KF>::operator[](const K &key) {
+  T *found = find(key);
+  XASSERT(found, "Requested key does not exist.");
+  return *found;
 }
 
 template<typename T, typename K, typename KF>
-const T &DictionaryList<T, K, KF>::operator[](K key) const {
-  return array[dictionary.at(key)];
+template<typename Q>
+size_t DictionaryList<T, K, KF>::lookup(const Q &key) const {
+  if (slots.empty()) {
+    return EMPTY;
+  }
+
+  size_t hash = DictionaryKey<K>::hash(key);
+  size_t mask = slots.size() - 1;
+
+  KF get_key;
+  for (size_t i = hash & mask; slots[i].index != EMPTY; i = (i + 1) & mask) {
+    if (slots[i].hash == hash &&
+        DictionaryKey<K>::equal(get_key(array[slots[i].index]), key)) {
+      return i;
+    }
+  }
+
+  return EMPTY;
 }
 
 template<typename T, typename K, typename KF>
-T &DictionaryList<T, K, KF>::operator[](K key) {
-  return array[dictionary.at(key)];
+void DictionaryList<T, K, KF>::insert(size_t hash, size_t index) {
+  size_t mask = slots.size() - 1;
+
+  size_t i = hash & mask;
+  while (slots[i].index != EMPTY) {
+    i = (i + 1) & mask;
+  }
+
+  slots[i].hash = hash;
+  slots[i].index = index;
+}
+
+template<typename T, typename K, typename KF>
+void DictionaryList<T, K, KF>::grow() {
+  std::vector<Slot> old;
+  old.swap(slots);
+
+  Slot empty = { 0, EMPTY };
+  slots.resize(old.empty() ? 16 : 2 * old.size(), empty);
+
+  for (auto iter = old.begin(); iter != old.end(); ++iter) {
+    if (iter->index != EMPTY) {
+      insert(iter->hash, iter->index);
+    }
+  }
 }
 
 template<typename T, typename K, typename KF>
@@ -227,4 +399,3 @@ typename DictionaryList<T, K, KF>::iterator &DictionaryList<T, K, KF>::iterator:
 }
 
 #endif
-
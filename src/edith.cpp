@@ -1,20 +1,40 @@
 #include <stdint.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <thread>
 
 #include "demo.pb.h"
+#include "edith.pb.h"
 #include "netmessages.pb.h"
 
+#include "aggregate.h"
 #include "bitstream.h"
 #include "debug.h"
 #include "demo.h"
+#include "edith.h"
 #include "entity.h"
+#include "entity_view.h"
+#include "pipeline.h"
+#include "snapshot.h"
+#include "spatial_index.h"
 #include "state.h"
+#include "stats.h"
+#include "tick_collector.h"
+#include "trace.h"
+#include "trigger.h"
 #include "visitor.h"
 
-#define INSTANCE_BASELINE_TABLE "instancebaseline"
 #define KEY_HISTORY_SIZE 32
 #define MAX_EDICTS 0x800
 #define MAX_KEY_SIZE 0x400
 #define MAX_VALUE_SIZE 0x4000
+#define MEMORY_CHECK_FRAMES 1024
 
 enum UpdateFlag {
   UF_LeavePVS = 1,
@@ -22,7 +42,233 @@ enum UpdateFlag {
   UF_EnterPVS = 4,
 };
 
-State *state = 0;
+ParseOptions::ParseOptions() :
+    batch_floats(false),
+    cache_schemas(true),
+    pipeline(false),
+    report_changes(false),
+    memory_limit(0),
+    recover_errors(false),
+    follow(false),
+    follow_poll_ms(100),
+    follow_timeout_ms(60000) {
+}
+
+Parser::Parser() :
+    tracer(0),
+    state(0),
+    collector(0),
+    memory_exceeded(false),
+    finished(false),
+    next_offset(0),
+    last_tick(0) {
+}
+
+Parser::Parser(const ParseOptions &_options) :
+    options(_options),
+    tracer(0),
+    state(0),
+    collector(0),
+    memory_exceeded(false),
+    finished(false),
+    next_offset(0),
+    last_tick(0) {
+}
+
+Parser::~Parser() {
+  delete state;
+
+  for (auto iter = trigger_matchers.begin(); iter != trigger_matchers.end(); ++iter) {
+    delete *iter;
+  }
+}
+
+FloatBatch *Parser::get_float_batch() {
+  return options.batch_floats ? &state->float_batch : 0;
+}
+
+const ParseStats &Parser::stats() const {
+  return parse_stats;
+}
+
+MemoryUsage Parser::memory_usage() const {
+  MemoryUsage usage;
+  if (state) {
+    measure_memory(*state, usage);
+  }
+
+  return usage;
+}
+
+const ParseError &Parser::error() const {
+  return parse_error;
+}
+
+bool Parser::exceeded_memory_limit() const {
+  return memory_exceeded;
+}
+
+// Measuring walks every entity, so it only happens every so many frames.
+bool Parser::within_memory_limit(size_t frame) {
+  if (!options.memory_limit || !state || frame % MEMORY_CHECK_FRAMES != 0) {
+    return true;
+  }
+
+  if (memory_usage().total() <= options.memory_limit) {
+    return true;
+  }
+
+  shed_memory();
+
+  memory_exceeded = memory_usage().total() > options.memory_limit;
+  return !memory_exceeded;
+}
+
+// Only instance baselines are ever read back out of string tables, and the scratch space is
+// rebuilt when it's next needed. Cached schemas stay, they're shared with other parses.
+void Parser::shed_memory() {
+  for (auto iter = state->string_tables.begin(); iter != state->string_tables.end(); ++iter) {
+    if ((*iter).name != INSTANCE_BASELINE_TABLE) {
+      (*iter).drop_values();
+    }
+  }
+
+  ChangedProps().swap(state->changed_props);
+}
+
+void Parser::set_tracer(Tracer *_tracer) {
+  tracer = _tracer;
+}
+
+void Parser::add_view(EntityViewBase &view) {
+  views.push_back(&view);
+}
+
+void Parser::add_triggers(const TriggerSet &triggers) {
+  trigger_matchers.push_back(new TriggerMatcher(triggers));
+}
+
+void Parser::add_spatial_index(SpatialIndex &index) {
+  spatial_indexes.push_back(&index);
+}
+
+void Parser::add_aggregates(AggregateSet &aggregates) {
+  aggregate_sets.push_back(&aggregates);
+}
+
+// Windows that end before the tick are passed on first. Sets only hold this replay's windows
+// once they're bound to its schema.
+void Parser::begin_tick(uint32_t tick, Visitor &visitor) {
+  last_tick = tick;
+
+  if (state && state->schema) {
+    for (auto iter = aggregate_sets.begin(); iter != aggregate_sets.end(); ++iter) {
+      (*iter)->advance(tick, visitor);
+    }
+  }
+
+  visitor.visit_tick(tick);
+}
+
+void Parser::end_replay(const char *file, Visitor &visitor) {
+  if (state && state->schema) {
+    for (auto iter = aggregate_sets.begin(); iter != aggregate_sets.end(); ++iter) {
+      (*iter)->finish(visitor);
+    }
+  }
+
+  visitor.visit_replay_end(file);
+}
+
+// Binds each of items to the schema and lists it for every class it covers.
+template<typename T>
+void bind_to_classes(const std::vector<T*> &items, const char *what, const Schema &schema,
+    std::vector<ClassBindings> &classes, std::vector<T*> ClassBindings::*list) {
+  for (auto item = items.begin(); item != items.end(); ++item) {
+    std::vector<std::string> errors = (*item)->bind(schema);
+    for (auto error = errors.begin(); error != errors.end(); ++error) {
+      std::cerr << "Can't bind " << what << ": " << *error << std::endl;
+    }
+
+    for (auto iter = schema.classes.begin(); iter != schema.classes.end(); ++iter) {
+      if ((*item)->binds(iter->id)) {
+        (classes[iter->id].*list).push_back(*item);
+      }
+    }
+  }
+}
+
+void Parser::bind_views() {
+  const Schema &schema = *state->schema;
+
+  uint32_t max_id = 0;
+  for (auto iter = schema.classes.begin(); iter != schema.classes.end(); ++iter) {
+    max_id = std::max(max_id, iter->id);
+  }
+
+  std::vector<ClassBindings> &classes = state->class_bindings;
+  classes.assign(max_id + 1, ClassBindings());
+
+  bind_to_classes(views, "view field", schema, classes, &ClassBindings::views);
+  bind_to_classes(trigger_matchers, "trigger", schema, classes, &ClassBindings::triggers);
+  bind_to_classes(spatial_indexes, "spatial index", schema, classes, &ClassBindings::indexes);
+  bind_to_classes(aggregate_sets, "aggregate", schema, classes, &ClassBindings::aggregates);
+}
+
+const ClassBindings *Parser::get_bindings(const Entity &entity) {
+  uint32_t class_id = entity.clazz->id;
+
+  if (class_id < state->class_bindings.size() && !state->class_bindings[class_id].empty()) {
+    return &state->class_bindings[class_id];
+  } else {
+    return 0;
+  }
+}
+
+void Parser::update_entity(Entity &entity, Bitstream &stream, Visitor &visitor, bool created) {
+  const ClassBindings *bindings = get_bindings(entity);
+
+  if (!bindings && !options.report_changes) {
+    entity.update(stream, state->interned_strings, get_float_batch());
+    return;
+  }
+
+  ChangedProps &changed = state->changed_props;
+  changed.clear();
+
+  entity.update(stream, state->interned_strings, get_float_batch(), &changed);
+
+  dispatch_changes(entity, changed, bindings, visitor, created);
+}
+
+void Parser::dispatch_changes(const Entity &entity, const ChangedProps &changed,
+    const ClassBindings *bindings, Visitor &visitor, bool created) {
+  if (bindings) {
+    for (auto iter = bindings->views.begin(); iter != bindings->views.end(); ++iter) {
+      (*iter)->write(entity, changed);
+    }
+
+    for (auto iter = bindings->indexes.begin(); iter != bindings->indexes.end(); ++iter) {
+      (*iter)->update(entity, changed);
+    }
+
+    // A created entity is aggregated once it's read, see aggregate_created.
+    if (!created) {
+      for (auto iter = bindings->aggregates.begin(); iter != bindings->aggregates.end();
+          ++iter) {
+        (*iter)->update(entity, changed);
+      }
+    }
+
+    for (auto iter = bindings->triggers.begin(); iter != bindings->triggers.end(); ++iter) {
+      (*iter)->check(entity, changed, visitor, !created);
+    }
+  }
+
+  if (options.report_changes) {
+    visitor.visit_entity_changes(entity, changed);
+  }
+}
 
 uint32_t read_var_int(const char *data, size_t length, size_t *offset) {
   uint32_t b;
@@ -41,34 +287,10 @@ uint32_t read_var_int(const char *data, size_t length, size_t *offset) {
   return result;
 }
 
-void dump_SVC_SendTable(const CSVCMsg_SendTable &table) {
-  XASSERT(state, "SVC_SendTable but no state created.");
-
-  SendTable &converted = state->create_send_table(table.net_table_name(), table.needs_decoder());
-
-  size_t prop_count = table.props_size();
-  for (size_t i = 0; i < prop_count; ++i) {
-    const CSVCMsg_SendTable_sendprop_t &prop = table.props(i);
-
-    SendProp c(
-        static_cast<SP_Types>(prop.type()),
-        prop.var_name(),
-        prop.flags(),
-        prop.priority(),
-        prop.dt_name(),
-        prop.num_elements(),
-        prop.low_value(),
-        prop.high_value(),
-        prop.num_bits());
-
-    converted.props.add(c);
-  }
-}
-
-void dump_DEM_SendTables(const CDemoSendTables &tables) {
-  const char *data = tables.data().c_str();
+void dump_DEM_SendTables(const std::string &tables, Schema &schema) {
+  const char *data = tables.c_str();
   size_t offset = 0;
-  size_t length = tables.data().length();
+  size_t length = tables.length();
 
   while (offset < length) {
     uint32_t command = read_var_int(data, length, &offset);
@@ -79,23 +301,12 @@ void dump_DEM_SendTables(const CDemoSendTables &tables) {
 
     CSVCMsg_SendTable send_table;
     send_table.ParseFromArray(&(data[offset]), size);
-    dump_SVC_SendTable(send_table);
+    schema.create_send_table(send_table);
 
     offset += size;
   }
 }
 
-const StringTableEntry &get_baseline_for(int class_i) {
-  XASSERT(state, "No state created.");
-
-  StringTable &instance_baseline = state->get_string_table(INSTANCE_BASELINE_TABLE);
-
-  char buf[32];
-  sprintf(buf, "%d", class_i);
-
-  return instance_baseline.get(buf);
-}
-
 uint32_t read_entity_header(uint32_t *base, Bitstream &stream) {
   uint32_t value = stream.get_bits(6);
 
@@ -124,44 +335,164 @@ uint32_t read_entity_header(uint32_t *base, Bitstream &stream) {
   return update_flags;
 }
 
-void read_entity_enter_pvs(uint32_t entity_id, Bitstream &stream, Visitor& visitor) {
+void Parser::reset_bindings(const Entity &entity) {
+  const ClassBindings *bindings = get_bindings(entity);
+  if (!bindings) {
+    return;
+  }
+
+  for (auto iter = bindings->views.begin(); iter != bindings->views.end(); ++iter) {
+    (*iter)->reset(entity.id);
+  }
+
+  for (auto iter = bindings->triggers.begin(); iter != bindings->triggers.end(); ++iter) {
+    (*iter)->reset(entity.id);
+  }
+
+  for (auto iter = bindings->indexes.begin(); iter != bindings->indexes.end(); ++iter) {
+    (*iter)->reset(entity.id);
+  }
+
+  for (auto iter = bindings->aggregates.begin(); iter != bindings->aggregates.end(); ++iter) {
+    (*iter)->reset(entity.id);
+  }
+}
+
+void Parser::entity_created(const Entity &entity, Visitor &visitor) {
+  if (collector) {
+    collector->created(entity);
+  } else {
+    visitor.visit_entity_created(entity);
+  }
+}
+
+void Parser::entity_updated(const Entity &entity, Visitor &visitor) {
+  if (collector) {
+    collector->updated(entity);
+  } else {
+    visitor.visit_entity_updated(entity);
+  }
+}
+
+void Parser::delete_entity(uint32_t entity_id, Visitor &visitor) {
+  Entity &entity = state->entities[entity_id];
+
+  STATS_ADD(entities_deleted, 1);
+
+  if (!collector) {
+    visitor.visit_entity_deleted(entity);
+  }
+
+  if (entity.id != (uint32_t) -1) {
+    reset_bindings(entity);
+  }
+
+  if (collector) {
+    collector->deleted(entity);
+  }
+
+  entity.id = -1;
+}
+
+// Restored entities are reported as created, the way a segment reports what its full packet
+// holds, with every prop they have as what changed.
+void list_props(const Entity &entity, ChangedProps &out) {
+  out.clear();
+
+  const std::vector<const SendProp*> &props = entity.table->props;
+  for (uint32_t i = 0; i < props.size(); ++i) {
+    auto found = entity.properties.find(props[i]->qualified_name);
+
+    if (found != entity.properties.end() && found->second) {
+      out.push_back(std::make_pair(i, found->second.get()));
+    }
+  }
+}
+
+// Entities are read from their baseline and then from the packet, and the packet's values
+// replace what the baseline said, so only the values they end up with are aggregated.
+void Parser::aggregate_created(const Entity &entity, const ClassBindings *bindings) {
+  if (!bindings || bindings->aggregates.empty()) {
+    return;
+  }
+
+  ChangedProps &changed = state->changed_props;
+  list_props(entity, changed);
+
+  for (auto iter = bindings->aggregates.begin(); iter != bindings->aggregates.end(); ++iter) {
+    (*iter)->update(entity, changed);
+  }
+}
+
+void Parser::restore_entities(Visitor &visitor) {
+  for (uint32_t i = 0; i < MAX_ENTITIES; ++i) {
+    Entity &entity = state->entities[i];
+    if (entity.id == (uint32_t) -1) {
+      continue;
+    }
+
+    reset_bindings(entity);
+
+    const ClassBindings *bindings = get_bindings(entity);
+
+    if (bindings || options.report_changes) {
+      ChangedProps &changed = state->changed_props;
+      list_props(entity, changed);
+
+      dispatch_changes(entity, changed, bindings, visitor, true);
+    }
+
+    aggregate_created(entity, bindings);
+    entity_created(entity, visitor);
+  }
+}
+
+void Parser::read_entity_enter_pvs(uint32_t entity_id, Bitstream &stream, Visitor& visitor) {
   uint32_t class_i = stream.get_bits(state->class_bits);
   uint32_t serial = stream.get_bits(10);
 
   XASSERT(entity_id < MAX_EDICTS, "Entity %ld exceeds max edicts.", entity_id);
 
   const Class &clazz = state->get_class(class_i);
-  const FlatSendTable &flat_send_table = state->flat_send_tables[clazz.dt_name];
+  XASSERT(clazz.flat_table, "Class %s has no send table.", clazz.name.c_str());
 
   Entity &entity = state->entities[entity_id];
 
   if (entity.id != -1) {
-    visitor.visit_entity_deleted(entity);
+    delete_entity(entity_id, visitor);
   }
 
-  entity = Entity(entity_id, clazz, flat_send_table);
+  entity = Entity(entity_id, clazz, *clazz.flat_table);
+  reset_bindings(entity);
 
-  const StringTableEntry &baseline = get_baseline_for(class_i);
+  const StringTableEntry &baseline = state->get_baseline(class_i);
   Bitstream baseline_stream(baseline.value);
-  entity.update(baseline_stream);
+  update_entity(entity, baseline_stream, visitor, true);
 
-  entity.update(stream);
+  update_entity(entity, stream, visitor, true);
+  aggregate_created(entity, get_bindings(entity));
 
-  visitor.visit_entity_created(entity);
+  STATS_ADD(entities_created, 1);
+  entity_created(entity, visitor);
 }
 
-void read_entity_update(uint32_t entity_id, Bitstream &stream, Visitor& visitor) {
+void Parser::read_entity_update(uint32_t entity_id, Bitstream &stream, Visitor& visitor) {
   XASSERT(entity_id < MAX_ENTITIES, "Entity id too big");
 
   Entity &entity = state->entities[entity_id];
   XASSERT(entity.id != -1, "Entity %d is not set up.", entity_id);
 
-  entity.update(stream);
+  update_entity(entity, stream, visitor, false);
 
-  visitor.visit_entity_updated(entity);
+  STATS_ADD(entities_updated, 1);
+  entity_updated(entity, visitor);
 }
 
-void dump_SVC_PacketEntities(const CSVCMsg_PacketEntities &entities, Visitor& visitor) {
+void Parser::dump_SVC_PacketEntities(const CSVCMsg_PacketEntities &entities, Visitor& visitor) {
+  STATS_TIME(PS_Entities);
+  TraceSpan span("packet_entities");
+  span.arg("entries", entities.updated_entries());
+
   Bitstream stream(entities.entity_data());
 
   uint32_t entity_id = -1;
@@ -170,6 +501,7 @@ void dump_SVC_PacketEntities(const CSVCMsg_PacketEntities &entities, Visitor& vi
 
   while (found < entities.updated_entries()) {
     update_type = read_entity_header(&entity_id, stream);
+    XASSERT(entity_id < MAX_ENTITIES, "Entity %u is out of range.", entity_id);
 
     if (update_type & UF_EnterPVS) {
       read_entity_enter_pvs(entity_id, stream, visitor);
@@ -177,9 +509,7 @@ void dump_SVC_PacketEntities(const CSVCMsg_PacketEntities &entities, Visitor& vi
       XASSERT(entities.is_delta(), "Leave PVS on full update");
 
       if (update_type & UF_Delete) {
-        visitor.visit_entity_deleted(state->entities[entity_id]);
-
-        state->entities[entity_id].id = -1;
+        delete_entity(entity_id, visitor);
       }
     } else {
       read_entity_update(entity_id, stream, visitor);
@@ -191,42 +521,57 @@ void dump_SVC_PacketEntities(const CSVCMsg_PacketEntities &entities, Visitor& vi
   if (entities.is_delta()) {
     while (stream.get_bits(1)) {
       entity_id = stream.get_bits(11);
-      visitor.visit_entity_deleted(state->entities[entity_id]);
-      state->entities[entity_id].id = -1;
+      delete_entity(entity_id, visitor);
     }
   }
 }
 
-void dump_SVC_ServerInfo(const CSVCMsg_ServerInfo &info) {
+void Parser::dump_SVC_ServerInfo(const CSVCMsg_ServerInfo &info) {
   XASSERT(!state, "Already seen SVC_ServerInfo.");
 
   state = new State(info.max_classes());
 }
 
-void dump_DEM_ClassInfo(const CDemoClassInfo &info) {
+void Parser::dump_DEM_ClassInfo(const CDemoClassInfo &info, Visitor &visitor) {
+  STATS_TIME(PS_Schema);
+  TraceSpan span("schema");
+
   XASSERT(state, "DEM_ClassInfo but no state.");
 
-  for (size_t i = 0; i < info.classes_size(); ++i) {
-    const CDemoClassInfo_class_t &clazz = info.classes(i);
-    state->create_class(clazz.class_id(), clazz.table_name(), clazz.network_name());
+  uint64_t key = Schema::fingerprint(state->send_tables_data, info);
+
+  std::shared_ptr<const Schema> schema;
+  if (options.cache_schemas) {
+    schema = SchemaCache::shared().find(key, options.schema_cache_dir);
   }
 
-  for (auto iter = state->send_tables.begin(); iter != state->send_tables.end(); ++iter) {
-    SendTable &table = *iter;
+  if (!schema) {
+    std::shared_ptr<Schema> compiled(new Schema());
 
-    for (size_t i = 0; i < table.props.size(); ++i) {
-      SendProp &prop = table.props[i];
+    dump_DEM_SendTables(state->send_tables_data, *compiled);
 
-      prop.in_table = &table;
+    for (size_t i = 0; i < info.classes_size(); ++i) {
+      const CDemoClassInfo_class_t &clazz = info.classes(i);
+      compiled->create_class(clazz.class_id(), clazz.table_name(), clazz.network_name());
+    }
 
-      if (prop.type == SP_Array) {
-        XASSERT(i > 0, "Array prop %s is at index zero.", prop.var_name.c_str());
-        prop.array_prop = &(table.props[i - 1]);
-      }
+    compiled->link();
+    compiled->compile_send_tables();
+
+    schema = compiled;
+
+    if (options.cache_schemas) {
+      SchemaCache::shared().insert(key, schema, options.schema_cache_dir);
     }
   }
 
-  state->compile_send_tables();
+  state->schema = schema;
+  state->schema_key = key;
+  state->send_tables_data.clear();
+
+  bind_views();
+
+  visitor.visit_schema(*schema);
 }
 
 void read_string_table_key(uint32_t first_bit, Bitstream &stream, char *buf,
@@ -248,9 +593,15 @@ void read_string_table_key(uint32_t first_bit, Bitstream &stream, char *buf,
   }
 }
 
-void update_string_table(StringTable &table, size_t num_entries, const std::string &data) {
+void Parser::update_string_table(StringTable &table, size_t num_entries, const std::string &data) {
+  STATS_TIME(PS_StringTables);
+  TraceSpan span("string_table");
+  span.arg("entries", num_entries);
+
   Bitstream stream(data);
 
+  bool is_baseline = table.name == INSTANCE_BASELINE_TABLE;
+
   uint32_t first_bit = stream.get_bits(1);
 
   std::vector<std::string> key_history;
@@ -306,7 +657,7 @@ void update_string_table(StringTable &table, size_t num_entries, const std::stri
         XASSERT(item.key == key, "Entry's keys don't match.");
       }
 
-      if (value) {
+      if (value && table.keep_values) {
         // This is kind of bad because if the server sends us a zero length string we'll consider
         // it to be uninitialized.
         XASSERT(item.value.size() == 0, "String table already has this value");
@@ -315,14 +666,18 @@ void update_string_table(StringTable &table, size_t num_entries, const std::stri
     } else {
       XASSERT(key, "Creating a new string table entry but no key specified.");
 
-      table.put(key, std::string(value_buffer, length));
+      const StringTableEntry &entry = table.put(key, std::string(value_buffer, length));
+
+      if (is_baseline) {
+        state->set_baseline(entry);
+      }
     }
 
     ++entries_read;
   }
 }
 
-void handle_SVC_CreateStringTable(const CSVCMsg_CreateStringTable &table) {
+void Parser::handle_SVC_CreateStringTable(const CSVCMsg_CreateStringTable &table) {
   XASSERT(state, "SVC_CreateStringTable but no state.");
 
   StringTable &converted = state->create_string_table(table.name(),
@@ -332,7 +687,7 @@ void handle_SVC_CreateStringTable(const CSVCMsg_CreateStringTable &table) {
   update_string_table(converted, table.num_entries(), table.string_data());
 }
 
-void handle_SVC_UpdateStringTable(const CSVCMsg_UpdateStringTable &update) {
+void Parser::handle_SVC_UpdateStringTable(const CSVCMsg_UpdateStringTable &update) {
   XASSERT(state, "SVC_UpdateStringTable but no state.");
 
   StringTable &table = state->get_string_table(update.table_id());
@@ -340,7 +695,13 @@ void handle_SVC_UpdateStringTable(const CSVCMsg_UpdateStringTable &update) {
   update_string_table(table, update.num_changed_entries(), update.string_data());
 }
 
-void dump_DEM_Packet(const CDemoPacket &packet, Visitor& visitor) {
+void parse_message(google::protobuf::Message &message, const char *data, size_t size) {
+  STATS_TIME(PS_Protobuf);
+  TraceSpan span("protobuf");
+  message.ParseFromArray(data, size);
+}
+
+void Parser::dump_DEM_Packet(const CDemoPacket &packet, Visitor& visitor) {
   const char *data = packet.data().c_str();
   size_t offset = 0;
   size_t length = packet.data().length();
@@ -350,24 +711,26 @@ void dump_DEM_Packet(const CDemoPacket &packet, Visitor& visitor) {
     uint32_t size = read_var_int(data, length, &offset);
     XASSERT(offset + size <= length, "Reading data outside of packet.");
 
+    STATS_ADD(messages[std::min<uint32_t>(command, STATS_MAX_MESSAGES)], 1);
+
     if (command == svc_ServerInfo) {
       CSVCMsg_ServerInfo info;
-      info.ParseFromArray(&(data[offset]), size);
+      parse_message(info, &(data[offset]), size);
 
       dump_SVC_ServerInfo(info);
     } else if (command == svc_PacketEntities) {
       CSVCMsg_PacketEntities entities;
-      entities.ParseFromArray(&(data[offset]), size);
+      parse_message(entities, &(data[offset]), size);
 
       dump_SVC_PacketEntities(entities, visitor);
     } else if (command == svc_CreateStringTable) {
       CSVCMsg_CreateStringTable table;
-      table.ParseFromArray(&(data[offset]), size);
+      parse_message(table, &(data[offset]), size);
 
       handle_SVC_CreateStringTable(table);
     } else if (command == svc_UpdateStringTable) {
       CSVCMsg_UpdateStringTable table;
-      table.ParseFromArray(&(data[offset]), size);
+      parse_message(table, &(data[offset]), size);
 
       handle_SVC_UpdateStringTable(table);
     }
@@ -377,9 +740,159 @@ void dump_DEM_Packet(const CDemoPacket &packet, Visitor& visitor) {
 }
 
 void dump(const char *file, Visitor& visitor) {
-  Demo demo(file);
+  dump(file, visitor, ParseOptions());
+}
+
+void dump(const char *file, Visitor& visitor, const ParseOptions &options) {
+  Parser parser(options);
+  parser.parse(file, visitor);
+}
+
+void dump(const char *file, TickVisitor& visitor, const ParseOptions &options) {
+  Parser parser(options);
+  parser.parse(file, visitor);
+}
+
+void Parser::handle_DEM_SendTables(const CDemoSendTables &tables) {
+  // These are only parsed once DEM_ClassInfo shows up, and only if the schema they describe
+  // isn't cached already.
+  XASSERT(state, "DEM_SendTables but no state.");
+  state->send_tables_data = tables.data();
+}
+
+void Parser::handle_packet_message(uint32_t command, const google::protobuf::Message &message,
+    Visitor &visitor) {
+  if (command == svc_ServerInfo) {
+    dump_SVC_ServerInfo(static_cast<const CSVCMsg_ServerInfo&>(message));
+  } else if (command == svc_PacketEntities) {
+    dump_SVC_PacketEntities(static_cast<const CSVCMsg_PacketEntities&>(message), visitor);
+  } else if (command == svc_CreateStringTable) {
+    handle_SVC_CreateStringTable(static_cast<const CSVCMsg_CreateStringTable&>(message));
+  } else if (command == svc_UpdateStringTable) {
+    handle_SVC_UpdateStringTable(static_cast<const CSVCMsg_UpdateStringTable&>(message));
+  }
+}
+
+bool Parser::parse(const char *file, Visitor &visitor) {
+  return run(file, 0, -1, 0, visitor);
+}
+
+// Everything a parse does around the frames in its range. A segment starts from the signon and
+// the full packet at start, a resume from the snapshot, and anything else from the beginning.
+bool Parser::run(const char *file, size_t start, size_t end, const char *snapshot,
+    Visitor &visitor) {
+  reset();
+
+  STATS_SCOPE(&parse_stats);
+  TraceScope trace_scope(tracer, "decode");
+  RecoverErrors recover_errors(options.recover_errors);
+
+  TracingVisitor traced(visitor);
+  Visitor &target = tracer ? traced : visitor;
+
+  try {
+    CEdithSnapshot saved;
+    if (snapshot) {
+      read_snapshot(snapshot, saved);
+    }
+
+    Demo demo(file);
+    if (options.follow) {
+      demo.follow(options.follow_poll_ms, options.follow_timeout_ms);
+    }
+
+    target.visit_replay_start(file);
+
+    if (snapshot) {
+      restore_snapshot(saved, demo, target);
+    } else if (start != 0) {
+      start_segment(demo, start, target);
+    }
+
+    parse_range(demo, end, target);
+    next_offset = demo.tell();
+
+    end_replay(file, target);
+  } catch (const ParseError &error) {
+    return failed(error, file);
+  }
+
+  return succeeded(file);
+}
+
+void Parser::reset() {
+  delete state;
+  state = 0;
+
+  memory_exceeded = false;
+  parse_error = ParseError();
+  finished = false;
+
+  parse_stats.clear();
+}
+
+bool Parser::failed(const ParseError &error, const char *file) {
+  parse_error = error;
+  parse_error.replay = file;
+
+  return false;
+}
+
+// Stopping at the memory limit counts as failing, so batches report it with the other errors.
+bool Parser::succeeded(const char *file) {
+  if (memory_exceeded) {
+    return failed(ParseError("Stopped at the memory limit of " +
+        std::to_string(options.memory_limit) + " bytes.", __FILE__, __LINE__), file);
+  }
+
+  finished = true;
+  return true;
+}
+
+void Parser::handle_frame(uint32_t command, const char *data, size_t size,
+    Visitor &visitor) {
+  if (command == DEM_ClassInfo) {
+    CDemoClassInfo info;
+    parse_message(info, data, size);
+
+    dump_DEM_ClassInfo(info, visitor);
+  } else if (command == DEM_SendTables) {
+    CDemoSendTables tables;
+    parse_message(tables, data, size);
+
+    handle_DEM_SendTables(tables);
+  } else if (command == DEM_Packet || command == DEM_SignonPacket) {
+    CDemoPacket packet;
+    parse_message(packet, data, size);
+
+    dump_DEM_Packet(packet, visitor);
+  }
+}
+
+bool Parser::parse(const char *file, TickVisitor &visitor) {
+  TickCollector tick_collector(visitor);
+
+  collector = &tick_collector;
+
+  bool parsed;
+  try {
+    parsed = parse(file, tick_collector);
+  } catch (...) {
+    collector = 0;
+    throw;
+  }
+
+  collector = 0;
+  return parsed;
+}
+
+// Stops before the frame at offset end, or at the end of the file if end is -1.
+void Parser::parse_sequential(Demo &demo, size_t end, Visitor &visitor) {
+  for (size_t frame = 0;
+      !demo.eof() && (end == (size_t) -1 || demo.tell() != end) && within_memory_limit(frame);
+      ++frame) {
+    TraceSpan span("frame");
 
-  for (int frame = 0; !demo.eof(); ++frame) {
     int tick = 0;
     size_t size;
     bool compressed;
@@ -388,24 +901,230 @@ void dump(const char *file, Visitor& visitor) {
     EDemoCommands command = demo.get_message_type(&tick, &compressed);
     demo.read_message(compressed, &size, &uncompressed_size);
 
-    visitor.visit_tick(tick);
+    span.arg("tick", tick);
+    span.arg("command", command);
+    span.arg("bytes", uncompressed_size);
 
-    if (command == DEM_ClassInfo) {
-      CDemoClassInfo info;
-      info.ParseFromArray(demo.expose_buffer(), uncompressed_size);
+    begin_tick(tick, visitor);
 
-      dump_DEM_ClassInfo(info);
-    } else if (command == DEM_SendTables) {
-      CDemoSendTables tables;
-      tables.ParseFromArray(demo.expose_buffer(), uncompressed_size);
+    handle_frame(command, demo.expose_buffer(), uncompressed_size, visitor);
+  }
+}
 
-      dump_DEM_SendTables(tables);
-    } else if (command == DEM_Packet || command == DEM_SignonPacket) {
-      CDemoPacket packet;
-      packet.ParseFromArray(demo.expose_buffer(), uncompressed_size);
+// Decoding needs every earlier frame applied first, so it stays on this thread along with the
+// visitor, which is handed the live entities. Whichever stage fails or stops first, the others
+// are let run out before its error is passed on, whatever kind of exception it is.
+void Parser::parse_pipelined(Demo &demo, Visitor &visitor) {
+  FrameQueue read(PIPELINE_DEPTH);
+  FrameQueue parsed(PIPELINE_DEPTH);
+
+  ParseStats *stats = &parse_stats;
+  Tracer *frame_tracer = tracer;
+  bool recover = RecoverErrors::current;
+  std::atomic<bool> stop(false);
+  std::exception_ptr reader_error;
+  std::exception_ptr protobuf_error;
+
+  // A reader following the replay would otherwise wait for more frames to come after we've
+  // stopped.
+  demo.stop_when(&stop);
+
+  // The stages report to this parse's stats and tracer from their own threads.
+  std::thread reader([&demo, &read, &stop, &reader_error, stats, frame_tracer, recover]() {
+    STATS_SCOPE(stats);
+    TraceScope trace_scope(frame_tracer, "read");
+    RecoverErrors recover_errors(recover);
+
+    try {
+      read_frames(demo, read, stop);
+    } catch (...) {
+      reader_error = std::current_exception();
+      stop = true;
+      read.push(0);
+    }
+  });
+
+  std::thread protobufs([&read, &parsed, &stop, &protobuf_error, stats, frame_tracer,
+      recover]() {
+    STATS_SCOPE(stats);
+    TraceScope trace_scope(frame_tracer, "protobuf");
+    RecoverErrors recover_errors(recover);
+
+    try {
+      parse_frames(read, parsed);
+    } catch (...) {
+      protobuf_error = std::current_exception();
+      stop = true;
+      drain_frames(read);
+      parsed.push(0);
+    }
+  });
+
+  try {
+    for (size_t i = 0; PipelineFrame *popped = parsed.pop(); ++i) {
+      std::unique_ptr<PipelineFrame> frame(popped);
+
+      if (!within_memory_limit(i)) {
+        stop = true;
+        drain_frames(parsed);
+        break;
+      }
 
-      dump_DEM_Packet(packet, visitor);
+      TraceSpan span("frame");
+      span.arg("tick", frame->tick);
+      span.arg("command", frame->command);
+
+      begin_tick(frame->tick, visitor);
+
+      if (frame->command == DEM_ClassInfo) {
+        dump_DEM_ClassInfo(static_cast<const CDemoClassInfo&>(*frame->message), visitor);
+      } else if (frame->command == DEM_SendTables) {
+        handle_DEM_SendTables(static_cast<const CDemoSendTables&>(*frame->message));
+      } else {
+        for (auto iter = frame->packet_messages.begin(); iter != frame->packet_messages.end();
+            ++iter) {
+          handle_packet_message(iter->first, *iter->second, visitor);
+        }
+      }
     }
+  } catch (...) {
+    stop = true;
+    drain_frames(parsed);
+    reader.join();
+    protobufs.join();
+    demo.stop_when(0);
+    throw;
+  }
+
+  reader.join();
+  protobufs.join();
+  demo.stop_when(0);
+
+  if (reader_error) {
+    std::rethrow_exception(reader_error);
+  } else if (protobuf_error) {
+    std::rethrow_exception(protobuf_error);
+  }
+}
+
+// Everything before the first tick sets up the schema and string tables, which a segment needs
+// no matter where it starts. None of it involves entities or ticks.
+void Parser::read_signon(Demo &demo, Visitor &visitor) {
+  while (!demo.eof()) {
+    int tick = 0;
+    size_t size;
+    bool compressed;
+    size_t uncompressed_size;
+
+    EDemoCommands command = demo.get_message_type(&tick, &compressed);
+    if (command == DEM_SyncTick || command == DEM_Packet || command == DEM_FullPacket) {
+      break;
+    }
+
+    demo.read_message(compressed, &size, &uncompressed_size);
+    handle_frame(command, demo.expose_buffer(), uncompressed_size, visitor);
   }
 }
 
+// Entries we already have take the snapshot's value and the rest are added. Tables that were
+// never created are ones we can't read anyway.
+void Parser::restore_string_tables(const CDemoStringTables &tables) {
+  STATS_TIME(PS_StringTables);
+  TraceSpan span("restore_string_tables");
+
+  for (int i = 0; i < tables.tables_size(); ++i) {
+    const CDemoStringTables_table_t &snapshot = tables.tables(i);
+
+    StringTable *table = state->string_tables.find(snapshot.table_name());
+    if (!table) {
+      continue;
+    }
+
+    bool is_baseline = table->name == INSTANCE_BASELINE_TABLE;
+
+    for (int j = 0; j < snapshot.items_size(); ++j) {
+      const CDemoStringTables_items_t &item = snapshot.items(j);
+
+      if ((size_t) j < table->count()) {
+        StringTableEntry &entry = table->get(j);
+        XASSERT(entry.key == item.str(), "Snapshot's keys don't match.");
+
+        if (table->keep_values) {
+          entry.value = item.data();
+        }
+      } else {
+        const StringTableEntry &entry = table->put(item.str(), item.data());
+
+        if (is_baseline) {
+          state->set_baseline(entry);
+        }
+      }
+    }
+  }
+}
+
+bool Parser::parse_segment(const char *file, size_t start, size_t end, Visitor &visitor) {
+  return run(file, start, end, 0, visitor);
+}
+
+void Parser::start_segment(Demo &demo, size_t start, Visitor &visitor) {
+  read_signon(demo, visitor);
+  XASSERT(state, "No state after signon.");
+
+  demo.seek(start);
+
+  int tick = 0;
+  size_t size;
+  bool compressed;
+  size_t uncompressed_size;
+
+  EDemoCommands command = demo.get_message_type(&tick, &compressed);
+  XASSERT(command == DEM_FullPacket, "Segment doesn't start with a full packet.");
+  demo.read_message(compressed, &size, &uncompressed_size);
+
+  begin_tick(tick, visitor);
+
+  CDemoFullPacket full;
+  parse_message(full, demo.expose_buffer(), uncompressed_size);
+
+  restore_string_tables(full.string_table());
+  dump_DEM_Packet(full.packet(), visitor);
+}
+
+// Only parses to the end of the file are pipelined, since the reader can't know where to stop.
+void Parser::parse_range(Demo &demo, size_t end, Visitor &visitor) {
+  if (end == (size_t) -1 && options.pipeline) {
+    parse_pipelined(demo, visitor);
+  } else {
+    parse_sequential(demo, end, visitor);
+  }
+}
+
+void Parser::save_snapshot(const char *path) const {
+  XASSERT(finished && state, "Nothing to snapshot, the last parse didn't finish.");
+
+  CEdithSnapshot snapshot;
+  save_state(*state, snapshot);
+  snapshot.set_offset(next_offset);
+  snapshot.set_tick(last_tick);
+
+  write_snapshot(snapshot, path);
+}
+
+bool Parser::resume(const char *file, const char *snapshot, size_t end, Visitor &visitor) {
+  return run(file, 0, end, snapshot, visitor);
+}
+
+void Parser::restore_snapshot(const CEdithSnapshot &saved, Demo &demo, Visitor &visitor) {
+  state = load_state(saved, options.cache_schemas, options.schema_cache_dir);
+  if (state->schema) {
+    bind_views();
+    visitor.visit_schema(*state->schema);
+  }
+
+  begin_tick(saved.tick(), visitor);
+
+  restore_entities(visitor);
+
+  demo.seek(saved.offset());
+}
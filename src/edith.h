@@ -1,9 +1,240 @@
 #ifndef _EDITH_H
 #define _EDITH_H
 
+#include <stdint.h>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "debug.h"
+#include "entity.h"
+#include "memory.h"
+#include "stats.h"
+
+class AggregateSet;
+class Bitstream;
+class CDemoClassInfo;
+class CDemoPacket;
+class CDemoSendTables;
+class CDemoStringTables;
+class CEdithSnapshot;
+class CSVCMsg_CreateStringTable;
+class CSVCMsg_PacketEntities;
+class CSVCMsg_ServerInfo;
+class CSVCMsg_UpdateStringTable;
+struct ClassBindings;
+class Demo;
+class EntityViewBase;
+class FloatBatch;
+class SpatialIndex;
+class State;
+class StringTable;
+class StringTableEntry;
+class TickCollector;
+class TickVisitor;
+class Tracer;
+class TriggerMatcher;
+class TriggerSet;
 class Visitor;
 
+namespace google {
+namespace protobuf {
+class Message;
+}
+}
+
+struct ParseOptions {
+  ParseOptions();
+
+  // Read the raw codes of every float and vector prop in an entity update first, then
+  // convert them together with SIMD kernels.
+  bool batch_floats;
+
+  // Reuse compiled schemas between parses in this process. If schema_cache_dir is set
+  // they're also kept there as files, which helps separate runs over the same build.
+  bool cache_schemas;
+  std::string schema_cache_dir;
+
+  // Read and decompress frames on one thread and parse their protobufs on another, leaving
+  // only decoding and visiting on the calling thread. Visitors see the same calls in the same
+  // order either way.
+  bool pipeline;
+
+  // Call Visitor::visit_entity_changes with the props read by each entity update.
+  bool report_changes;
+
+  // Roughly how many bytes a parse may hold, 0 for no limit. Past it the parser first drops
+  // what it can rebuild or never reads (string table values other than instance baselines and
+  // scratch space) and then, if that isn't enough, stops at the next frame and calls
+  // visit_replay_end as if the replay had ended there. The parse then returns false and
+  // Parser::error names the limit. See MemoryUsage for what's counted.
+  uint64_t memory_limit;
+
+  // A replay that fails to parse, because it's corrupt or uses an encoding we can't read, only
+  // ends its own parse rather than the whole process. The parse returns false and
+  // Parser::error says what went wrong. The visitor doesn't get visit_replay_end then.
+  bool recover_errors;
+
+  // Keep reading a replay that's still being written, see Demo::follow. Each frame is parsed
+  // and visited as soon as it's been written in full, within about follow_poll_ms. The parse
+  // ends at DEM_Stop, or once the file hasn't grown for follow_timeout_ms (never if 0).
+  bool follow;
+  uint32_t follow_poll_ms;
+  uint32_t follow_timeout_ms;
+};
+
+// Owns everything read from one replay, so separate parsers can run on separate threads.
+// A parser can be reused, each call to parse starts from scratch.
+class Parser {
+public:
+  Parser();
+  Parser(const ParseOptions &options);
+  ~Parser();
+
+  // Returns false if the replay failed to parse, which only happens with
+  // ParseOptions::recover_errors, or if it stopped at ParseOptions::memory_limit.
+  bool parse(const char *file, Visitor &visitor);
+  bool parse(const char *file, TickVisitor &visitor);
+
+  // Binds the view to each replay's schema and keeps it up to date from then on. The view has
+  // to outlive the parser.
+  void add_view(EntityViewBase &view);
+
+  // Checks the triggers in the set from each replay's schema on, see TriggerSet. The set has to
+  // outlive the parser, but other parsers can check it too.
+  void add_triggers(const TriggerSet &triggers);
+
+  // Keeps the index up to date with where the entities it covers are, see SpatialIndex. The
+  // index has to outlive the parser.
+  void add_spatial_index(SpatialIndex &index);
+
+  // Aggregates props into windows of ticks from each replay's schema on, see AggregateSet. The
+  // set has to outlive the parser.
+  void add_aggregates(AggregateSet &aggregates);
+
+  // Parses the frames from offset start up to offset end. Unless start is 0 it has to be the
+  // offset of a DEM_FullPacket, and the segment begins with everything in that packet being
+  // created. Visitors are called in tick order, but not for anything before start.
+  bool parse_segment(const char *file, size_t start, size_t end, Visitor &visitor);
+
+  // Saves everything the last parse built up, so resume can carry on from where it stopped
+  // without reading the replay up to there. Parse up to some offset with parse_segment to
+  // checkpoint there, or to the end of what's been written so far to pick up what's appended
+  // later. Only possible after a parse that finished.
+  void save_snapshot(const char *path) const;
+
+  // Parses file from where the snapshot was taken up to offset end, or to the end of the file if
+  // end is -1. Visitors start with the schema, the tick the snapshot was taken at and every live
+  // entity being created, then see the frames after it as usual.
+  bool resume(const char *file, const char *snapshot, size_t end, Visitor &visitor);
+
+  // What the last parse did. See ParseStats for when it's filled in.
+  const ParseStats &stats() const;
+
+  // Why the last parse failed.
+  const ParseError &error() const;
+
+  // Roughly how much memory the parser holds for the last replay, by category.
+  MemoryUsage memory_usage() const;
+
+  // Whether the last parse stopped early because of ParseOptions::memory_limit.
+  bool exceeded_memory_limit() const;
+
+  // Records spans for everything later parses do in tracer, or stops if it's null. The tracer
+  // has to outlive the parses.
+  void set_tracer(Tracer *tracer);
+
+private:
+  Parser(const Parser&);
+  Parser &operator=(const Parser&);
+
+  FloatBatch *get_float_batch();
+  void bind_views();
+  const ClassBindings *get_bindings(const Entity &entity);
+  void update_entity(Entity &entity, Bitstream &stream, Visitor &visitor, bool created);
+  void dispatch_changes(const Entity &entity, const ChangedProps &changed,
+      const ClassBindings *bindings, Visitor &visitor, bool created);
+  void aggregate_created(const Entity &entity, const ClassBindings *bindings);
+  void reset_bindings(const Entity &entity);
+  void entity_created(const Entity &entity, Visitor &visitor);
+  void entity_updated(const Entity &entity, Visitor &visitor);
+  void delete_entity(uint32_t entity_id, Visitor &visitor);
+  void restore_entities(Visitor &visitor);
+
+  void read_entity_enter_pvs(uint32_t entity_id, Bitstream &stream, Visitor &visitor);
+  void read_entity_update(uint32_t entity_id, Bitstream &stream, Visitor &visitor);
+  void dump_SVC_PacketEntities(const CSVCMsg_PacketEntities &entities, Visitor &visitor);
+  void dump_SVC_ServerInfo(const CSVCMsg_ServerInfo &info);
+  void dump_DEM_ClassInfo(const CDemoClassInfo &info, Visitor &visitor);
+  void update_string_table(StringTable &table, size_t num_entries, const std::string &data);
+  void handle_SVC_CreateStringTable(const CSVCMsg_CreateStringTable &table);
+  void handle_SVC_UpdateStringTable(const CSVCMsg_UpdateStringTable &update);
+  void dump_DEM_Packet(const CDemoPacket &packet, Visitor &visitor);
+  void handle_DEM_SendTables(const CDemoSendTables &tables);
+  void handle_packet_message(uint32_t command, const google::protobuf::Message &message,
+      Visitor &visitor);
+
+  void handle_frame(uint32_t command, const char *data, size_t size, Visitor &visitor);
+  void read_signon(Demo &demo, Visitor &visitor);
+  void start_segment(Demo &demo, size_t start, Visitor &visitor);
+  void restore_snapshot(const CEdithSnapshot &saved, Demo &demo, Visitor &visitor);
+  void restore_string_tables(const CDemoStringTables &tables);
+
+  void begin_tick(uint32_t tick, Visitor &visitor);
+  void end_replay(const char *file, Visitor &visitor);
+
+  void reset();
+  bool failed(const ParseError &error, const char *file);
+  bool succeeded(const char *file);
+  bool within_memory_limit(size_t frame);
+  void shed_memory();
+
+  bool run(const char *file, size_t start, size_t end, const char *snapshot, Visitor &visitor);
+  void parse_sequential(Demo &demo, size_t end, Visitor &visitor);
+  void parse_pipelined(Demo &demo, Visitor &visitor);
+  void parse_range(Demo &demo, size_t end, Visitor &visitor);
+
+  ParseOptions options;
+  std::vector<EntityViewBase*> views;
+  std::vector<TriggerMatcher*> trigger_matchers;
+  std::vector<SpatialIndex*> spatial_indexes;
+  std::vector<AggregateSet*> aggregate_sets;
+  ParseStats parse_stats;
+  Tracer *tracer;
+  State *state;
+
+  // Set while parsing for a TickVisitor, which gets entity events without going through the
+  // visitor.
+  TickCollector *collector;
+
+  bool memory_exceeded;
+
+  // Where the last parse stopped, for snapshots.
+  bool finished;
+  size_t next_offset;
+  uint32_t last_tick;
+  ParseError parse_error;
+};
+
 void dump(const char *file, Visitor& visitor);
+void dump(const char *file, Visitor& visitor, const ParseOptions &options);
+void dump(const char *file, TickVisitor& visitor, const ParseOptions &options);
 
-#endif
+// Parses every file using one thread per visitor. Worker i only ever calls visitors[i], and
+// files are handed out as workers finish their previous ones. With
+// ParseOptions::recover_errors, a worker moves on from a replay that fails and what went wrong
+// with each one is returned.
+std::vector<ParseError> dump_batch(const std::vector<std::string> &files,
+    const std::vector<Visitor*> &visitors, const ParseOptions &options);
 
+// Splits a replay at each DEM_FullPacket and parses the pieces on up to threads threads (all
+// cores if 0). Each piece gets a visitor from create, see Parser::parse_segment for what it
+// sees. Once every piece is done, merge is called on the visitors in tick order from this
+// thread and then they're deleted. With ParseOptions::recover_errors, visitors of pieces that
+// fail aren't merged and the errors are returned in the order of the pieces.
+std::vector<ParseError> dump_segmented(const char *file, const std::function<Visitor *()> &create,
+    const std::function<void (Visitor&)> &merge, const ParseOptions &options,
+    size_t threads = 0);
+
+#endif
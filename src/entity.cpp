@@ -3,8 +3,11 @@
 #include <iostream>
 
 #include "bitstream.h"
+#include "debug.h"
+#include "float_batch.h"
 #include "state.h"
 #include "property.h"
+#include "stats.h"
 
 Entity::Entity() : id(-1), clazz(0), table(0) {
 }
@@ -23,6 +26,7 @@ void read_field_number(uint32_t &last_field, Bitstream &stream) {
     if (value == 0x3FFF) {
       last_field = 0xFFFFFFFF;
     } else {
+      XASSERT(value < 0x3FFF, "Skipping %u fields.", value);
       last_field += value + 1;
     }
   }
@@ -39,19 +43,35 @@ void read_field_list(std::vector<uint32_t> &fields, Bitstream &stream) {
   }
 }
 
-void Entity::update(Bitstream &stream) {
+void Entity::update(Bitstream &stream, InternTable &strings, FloatBatch *floats,
+    ChangedProps *changed) {
   std::vector<uint32_t> fields;
   read_field_list(fields, stream);
 
-  std::string name;
+  // Fields only ever go up, so checking the last one covers them all.
+  XASSERT(fields.empty() || fields.back() < table->props.size(), "Field %u isn't in %s.",
+      fields.back(), table->net_table_name.c_str());
+
   for (auto iter = fields.begin(); iter != fields.end(); ++iter) {
     uint32_t i = *iter;
 
     //std::cout << table->props[i]->var_name << " " <<
     //  table->props[i]->type << " " <<
     //  table->props[i]->flags << ": ";
-    auto prop = Property::read_prop(stream, table->props[i], name);
-    properties[name] = prop;
+    const SendProp *send_prop = table->props[i];
+    std::shared_ptr<Property> &property = properties[send_prop->qualified_name];
+
+    STATS_MARK(start, stream.get_position());
+    property = Property::read_prop(stream, send_prop, strings, floats);
+    STATS_ADD(prop_bits[send_prop->type], stream.get_position() - start);
+
+    if (changed) {
+      changed->push_back(std::make_pair(i, property.get()));
+    }
+  }
+
+  if (floats) {
+    floats->flush();
   }
 }
 
@@ -59,6 +79,7 @@ void swap(Entity &first, Entity &second) {
   using std::swap;
 
   swap(first.id, second.id);
+  swap(first.clazz, second.clazz);
   swap(first.table, second.table);
   swap(first.properties, second.properties);
 }
@@ -10,14 +10,22 @@
 class Bitstream;
 class Class;
 class FlatSendTable;
+class FloatBatch;
+class InternTable;
 class Property;
 
+// The flat prop index and new value of each prop read by an update, in the order read.
+typedef std::vector<std::pair<uint32_t, const Property*>> ChangedProps;
+
 class Entity {
 public:
   Entity();
   Entity(uint32_t id, const Class &clazz, const FlatSendTable &table);
 
-  void update(Bitstream &stream);
+  // If floats is set, float props are converted in one batch at the end of the update
+  // instead of as they are read. If changed is set, what the update read is appended to it.
+  void update(Bitstream &stream, InternTable &strings, FloatBatch *floats = 0,
+      ChangedProps *changed = 0);
 
   friend void swap(Entity &first, Entity &second);
 
@@ -0,0 +1,106 @@
+#include "entity_view.h"
+
+#include <algorithm>
+#include <unordered_map>
+
+#include "schema.h"
+
+EntityViewBase::EntityViewBase(const std::string &_class_prefix) : class_prefix(_class_prefix) {
+}
+
+EntityViewBase::~EntityViewBase() {
+}
+
+void EntityViewBase::add_field(Field *field) {
+  for (auto iter = fields.begin(); iter != fields.end(); ++iter) {
+    XASSERT((*iter)->name != field->name, "%s is already bound.", field->name.c_str());
+  }
+
+  fields.push_back(std::unique_ptr<Field>(field));
+}
+
+// Failures are reported per field rather than per class since a view usually covers many
+// classes with the same props.
+std::vector<std::string> EntityViewBase::bind(const Schema &schema) {
+  std::vector<std::string> errors;
+
+  std::unordered_map<std::string, size_t> by_name;
+  for (size_t i = 0; i < fields.size(); ++i) {
+    by_name[fields[i]->name] = i;
+  }
+
+  uint32_t max_id = 0;
+  for (auto iter = schema.classes.begin(); iter != schema.classes.end(); ++iter) {
+    max_id = std::max(max_id, iter->id);
+  }
+
+  bindings.assign(max_id + 1, std::vector<const Field*>());
+
+  std::vector<bool> failed(fields.size(), false);
+  bool matched = false;
+
+  for (auto iter = schema.classes.begin(); iter != schema.classes.end(); ++iter) {
+    const Class &clazz = *iter;
+    if (clazz.name.compare(0, class_prefix.size(), class_prefix) != 0 || !clazz.flat_table) {
+      continue;
+    }
+
+    matched = true;
+
+    const std::vector<const SendProp*> &props = clazz.flat_table->props;
+    std::vector<const Field*> &bound = bindings[clazz.id];
+    bound.assign(props.size(), 0);
+
+    std::vector<bool> found(fields.size(), false);
+    for (size_t i = 0; i < props.size(); ++i) {
+      auto field = by_name.find(props[i]->qualified_name);
+      if (field == by_name.end()) {
+        continue;
+      }
+
+      found[field->second] = true;
+
+      if (props[i]->type != fields[field->second]->type) {
+        if (!failed[field->second]) {
+          errors.push_back(fields[field->second]->name + " in " + clazz.name +
+              " has send prop type " + std::to_string(props[i]->type) + " but the field wants " +
+              std::to_string(fields[field->second]->type) + ".");
+          failed[field->second] = true;
+        }
+        continue;
+      }
+
+      bound[i] = fields[field->second].get();
+    }
+
+    for (size_t i = 0; i < fields.size(); ++i) {
+      if (!found[i] && !failed[i]) {
+        errors.push_back(fields[i]->name + " isn't a prop of " + clazz.name + ".");
+        failed[i] = true;
+      }
+    }
+  }
+
+  if (!matched) {
+    errors.push_back("No class starts with " + class_prefix + ".");
+  }
+
+  return errors;
+}
+
+bool EntityViewBase::binds(uint32_t class_id) const {
+  return class_id < bindings.size() && !bindings[class_id].empty();
+}
+
+void EntityViewBase::write(const Entity &entity, const ChangedProps &changed) {
+  const std::vector<const Field*> &bound = bindings[entity.clazz->id];
+  void *to = object(entity.id);
+
+  for (auto iter = changed.begin(); iter != changed.end(); ++iter) {
+    const Field *field = bound[iter->first];
+
+    if (field) {
+      field->assign(to, *iter->second);
+    }
+  }
+}
@@ -0,0 +1,209 @@
+#ifndef _ENTITY_VIEW_H
+#define _ENTITY_VIEW_H
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "debug.h"
+#include "entity.h"
+#include "property.h"
+
+class Schema;
+
+// How a struct member of type M is filled in, and which send prop type it needs.
+template<typename M>
+struct ViewFieldTraits;
+
+template<>
+struct ViewFieldTraits<uint32_t> {
+  static const SP_Types type = SP_Int;
+
+  static void assign(uint32_t &to, const Property &from) {
+    to = static_cast<const IntProperty&>(from).value;
+  }
+};
+
+template<>
+struct ViewFieldTraits<int32_t> {
+  static const SP_Types type = SP_Int;
+
+  static void assign(int32_t &to, const Property &from) {
+    to = static_cast<const IntProperty&>(from).value;
+  }
+};
+
+template<>
+struct ViewFieldTraits<float> {
+  static const SP_Types type = SP_Float;
+
+  static void assign(float &to, const Property &from) {
+    to = static_cast<const FloatProperty&>(from).value;
+  }
+};
+
+template<>
+struct ViewFieldTraits<uint64_t> {
+  static const SP_Types type = SP_Int64;
+
+  static void assign(uint64_t &to, const Property &from) {
+    to = static_cast<const Int64Property&>(from).value;
+  }
+};
+
+template<>
+struct ViewFieldTraits<std::string> {
+  static const SP_Types type = SP_String;
+
+  static void assign(std::string &to, const Property &from) {
+    to = static_cast<const StringProperty&>(from).value.str();
+  }
+};
+
+template<>
+struct ViewFieldTraits<std::array<float, 3>> {
+  static const SP_Types type = SP_Vector;
+
+  static void assign(std::array<float, 3> &to, const Property &from) {
+    const float *values = static_cast<const VectorProperty&>(from).values;
+    std::copy(values, values + 3, to.begin());
+  }
+};
+
+template<>
+struct ViewFieldTraits<std::array<float, 2>> {
+  static const SP_Types type = SP_VectorXY;
+
+  static void assign(std::array<float, 2> &to, const Property &from) {
+    const float *values = static_cast<const VectorXYProperty&>(from).values;
+    std::copy(values, values + 2, to.begin());
+  }
+};
+
+// A struct per entity whose members are kept up to date by the parser. Fields are named by
+// their qualified prop names and bound to flat prop indices when the schema arrives, so an
+// update writes straight into the bound members without any name lookups. Attach views with
+// Parser::add_view.
+class EntityViewBase {
+public:
+  // Covers every class whose name starts with class_prefix, so a full class name covers one.
+  EntityViewBase(const std::string &_class_prefix);
+  virtual ~EntityViewBase();
+
+  // Returns a message for each field that couldn't be bound. Those fields are left alone.
+  std::vector<std::string> bind(const Schema &schema);
+  bool binds(uint32_t class_id) const;
+
+  virtual void reset(uint32_t entity_id) = 0;
+  void write(const Entity &entity, const ChangedProps &changed);
+
+protected:
+  class Field {
+  public:
+    Field(const std::string &_name, SP_Types _type) : name(_name), type(_type) {
+    }
+
+    virtual ~Field() {
+    }
+
+    virtual void assign(void *object, const Property &property) const = 0;
+
+    std::string name;
+    SP_Types type;
+  };
+
+  virtual void *object(uint32_t entity_id) = 0;
+
+  // Each prop can only be bound to one field.
+  void add_field(Field *field);
+
+  std::vector<std::unique_ptr<Field>> fields;
+
+private:
+  EntityViewBase(const EntityViewBase&);
+  EntityViewBase &operator=(const EntityViewBase&);
+
+  std::string class_prefix;
+
+  // For each class id, the field bound to each flat prop index. Empty for classes that aren't
+  // covered.
+  std::vector<std::vector<const Field*>> bindings;
+};
+
+template<typename T>
+class EntityView : public EntityViewBase {
+public:
+  EntityView(const std::string &class_prefix) : EntityViewBase(class_prefix) {
+  }
+
+  template<typename M>
+  EntityView &field(const std::string &name, M T::*member) {
+    add_field(new MemberField<M>(name, member));
+    return *this;
+  }
+
+  // Binds one element of an array member, for props like m_iszPlayerNames.0003.
+  template<typename M, size_t N>
+  EntityView &field(const std::string &name, M (T::*member)[N], size_t index) {
+    XASSERT(index < N, "Index %lu is out of bounds.", index);
+
+    add_field(new ElementField<M, N>(name, member, index));
+    return *this;
+  }
+
+  const T &get(const Entity &entity) const {
+    XASSERT(entity.id < objects.size(), "Entity %u has no view.", entity.id);
+
+    return objects[entity.id];
+  }
+
+  void reset(uint32_t entity_id) {
+    if (entity_id >= objects.size()) {
+      objects.resize(entity_id + 1);
+    }
+
+    objects[entity_id] = T();
+  }
+
+private:
+  template<typename M>
+  class MemberField : public Field {
+  public:
+    MemberField(const std::string &name, M T::*_member) :
+        Field(name, ViewFieldTraits<M>::type), member(_member) {
+    }
+
+    void assign(void *object, const Property &property) const {
+      ViewFieldTraits<M>::assign(static_cast<T*>(object)->*member, property);
+    }
+
+    M T::*member;
+  };
+
+  template<typename M, size_t N>
+  class ElementField : public Field {
+  public:
+    ElementField(const std::string &name, M (T::*_member)[N], size_t _index) :
+        Field(name, ViewFieldTraits<M>::type), member(_member), index(_index) {
+    }
+
+    void assign(void *object, const Property &property) const {
+      ViewFieldTraits<M>::assign((static_cast<T*>(object)->*member)[index], property);
+    }
+
+    M (T::*member)[N];
+    size_t index;
+  };
+
+  void *object(uint32_t entity_id) {
+    return &objects[entity_id];
+  }
+
+  std::vector<T> objects;
+};
+
+#endif
@@ -0,0 +1,216 @@
+#include "float_batch.h"
+
+#include <cmath>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "state.h"
+
+#define NORMAL_SCALE 4.885197850512946e-4
+#define SIGN_BIT 0x80000000
+
+static inline float negate_if(float f, uint32_t sign) {
+  uint32_t bits;
+  memcpy(&bits, &f, sizeof(bits));
+  bits ^= sign;
+  memcpy(&f, &bits, sizeof(bits));
+  return f;
+}
+
+FloatBatch::FloatBatch() {
+}
+
+void FloatBatch::add_quantized(float *out, uint32_t dividend, const SendProp *prop) {
+  quantized.out.push_back(out);
+  quantized.dividend.push_back(dividend);
+  quantized.divisor.push_back((float) ((1 << prop->num_bits) - 1));
+  quantized.range.push_back(prop->high_value - prop->low_value);
+  quantized.low.push_back(prop->low_value);
+}
+
+void FloatBatch::add_fixed(float *out, uint32_t integer, uint32_t fraction,
+    float fraction_scale, bool negate) {
+  fixed.out.push_back(out);
+  fixed.integer.push_back(integer);
+  fixed.fraction.push_back(fraction);
+  fixed.scale.push_back(fraction_scale);
+  fixed.sign.push_back(negate ? SIGN_BIT : 0);
+}
+
+void FloatBatch::add_normal(float *out, uint32_t value, bool negate) {
+  normal.out.push_back(out);
+  normal.value.push_back(value);
+  normal.sign.push_back(negate ? SIGN_BIT : 0);
+}
+
+void FloatBatch::add_normal_z(float *vector, bool negate) {
+  normal_z.vector.push_back(vector);
+  normal_z.sign.push_back(negate ? SIGN_BIT : 0);
+}
+
+bool FloatBatch::empty() const {
+  return quantized.out.empty() && fixed.out.empty() && normal.out.empty() &&
+      normal_z.vector.empty();
+}
+
+void FloatBatch::flush() {
+  flush_quantized();
+  flush_fixed();
+  flush_normal();
+
+  // The z reconstruction reads x and y, so it has to wait for everything else.
+  flush_normal_z();
+}
+
+void FloatBatch::flush_quantized() {
+  size_t count = quantized.out.size();
+  size_t i = 0;
+
+#ifdef __SSE2__
+  for (; i + 4 <= count; i += 4) {
+    __m128 dividend = _mm_cvtepi32_ps(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(&quantized.dividend[i])));
+    __m128 f = _mm_div_ps(dividend, _mm_loadu_ps(&quantized.divisor[i]));
+    f = _mm_add_ps(_mm_mul_ps(f, _mm_loadu_ps(&quantized.range[i])),
+        _mm_loadu_ps(&quantized.low[i]));
+
+    float converted[4];
+    _mm_storeu_ps(converted, f);
+    for (size_t j = 0; j < 4; ++j) {
+      *quantized.out[i + j] = converted[j];
+    }
+  }
+#endif
+
+  for (; i < count; ++i) {
+    float f = ((float) quantized.dividend[i]) / quantized.divisor[i];
+    *quantized.out[i] = f * quantized.range[i] + quantized.low[i];
+  }
+
+  quantized.out.clear();
+  quantized.dividend.clear();
+  quantized.divisor.clear();
+  quantized.range.clear();
+  quantized.low.clear();
+}
+
+void FloatBatch::flush_fixed() {
+  size_t count = fixed.out.size();
+  size_t i = 0;
+
+#ifdef __SSE2__
+  for (; i + 4 <= count; i += 4) {
+    __m128 integer = _mm_cvtepi32_ps(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(&fixed.integer[i])));
+    __m128 fraction = _mm_cvtepi32_ps(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(&fixed.fraction[i])));
+    __m128 f = _mm_add_ps(integer, _mm_mul_ps(fraction, _mm_loadu_ps(&fixed.scale[i])));
+    f = _mm_xor_ps(f, _mm_castsi128_ps(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(&fixed.sign[i]))));
+
+    float converted[4];
+    _mm_storeu_ps(converted, f);
+    for (size_t j = 0; j < 4; ++j) {
+      *fixed.out[i + j] = converted[j];
+    }
+  }
+#endif
+
+  for (; i < count; ++i) {
+    float f = (float) fixed.integer[i] + (float) fixed.fraction[i] * fixed.scale[i];
+    *fixed.out[i] = negate_if(f, fixed.sign[i]);
+  }
+
+  fixed.out.clear();
+  fixed.integer.clear();
+  fixed.fraction.clear();
+  fixed.scale.clear();
+  fixed.sign.clear();
+}
+
+void FloatBatch::flush_normal() {
+  size_t count = normal.out.size();
+  size_t i = 0;
+
+#ifdef __SSE2__
+  // read_float_normal scales in double precision, so do the same two lanes at a time.
+  const __m128d scale = _mm_set1_pd(NORMAL_SCALE);
+  for (; i + 4 <= count; i += 4) {
+    __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&normal.value[i]));
+    __m128 low = _mm_cvtpd_ps(_mm_mul_pd(_mm_cvtepi32_pd(value), scale));
+    __m128 high = _mm_cvtpd_ps(_mm_mul_pd(_mm_cvtepi32_pd(_mm_srli_si128(value, 8)), scale));
+    __m128 f = _mm_movelh_ps(low, high);
+    f = _mm_xor_ps(f, _mm_castsi128_ps(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(&normal.sign[i]))));
+
+    float converted[4];
+    _mm_storeu_ps(converted, f);
+    for (size_t j = 0; j < 4; ++j) {
+      *normal.out[i + j] = converted[j];
+    }
+  }
+#endif
+
+  for (; i < count; ++i) {
+    float f = (float) (normal.value[i] * NORMAL_SCALE);
+    *normal.out[i] = negate_if(f, normal.sign[i]);
+  }
+
+  normal.out.clear();
+  normal.value.clear();
+  normal.sign.clear();
+}
+
+void FloatBatch::flush_normal_z() {
+  size_t count = normal_z.vector.size();
+  size_t i = 0;
+
+#ifdef __SSE2__
+  const __m128 one = _mm_set1_ps(1);
+  for (; i + 4 <= count; i += 4) {
+    float x[4];
+    float y[4];
+    for (size_t j = 0; j < 4; ++j) {
+      x[j] = normal_z.vector[i + j][0];
+      y[j] = normal_z.vector[i + j][1];
+    }
+
+    __m128 vx = _mm_loadu_ps(x);
+    __m128 vy = _mm_loadu_ps(y);
+    __m128 f = _mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy));
+    __m128 rest = _mm_sub_ps(one, f);
+
+    __m128 low = _mm_cvtpd_ps(_mm_sqrt_pd(_mm_cvtps_pd(rest)));
+    __m128 high = _mm_cvtpd_ps(_mm_sqrt_pd(_mm_cvtps_pd(_mm_movehl_ps(rest, rest))));
+    __m128 z = _mm_andnot_ps(_mm_cmple_ps(f, one), _mm_movelh_ps(low, high));
+    z = _mm_xor_ps(z, _mm_castsi128_ps(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(&normal_z.sign[i]))));
+
+    float converted[4];
+    _mm_storeu_ps(converted, z);
+    for (size_t j = 0; j < 4; ++j) {
+      normal_z.vector[i + j][2] = converted[j];
+    }
+  }
+#endif
+
+  for (; i < count; ++i) {
+    float *vector = normal_z.vector[i];
+    float f = vector[0] * vector[0] + vector[1] * vector[1];
+
+    float z;
+    if (1 >= f) {
+      z = 0;
+    } else {
+      z = sqrt(1 - f);
+    }
+
+    vector[2] = negate_if(z, normal_z.sign[i]);
+  }
+
+  normal_z.vector.clear();
+  normal_z.sign.clear();
+}
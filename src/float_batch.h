@@ -0,0 +1,67 @@
+#ifndef _FLOAT_BATCH_H
+#define _FLOAT_BATCH_H
+
+#include <stdint.h>
+
+#include <vector>
+
+class SendProp;
+
+// Collects the raw codes of float props while an update is being read and converts them
+// all at once in flush(). Each add_* call records where the converted value goes; the
+// pointer must stay valid until flush() returns.
+//
+// The conversions give bit for bit the same results as the scalar readers in property.cpp.
+class FloatBatch {
+public:
+  FloatBatch();
+
+  // dividend / (2^num_bits - 1) * (high - low) + low
+  void add_quantized(float *out, uint32_t dividend, const SendProp *prop);
+  // (integer + fraction * fraction_scale), negated if asked. The sum must be exact in a
+  // float, which the callers guarantee by limiting the number of integer bits.
+  void add_fixed(float *out, uint32_t integer, uint32_t fraction, float fraction_scale,
+      bool negate);
+  // value / 2047 with an optional sign, like read_float_normal.
+  void add_normal(float *out, uint32_t value, bool negate);
+  // Reconstructs vector[2] from vector[0] and vector[1] once those are converted.
+  void add_normal_z(float *vector, bool negate);
+
+  bool empty() const;
+  void flush();
+
+private:
+  void flush_quantized();
+  void flush_fixed();
+  void flush_normal();
+  void flush_normal_z();
+
+  struct Quantized {
+    std::vector<float *> out;
+    std::vector<int32_t> dividend;
+    std::vector<float> divisor;
+    std::vector<float> range;
+    std::vector<float> low;
+  } quantized;
+
+  struct Fixed {
+    std::vector<float *> out;
+    std::vector<int32_t> integer;
+    std::vector<int32_t> fraction;
+    std::vector<float> scale;
+    std::vector<uint32_t> sign;
+  } fixed;
+
+  struct Normal {
+    std::vector<float *> out;
+    std::vector<int32_t> value;
+    std::vector<uint32_t> sign;
+  } normal;
+
+  struct NormalZ {
+    std::vector<float *> vector;
+    std::vector<uint32_t> sign;
+  } normal_z;
+};
+
+#endif
@@ -0,0 +1,69 @@
+#include "intern_table.h"
+
+#include <functional>
+
+#include "memory.h"
+
+static const std::string EMPTY_STRING;
+
+InternedString::InternedString() : value(&EMPTY_STRING) {
+}
+
+InternedString::InternedString(const std::string *_value) : value(_value) {
+}
+
+const std::string &InternedString::str() const {
+  return *value;
+}
+
+InternedString::operator const std::string &() const {
+  return *value;
+}
+
+bool InternedString::operator==(const InternedString &that) const {
+  return value == that.value;
+}
+
+bool InternedString::operator!=(const InternedString &that) const {
+  return value != that.value;
+}
+
+// Orders by address, which is stable for a table's lifetime but not alphabetical.
+bool InternedString::operator<(const InternedString &that) const {
+  return std::less<const std::string *>()(value, that.value);
+}
+
+InternTable::InternTable() {
+}
+
+InternedString InternTable::intern(const char *data, size_t length) {
+  // Reuse the scratch buffer for the lookup so repeats don't allocate.
+  scratch.assign(data, length);
+
+  auto iter = strings.find(scratch);
+  if (iter == strings.end()) {
+    iter = strings.insert(scratch).first;
+  }
+
+  return InternedString(&*iter);
+}
+
+InternedString InternTable::intern(const std::string &value) {
+  auto iter = strings.insert(value).first;
+
+  return InternedString(&*iter);
+}
+
+size_t InternTable::size() const {
+  return strings.size();
+}
+
+size_t InternTable::memory() const {
+  size_t bytes = strings.bucket_count() * sizeof(void *) + string_memory(scratch);
+
+  for (auto iter = strings.begin(); iter != strings.end(); ++iter) {
+    bytes += HASH_NODE_BYTES + sizeof(std::string) + string_memory(*iter);
+  }
+
+  return bytes;
+}
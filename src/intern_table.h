@@ -0,0 +1,45 @@
+#ifndef _INTERN_TABLE_H
+#define _INTERN_TABLE_H
+
+#include <stdint.h>
+
+#include <string>
+#include <unordered_set>
+
+// A handle to a string owned by an InternTable. Two handles from the same table compare
+// equal exactly when their strings do, so comparing them is a pointer comparison.
+class InternedString {
+public:
+  InternedString();
+  explicit InternedString(const std::string *value);
+
+  const std::string &str() const;
+  operator const std::string &() const;
+
+  bool operator==(const InternedString &that) const;
+  bool operator!=(const InternedString &that) const;
+  bool operator<(const InternedString &that) const;
+
+private:
+  const std::string *value;
+};
+
+// Deduplicates strings for the lifetime of a parse. Handles stay valid until the table is
+// destroyed.
+class InternTable {
+public:
+  InternTable();
+
+  InternedString intern(const char *data, size_t length);
+  InternedString intern(const std::string &value);
+  size_t size() const;
+
+  // Roughly the bytes held by the table and its strings.
+  size_t memory() const;
+
+private:
+  std::unordered_set<std::string> strings;
+  std::string scratch;
+};
+
+#endif
@@ -0,0 +1,174 @@
+#include "memory.h"
+
+#include "property.h"
+#include "schema.h"
+#include "state.h"
+#include "trigger.h"
+
+const char *MEMORY_CATEGORY_NAMES[MC_Count] = {
+  "entities", "properties", "string_tables", "send_tables", "buffers",
+};
+
+MemoryUsage::MemoryUsage() {
+  for (uint32_t i = 0; i < MC_Count; ++i) {
+    bytes[i] = 0;
+  }
+}
+
+uint64_t MemoryUsage::total() const {
+  uint64_t sum = 0;
+  for (uint32_t i = 0; i < MC_Count; ++i) {
+    sum += bytes[i];
+  }
+
+  return sum;
+}
+
+void MemoryUsage::write_json(std::ostream &out) const {
+  out << "{\"total\": " << total();
+  for (uint32_t i = 0; i < MC_Count; ++i) {
+    out << ", \"" << MEMORY_CATEGORY_NAMES[i] << "\": " << bytes[i];
+  }
+  out << "}";
+}
+
+size_t string_memory(const std::string &value) {
+  return value.capacity() > STRING_INLINE_CAPACITY ? value.capacity() + 1 : 0;
+}
+
+template<typename P>
+size_t packed_array_memory(const Property &property) {
+  return sizeof(P) + vector_memory(static_cast<const P&>(property).values);
+}
+
+// Arrays are packed or not depending on their element type, the same way read_array_prop
+// decides.
+size_t array_memory(const Property &property) {
+  if (const ArrayProperty *array = dynamic_cast<const ArrayProperty *>(&property)) {
+    size_t bytes = sizeof(ArrayProperty) + vector_memory(array->elements);
+
+    for (auto iter = array->elements.begin(); iter != array->elements.end(); ++iter) {
+      bytes += property_memory(**iter);
+    }
+
+    return bytes;
+  } else if (dynamic_cast<const IntArrayProperty *>(&property)) {
+    return packed_array_memory<IntArrayProperty>(property);
+  } else if (dynamic_cast<const FloatArrayProperty *>(&property)) {
+    return packed_array_memory<FloatArrayProperty>(property);
+  } else if (dynamic_cast<const VectorArrayProperty *>(&property)) {
+    return packed_array_memory<VectorArrayProperty>(property);
+  } else if (dynamic_cast<const VectorXYArrayProperty *>(&property)) {
+    return packed_array_memory<VectorXYArrayProperty>(property);
+  } else {
+    return packed_array_memory<Int64ArrayProperty>(property);
+  }
+}
+
+// Strings point into the intern table, which is counted separately.
+size_t property_memory(const Property &property) {
+  size_t bytes = SHARED_COUNT_BYTES;
+
+  if (property.type == SP_Int) {
+    bytes += sizeof(IntProperty);
+  } else if (property.type == SP_Float) {
+    bytes += sizeof(FloatProperty);
+  } else if (property.type == SP_Vector) {
+    bytes += sizeof(VectorProperty);
+  } else if (property.type == SP_VectorXY) {
+    bytes += sizeof(VectorXYProperty);
+  } else if (property.type == SP_String) {
+    bytes += sizeof(StringProperty);
+  } else if (property.type == SP_Array) {
+    bytes += array_memory(property);
+  } else {
+    bytes += sizeof(Int64Property);
+  }
+
+  return bytes;
+}
+
+void measure_entities(const State &state, MemoryUsage &usage) {
+  typedef std::pair<const std::string, std::shared_ptr<Property>> PropertyNode;
+
+  usage.bytes[MC_Entities] += MAX_ENTITIES * sizeof(Entity);
+
+  for (size_t i = 0; i < MAX_ENTITIES; ++i) {
+    const Entity &entity = state.entities[i];
+    if (entity.id == (uint32_t) -1) {
+      continue;
+    }
+
+    usage.bytes[MC_Entities] += entity.properties.bucket_count() * sizeof(void *);
+
+    for (auto iter = entity.properties.begin(); iter != entity.properties.end(); ++iter) {
+      usage.bytes[MC_Entities] += HASH_NODE_BYTES + sizeof(PropertyNode) +
+          string_memory(iter->first);
+
+      if (iter->second) {
+        usage.bytes[MC_Properties] += property_memory(*iter->second);
+      }
+    }
+  }
+
+  usage.bytes[MC_Properties] += state.interned_strings.memory();
+}
+
+size_t dt_prop_memory(const DTProp &dt_prop) {
+  size_t bytes = vector_memory(dt_prop.dt_props) + vector_memory(dt_prop.non_dt_props);
+
+  for (auto iter = dt_prop.dt_props.begin(); iter != dt_prop.dt_props.end(); ++iter) {
+    bytes += dt_prop_memory(*iter);
+  }
+
+  return bytes;
+}
+
+size_t schema_memory(const Schema &schema) {
+  size_t bytes = sizeof(Schema) + schema.send_tables.memory() +
+      schema.flat_send_tables.memory() + vector_memory(schema.classes) + schema.names.memory();
+
+  for (auto iter = schema.send_tables.begin(); iter != schema.send_tables.end(); ++iter) {
+    const SendTable &table = *iter;
+    bytes += string_memory(table.net_table_name) + table.props.memory();
+
+    for (auto prop = table.props.begin(); prop != table.props.end(); ++prop) {
+      bytes += string_memory((*prop).var_name) + string_memory((*prop).dt_name) +
+          string_memory((*prop).qualified_name);
+    }
+  }
+
+  for (auto iter = schema.flat_send_tables.begin(); iter != schema.flat_send_tables.end();
+      ++iter) {
+    bytes += string_memory((*iter).net_table_name) + vector_memory((*iter).props) +
+        dt_prop_memory((*iter).dt_prop);
+  }
+
+  for (auto iter = schema.classes.begin(); iter != schema.classes.end(); ++iter) {
+    bytes += string_memory(iter->dt_name) + string_memory(iter->name);
+  }
+
+  return bytes;
+}
+
+void measure_memory(const State &state, MemoryUsage &usage) {
+  measure_entities(state, usage);
+
+  usage.bytes[MC_StringTables] += state.string_tables.memory();
+  for (auto iter = state.string_tables.begin(); iter != state.string_tables.end(); ++iter) {
+    usage.bytes[MC_StringTables] += (*iter).memory();
+  }
+
+  if (state.schema) {
+    usage.bytes[MC_SendTables] += schema_memory(*state.schema);
+  }
+
+  usage.bytes[MC_Buffers] += sizeof(State) + string_memory(state.send_tables_data) +
+      vector_memory(state.changed_props) + vector_memory(state.baselines) +
+      vector_memory(state.class_bindings);
+
+  for (auto iter = state.class_bindings.begin(); iter != state.class_bindings.end(); ++iter) {
+    usage.bytes[MC_Buffers] += vector_memory(iter->views) + vector_memory(iter->triggers) +
+        vector_memory(iter->indexes) + vector_memory(iter->aggregates);
+  }
+}
@@ -0,0 +1,59 @@
+#ifndef _MEMORY_H
+#define _MEMORY_H
+
+#include <stdint.h>
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+// libstdc++ keeps strings this short inside the string itself.
+#define STRING_INLINE_CAPACITY 15
+// The next pointer and cached hash in each node of an unordered_map or unordered_set of strings.
+#define HASH_NODE_BYTES (2 * sizeof(void *))
+// The control block shared_ptr allocates when it's handed a raw pointer.
+#define SHARED_COUNT_BYTES 24
+
+class Property;
+class State;
+
+enum MemoryCategory {
+  // The entity array and each entity's map of props.
+  MC_Entities,
+  // Prop values and the interned strings they point to.
+  MC_Properties,
+  MC_StringTables,
+  // The schema: send tables, flattened tables and classes. It can be shared with other parses
+  // through the schema cache.
+  MC_SendTables,
+  // Scratch space reused between entity updates and lookups by class.
+  MC_Buffers,
+  MC_Count,
+};
+
+// Roughly how much memory a parse holds, by what it's for. These are estimates made by walking
+// the parser's structures with the sizes libstdc++ uses, not counts of actual allocations, so
+// allocator overhead and the fixed frame buffers in Demo aren't included.
+struct MemoryUsage {
+  MemoryUsage();
+
+  uint64_t total() const;
+  void write_json(std::ostream &out) const;
+
+  uint64_t bytes[MC_Count];
+};
+
+// Bytes a string has allocated outside itself.
+size_t string_memory(const std::string &value);
+
+// Bytes a prop value allocated, including its shared_ptr control block.
+size_t property_memory(const Property &property);
+
+template<typename T>
+size_t vector_memory(const std::vector<T> &values) {
+  return values.capacity() * sizeof(T);
+}
+
+void measure_memory(const State &state, MemoryUsage &usage);
+
+#endif
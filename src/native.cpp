@@ -0,0 +1,553 @@
+#include "native.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "edith.pb.h"
+
+#include "debug.h"
+#include "entity.h"
+#include "property.h"
+#include "state.h"
+
+#define NATIVE_MAGIC "EDITHNAT"
+
+typedef std::vector<std::shared_ptr<Property>*> PropSlots;
+
+template<typename T>
+void append_fixed(std::string &out, T value) {
+  out.append((const char *) &value, sizeof(value));
+}
+
+void append_var_int(std::string &out, uint32_t value) {
+  do {
+    uint8_t b = value & 0x7F;
+    value >>= 7;
+    out.push_back((char) (value ? b | 0x80 : b));
+  } while (value);
+}
+
+void append_value(std::string &out, const Property &property, const SendProp *prop);
+
+template<typename P, typename T, size_t C>
+void append_packed_array(std::string &out, const Property &property) {
+  const P &array = static_cast<const P&>(property);
+
+  append_var_int(out, array.count);
+  out.append((const char *) array.values.data(), array.count * C * sizeof(T));
+}
+
+// Arrays are split up the same way read_array_prop splits them.
+void append_array(std::string &out, const Property &property, const SendProp *prop) {
+  XASSERT(prop->array_prop, "Array prop has no inner prop.");
+
+  SP_Types element_type = prop->array_prop->type;
+
+  if (element_type == SP_Int) {
+    append_packed_array<IntArrayProperty, uint32_t, 1>(out, property);
+  } else if (element_type == SP_Float) {
+    append_packed_array<FloatArrayProperty, float, 1>(out, property);
+  } else if (element_type == SP_Vector) {
+    append_packed_array<VectorArrayProperty, float, 3>(out, property);
+  } else if (element_type == SP_VectorXY) {
+    append_packed_array<VectorXYArrayProperty, float, 2>(out, property);
+  } else if (element_type == SP_Int64) {
+    append_packed_array<Int64ArrayProperty, uint64_t, 1>(out, property);
+  } else {
+    const ArrayProperty &array = static_cast<const ArrayProperty&>(property);
+
+    append_var_int(out, array.elements.size());
+    for (auto iter = array.elements.begin(); iter != array.elements.end(); ++iter) {
+      append_value(out, **iter, prop->array_prop);
+    }
+  }
+}
+
+void append_value(std::string &out, const Property &property, const SendProp *prop) {
+  if (prop->type == SP_Int) {
+    append_fixed(out, static_cast<const IntProperty&>(property).value);
+  } else if (prop->type == SP_Float) {
+    append_fixed(out, static_cast<const FloatProperty&>(property).value);
+  } else if (prop->type == SP_Vector) {
+    out.append((const char *) static_cast<const VectorProperty&>(property).values,
+        3 * sizeof(float));
+  } else if (prop->type == SP_VectorXY) {
+    out.append((const char *) static_cast<const VectorXYProperty&>(property).values,
+        2 * sizeof(float));
+  } else if (prop->type == SP_String) {
+    const std::string &value = static_cast<const StringProperty&>(property).value;
+
+    append_var_int(out, value.size());
+    out.append(value);
+  } else if (prop->type == SP_Array) {
+    append_array(out, property, prop);
+  } else if (prop->type == SP_Int64) {
+    append_fixed(out, static_cast<const Int64Property&>(property).value);
+  } else {
+    XERROR("Unknown send prop type %d", prop->type);
+  }
+}
+
+NativeWriter::NativeWriter(const std::string &path) :
+    schema(0), closed(false) {
+  out.open(path.c_str(), std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+  XASSERT(out.is_open(), "Can't open %s.", path.c_str());
+
+  buffer.append(NATIVE_MAGIC);
+  append_fixed<uint32_t>(buffer, NATIVE_FORMAT_VERSION);
+}
+
+NativeWriter::~NativeWriter() {
+  close();
+}
+
+bool NativeWriter::close() {
+  if (closed) {
+    return !out.fail();
+  }
+
+  buffer.push_back('E');
+  flush(true);
+  out.close();
+
+  closed = true;
+  return !out.fail();
+}
+
+void NativeWriter::visit_schema(const Schema &_schema) {
+  schema = &_schema;
+
+  CEdithSchema saved;
+  schema->save(saved);
+
+  std::string data;
+  saved.SerializeToString(&data);
+
+  buffer.push_back('S');
+  append_fixed<uint32_t>(buffer, data.size());
+  buffer.append(data);
+}
+
+void NativeWriter::visit_tick(uint32_t tick) {
+  buffer.push_back('T');
+  append_fixed(buffer, tick);
+}
+
+void NativeWriter::visit_entity_created(const Entity &entity) {
+  write_entity('C', entity, true);
+}
+
+void NativeWriter::visit_entity_updated(const Entity &entity) {
+  write_entity('U', entity, false);
+}
+
+void NativeWriter::visit_entity_deleted(const Entity &entity) {
+  buffer.push_back('D');
+  append_var_int(buffer, entity.id);
+}
+
+void NativeWriter::visit_entity_changes(const Entity &, const ChangedProps &changed) {
+  for (auto iter = changed.begin(); iter != changed.end(); ++iter) {
+    pending.push_back(iter->first);
+  }
+}
+
+// A created entity's props were reported once for its baseline and again for what the packet
+// set, and only the first time each shows up is kept. Values are the entity's, so they're the
+// ones the packet left.
+void NativeWriter::write_entity(char type, const Entity &entity, bool with_class) {
+  XASSERT(!closed, "Writer is closed.");
+
+  buffer.push_back(type);
+  append_var_int(buffer, entity.id);
+
+  if (with_class) {
+    XASSERT(schema, "Entity before the schema.");
+    append_var_int(buffer, entity.clazz - &schema->classes[0]);
+  }
+
+  const std::vector<const SendProp*> &props = entity.table->props;
+  written.assign(props.size(), false);
+
+  std::string values;
+  uint32_t count = 0;
+
+  for (auto iter = pending.begin(); iter != pending.end(); ++iter) {
+    if (written[*iter]) {
+      continue;
+    }
+
+    const SendProp *prop = props[*iter];
+    auto found = entity.properties.find(prop->qualified_name);
+    XASSERT(found != entity.properties.end(), "Entity %u has no %s.", entity.id,
+        prop->qualified_name.c_str());
+
+    append_var_int(values, *iter);
+    append_value(values, *found->second, prop);
+
+    written[*iter] = true;
+    ++count;
+  }
+
+  append_var_int(buffer, count);
+  buffer.append(values);
+
+  pending.clear();
+
+  flush(false);
+}
+
+void NativeWriter::flush(bool force) {
+  if (force || buffer.size() >= NATIVE_BUFFER_SIZE) {
+    out.write(buffer.data(), buffer.size());
+    buffer.clear();
+  }
+}
+
+std::string encode_entity_props(const Entity &entity) {
+  const std::vector<const SendProp*> &props = entity.table->props;
+
+  std::string values;
+  uint32_t count = 0;
+  for (uint32_t i = 0; i < props.size(); ++i) {
+    auto found = entity.properties.find(props[i]->qualified_name);
+
+    if (found != entity.properties.end() && found->second) {
+      append_var_int(values, i);
+      append_value(values, *found->second, props[i]);
+      ++count;
+    }
+  }
+
+  std::string out;
+  append_var_int(out, count);
+  out += values;
+
+  return out;
+}
+
+// A replay that only parsed partway would otherwise look complete, so its file is deleted.
+bool convert_to_native(const char *file, const char *out, const ParseOptions &options,
+    ParseError *error) {
+  ParseOptions converting = options;
+  converting.report_changes = true;
+
+  NativeWriter writer(out);
+
+  Parser parser(converting);
+  bool parsed = parser.parse(file, writer);
+  bool written = writer.close();
+
+  if (parsed && written) {
+    return true;
+  }
+
+  remove(out);
+
+  if (error) {
+    *error = parsed ? ParseError(std::string("Can't write ") + out + ".", __FILE__, __LINE__) :
+        parser.error();
+  }
+
+  return false;
+}
+
+// A position in a native file held in memory.
+struct NativeInput {
+  const char *data;
+  size_t length;
+  size_t offset;
+};
+
+void take_bytes(NativeInput &in, void *out, size_t size) {
+  XASSERT(size <= in.length - in.offset, "Native file is truncated.");
+
+  memcpy(out, in.data + in.offset, size);
+  in.offset += size;
+}
+
+template<typename T>
+T take_fixed(NativeInput &in) {
+  T value;
+  take_bytes(in, &value, sizeof(value));
+  return value;
+}
+
+uint32_t take_var_int(NativeInput &in) {
+  uint32_t result = 0;
+
+  for (int count = 0; count < 5; ++count) {
+    uint8_t b = take_fixed<uint8_t>(in);
+    result |= (uint32_t) (b & 0x7F) << (7 * count);
+
+    if (!(b & 0x80)) {
+      return result;
+    }
+  }
+
+  XERROR("Corrupt varint in native file.");
+}
+
+void take_value(NativeInput &in, const SendProp *prop, InternTable &strings,
+    std::shared_ptr<Property> &value);
+
+// Whether a value can be overwritten in place, which it can unless a visitor kept a reference to
+// it. A prop's value is always of the type the prop reads, so it's safe to cast.
+bool reusable(const std::shared_ptr<Property> &value) {
+  return value && value.use_count() == 1;
+}
+
+template<typename P, typename T>
+void set_typed(std::shared_ptr<Property> &value, T typed) {
+  if (reusable(value)) {
+    static_cast<P&>(*value).value = typed;
+  } else {
+    value.reset(new P(typed));
+  }
+}
+
+template<typename P, size_t C>
+void take_fixed_typed(NativeInput &in, std::shared_ptr<Property> &value) {
+  float values[C];
+  take_bytes(in, values, sizeof(values));
+
+  if (reusable(value)) {
+    std::copy(values, values + C, static_cast<P&>(*value).values);
+  } else {
+    value.reset(new P(values));
+  }
+}
+
+template<typename P, typename T, size_t C>
+void take_packed_array(NativeInput &in, const SendProp *prop, std::shared_ptr<Property> &value) {
+  uint32_t count = take_var_int(in);
+  XASSERT(count <= prop->num_elements, "Array too long %d > %d", count, prop->num_elements);
+
+  std::unique_ptr<P> created;
+  P *array = reusable(value) ? static_cast<P*>(value.get()) : 0;
+  if (!array) {
+    created.reset(new P(prop->num_elements));
+    array = created.get();
+  }
+
+  if (count) {
+    take_bytes(in, &array->values[0], count * C * sizeof(T));
+  }
+  array->count = count;
+
+  if (created) {
+    value = std::move(created);
+  }
+}
+
+void take_array(NativeInput &in, const SendProp *prop, InternTable &strings,
+    std::shared_ptr<Property> &value) {
+  XASSERT(prop->array_prop, "Array prop has no inner prop.");
+
+  SP_Types element_type = prop->array_prop->type;
+
+  if (element_type == SP_Int) {
+    take_packed_array<IntArrayProperty, uint32_t, 1>(in, prop, value);
+  } else if (element_type == SP_Float) {
+    take_packed_array<FloatArrayProperty, float, 1>(in, prop, value);
+  } else if (element_type == SP_Vector) {
+    take_packed_array<VectorArrayProperty, float, 3>(in, prop, value);
+  } else if (element_type == SP_VectorXY) {
+    take_packed_array<VectorXYArrayProperty, float, 2>(in, prop, value);
+  } else if (element_type == SP_Int64) {
+    take_packed_array<Int64ArrayProperty, uint64_t, 1>(in, prop, value);
+  } else {
+    uint32_t count = take_var_int(in);
+    XASSERT(count <= prop->num_elements, "Array too long %d > %d", count, prop->num_elements);
+
+    if (!reusable(value)) {
+      value.reset(new ArrayProperty(std::vector<ArrayPropertyElement>(), element_type));
+    }
+
+    std::vector<ArrayPropertyElement> &elements = static_cast<ArrayProperty&>(*value).elements;
+    elements.resize(count);
+
+    for (uint32_t i = 0; i < count; ++i) {
+      take_value(in, prop->array_prop, strings, elements[i]);
+    }
+  }
+}
+
+// Reads into value, reusing what's there when nothing else holds it.
+void take_value(NativeInput &in, const SendProp *prop, InternTable &strings,
+    std::shared_ptr<Property> &value) {
+  if (prop->type == SP_Int) {
+    set_typed<IntProperty>(value, take_fixed<uint32_t>(in));
+  } else if (prop->type == SP_Float) {
+    set_typed<FloatProperty>(value, take_fixed<float>(in));
+  } else if (prop->type == SP_Vector) {
+    take_fixed_typed<VectorProperty, 3>(in, value);
+  } else if (prop->type == SP_VectorXY) {
+    take_fixed_typed<VectorXYProperty, 2>(in, value);
+  } else if (prop->type == SP_String) {
+    uint32_t length = take_var_int(in);
+    XASSERT(length <= in.length - in.offset, "Native file is truncated.");
+
+    InternedString string = strings.intern(in.data + in.offset, length);
+    in.offset += length;
+
+    set_typed<StringProperty>(value, string);
+  } else if (prop->type == SP_Array) {
+    take_array(in, prop, strings, value);
+  } else if (prop->type == SP_Int64) {
+    set_typed<Int64Property>(value, take_fixed<uint64_t>(in));
+  } else {
+    XERROR("Unknown send prop type %d", prop->type);
+  }
+}
+
+// Slots are where each of the entity's props is held, by flat index, so props already set are
+// found without hashing their names. Empty slots are filled in as props show up. Returns how
+// many props were read.
+uint32_t take_props(NativeInput &in, Entity &entity, InternTable &strings, PropSlots &slots) {
+  const std::vector<const SendProp*> &props = entity.table->props;
+
+  uint32_t count = take_var_int(in);
+  for (uint32_t i = 0; i < count; ++i) {
+    uint32_t index = take_var_int(in);
+    XASSERT(index < props.size(), "Prop %u of %s does not exist.", index,
+        entity.clazz->name.c_str());
+
+    std::shared_ptr<Property> *&slot = slots[index];
+    if (!slot) {
+      slot = &entity.properties[props[index]->qualified_name];
+    }
+
+    take_value(in, props[index], strings, *slot);
+  }
+
+  return count;
+}
+
+void decode_entity_props(const std::string &data, Entity &entity, InternTable &strings) {
+  NativeInput in = {data.data(), data.size(), 0};
+
+  PropSlots slots(entity.table->props.size());
+  take_props(in, entity, strings, slots);
+
+  XASSERT(in.offset == in.length, "Entity %u has data after its props.", entity.id);
+}
+
+Entity &take_entity(NativeInput &in, std::vector<Entity> &entities) {
+  uint32_t id = take_var_int(in);
+  XASSERT(id < entities.size(), "Entity %u exceeds max entities.", id);
+
+  return entities[id];
+}
+
+void dump_native(const char *file, Visitor &visitor) {
+  std::ifstream stream(file, std::ifstream::in | std::ifstream::binary | std::ifstream::ate);
+  XASSERT(stream.is_open(), "Can't open %s.", file);
+
+  std::streamoff length = stream.tellg();
+  XASSERT(length >= 0, "Can't read %s.", file);
+
+  std::string data(length, '\0');
+  stream.seekg(0);
+  stream.read(&data[0], data.size());
+  XASSERT(!stream.fail(), "Can't read %s.", file);
+
+  NativeInput in = {data.data(), data.size(), 0};
+
+  size_t magic_length = strlen(NATIVE_MAGIC);
+  XASSERT(data.compare(0, magic_length, NATIVE_MAGIC) == 0, "%s is not a native file.", file);
+  in.offset = magic_length;
+
+  uint32_t version = take_fixed<uint32_t>(in);
+  XASSERT(version == NATIVE_FORMAT_VERSION, "%s has format version %u, not %u.", file,
+      version, NATIVE_FORMAT_VERSION);
+
+  std::shared_ptr<Schema> schema;
+  std::vector<Entity> entities(MAX_ENTITIES);
+  std::vector<PropSlots> slots(MAX_ENTITIES);
+  InternTable strings;
+
+  visitor.visit_replay_start(file);
+
+  bool done = false;
+  while (!done) {
+    char type = take_fixed<char>(in);
+
+    if (type == 'S') {
+      uint32_t length = take_fixed<uint32_t>(in);
+      XASSERT(length <= in.length - in.offset, "Native file is truncated.");
+
+      CEdithSchema saved;
+      XASSERT(saved.ParseFromArray(in.data + in.offset, length), "Corrupt schema in %s.", file);
+      in.offset += length;
+
+      // Entities point into the schema they were created with.
+      entities.assign(MAX_ENTITIES, Entity());
+      slots.assign(MAX_ENTITIES, PropSlots());
+
+      schema.reset(new Schema());
+      XASSERT(schema->load(saved), "Can't load the schema in %s.", file);
+
+      visitor.visit_schema(*schema);
+    } else if (type == 'T') {
+      visitor.visit_tick(take_fixed<uint32_t>(in));
+    } else if (type == 'C') {
+      XASSERT(schema, "Entity before the schema.");
+
+      Entity &entity = take_entity(in, entities);
+      uint32_t id = &entity - &entities[0];
+
+      const Class &clazz = schema->get_class(take_var_int(in));
+      XASSERT(clazz.flat_table, "Class %s has no send table.", clazz.name.c_str());
+
+      // An entity of the same class that had this id leaves its props to be overwritten. If it
+      // had some the new one doesn't, the new one is read again from scratch.
+      size_t props = in.offset;
+      bool reused = entity.table == clazz.flat_table;
+
+      if (reused) {
+        entity.id = id;
+        entity.clazz = &clazz;
+        reused = take_props(in, entity, strings, slots[id]) == entity.properties.size();
+      }
+
+      if (!reused) {
+        in.offset = props;
+
+        entity = Entity(id, clazz, *clazz.flat_table);
+        entity.properties.reserve(clazz.flat_table->props.size());
+        slots[id].assign(clazz.flat_table->props.size(), 0);
+        take_props(in, entity, strings, slots[id]);
+      }
+
+      visitor.visit_entity_created(entity);
+    } else if (type == 'U') {
+      Entity &entity = take_entity(in, entities);
+      XASSERT(entity.id != (uint32_t) -1, "Entity %d is not set up.",
+          (int) (&entity - &entities[0]));
+
+      take_props(in, entity, strings, slots[&entity - &entities[0]]);
+
+      visitor.visit_entity_updated(entity);
+    } else if (type == 'D') {
+      uint32_t id = take_var_int(in);
+
+      if (id < entities.size()) {
+        visitor.visit_entity_deleted(entities[id]);
+        entities[id].id = -1;
+      } else {
+        XASSERT(id == (uint32_t) -1, "Entity %u exceeds max entities.", id);
+        visitor.visit_entity_deleted(Entity());
+      }
+    } else if (type == 'E') {
+      done = true;
+    } else {
+      XERROR("Unknown record %d in %s.", type, file);
+    }
+  }
+
+  visitor.visit_replay_end(file);
+}
@@ -0,0 +1,91 @@
+#ifndef _NATIVE_H
+#define _NATIVE_H
+
+#include <stdint.h>
+
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "edith.h"
+#include "schema.h"
+#include "visitor.h"
+
+class InternTable;
+
+#define NATIVE_FORMAT_VERSION 1
+#define NATIVE_BUFFER_SIZE (1 << 20)
+
+// Writes what a parse decodes to a file that dump_native can feed back to visitors without
+// decompressing, parsing protobufs or reading bits. Parse with ParseOptions::report_changes set,
+// convert_to_native does that for you.
+//
+// The file starts with the 8 bytes "EDITHNAT" and a uint32 format version, followed by records.
+// Numbers are stored as they are in memory on x86, so little-endian, and varints are 7 bits a
+// byte with the high bit set on all but the last. Each record is a one byte type and then:
+//
+//   'S' schema: uint32 length, then a CEdithSchema.
+//   'T' tick: uint32 tick.
+//   'C' created: varint entity id, varint position of the class in the schema, then props.
+//   'U' updated: varint entity id, then props.
+//   'D' deleted: varint entity id (0xFFFFFFFF when an entity that wasn't set up was deleted).
+//   'E' end of file.
+//
+// Props are a varint count and then for each a varint index into the class' flat send table and
+// the value, whose layout depends on the send prop's type. Ints and floats are 4 bytes, Int64s 8,
+// vectors 3 or 2 floats, strings a varint length and the bytes, and arrays a varint count and
+// then each element laid out by the array prop's type. A created entity's props are every prop
+// it was created with, in the order its baseline and then the packet first set them.
+class NativeWriter : public Visitor {
+public:
+  NativeWriter(const std::string &path);
+  ~NativeWriter();
+
+  // Writes out everything buffered and returns false if any of the file couldn't be written.
+  // Nothing can be written afterwards.
+  bool close();
+
+  virtual void visit_schema(const Schema &schema);
+  virtual void visit_tick(uint32_t tick);
+
+  virtual void visit_entity_created(const Entity &entity);
+  virtual void visit_entity_updated(const Entity &entity);
+  virtual void visit_entity_deleted(const Entity &entity);
+  virtual void visit_entity_changes(const Entity &entity, const ChangedProps &changed);
+
+private:
+  NativeWriter(const NativeWriter&);
+  NativeWriter &operator=(const NativeWriter&);
+
+  void write_entity(char type, const Entity &entity, bool with_class);
+  void flush(bool force);
+
+  const Schema *schema;
+  bool closed;
+
+  // Flat indices of the props reported for the entity about to be created or updated, and
+  // which of them have been written so far.
+  std::vector<uint32_t> pending;
+  std::vector<bool> written;
+
+  std::string buffer;
+  std::ofstream out;
+};
+
+// Parses file and writes it to out in the native format. If the parse fails or stops early, or
+// out can't be written, out is deleted and false is returned with what went wrong in error.
+bool convert_to_native(const char *file, const char *out, const ParseOptions &options,
+    ParseError *error = 0);
+
+// Every prop an entity has, as a varint count and then index and value pairs the same way
+// records hold them. Snapshots store entities like this.
+std::string encode_entity_props(const Entity &entity);
+void decode_entity_props(const std::string &data, Entity &entity, InternTable &strings);
+
+// Reads a file written by NativeWriter and makes the same visitor calls as parsing the replay
+// did, except visit_entity_changes. The whole file is read into memory first. Prop values are
+// overwritten in place by later updates unless a visitor holds a shared_ptr to them.
+void dump_native(const char *file, Visitor &visitor);
+
+#endif
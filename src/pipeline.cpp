@@ -0,0 +1,100 @@
+#include "pipeline.h"
+
+#include <algorithm>
+
+#include "netmessages.pb.h"
+
+#include "debug.h"
+#include "demo.h"
+#include "stats.h"
+#include "trace.h"
+
+void read_frames(Demo &demo, FrameQueue &out, const std::atomic<bool> &stop) {
+  while (!stop && !demo.eof()) {
+    std::unique_ptr<PipelineFrame> frame(new PipelineFrame());
+
+    size_t size;
+    bool compressed;
+    size_t uncompressed_size;
+
+    frame->command = demo.get_message_type(&frame->tick, &compressed);
+    demo.read_message(compressed, &size, &uncompressed_size);
+    frame->data.assign(demo.expose_buffer(), uncompressed_size);
+
+    out.push(frame.release());
+  }
+
+  out.push(0);
+}
+
+google::protobuf::Message *new_packet_message(uint32_t command) {
+  if (command == svc_ServerInfo) {
+    return new CSVCMsg_ServerInfo();
+  } else if (command == svc_PacketEntities) {
+    return new CSVCMsg_PacketEntities();
+  } else if (command == svc_CreateStringTable) {
+    return new CSVCMsg_CreateStringTable();
+  } else if (command == svc_UpdateStringTable) {
+    return new CSVCMsg_UpdateStringTable();
+  } else {
+    return 0;
+  }
+}
+
+void parse_packet(PipelineFrame &frame) {
+  CDemoPacket packet;
+  packet.ParseFromString(frame.data);
+
+  const char *data = packet.data().c_str();
+  size_t offset = 0;
+  size_t length = packet.data().length();
+
+  while (offset < length) {
+    uint32_t command = read_var_int(data, length, &offset);
+    uint32_t size = read_var_int(data, length, &offset);
+    XASSERT(offset + size <= length, "Reading data outside of packet.");
+
+    STATS_ADD(messages[std::min<uint32_t>(command, STATS_MAX_MESSAGES)], 1);
+
+    MessagePtr message(new_packet_message(command));
+    if (message) {
+      message->ParseFromArray(&(data[offset]), size);
+      frame.packet_messages.push_back(std::make_pair(command, std::move(message)));
+    }
+
+    offset += size;
+  }
+}
+
+void parse_frame(PipelineFrame &frame) {
+  STATS_TIME(PS_Protobuf);
+  TraceSpan span("protobuf");
+
+  if (frame.command == DEM_ClassInfo) {
+    frame.message.reset(new CDemoClassInfo());
+    frame.message->ParseFromString(frame.data);
+  } else if (frame.command == DEM_SendTables) {
+    frame.message.reset(new CDemoSendTables());
+    frame.message->ParseFromString(frame.data);
+  } else if (frame.command == DEM_Packet || frame.command == DEM_SignonPacket) {
+    parse_packet(frame);
+  }
+}
+
+void parse_frames(FrameQueue &in, FrameQueue &out) {
+  while (PipelineFrame *popped = in.pop()) {
+    std::unique_ptr<PipelineFrame> frame(popped);
+    parse_frame(*frame);
+
+    frame->data.clear();
+    out.push(frame.release());
+  }
+
+  out.push(0);
+}
+
+void drain_frames(FrameQueue &in) {
+  while (PipelineFrame *frame = in.pop()) {
+    delete frame;
+  }
+}
@@ -0,0 +1,53 @@
+#ifndef _PIPELINE_H
+#define _PIPELINE_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <google/protobuf/message.h>
+
+#include "demo.pb.h"
+#include "spsc_queue.h"
+
+#define PIPELINE_DEPTH 64
+
+class Demo;
+
+typedef std::unique_ptr<google::protobuf::Message> MessagePtr;
+
+// One demo frame on its way to the decoder. The reader fills in the raw bytes, then the
+// protobuf stage parses them into message (for DEM_ClassInfo and DEM_SendTables) or
+// packet_messages (for packets, only the commands the decoder handles, in order).
+struct PipelineFrame {
+  int tick;
+  EDemoCommands command;
+  std::string data;
+
+  MessagePtr message;
+  std::vector<std::pair<uint32_t, MessagePtr>> packet_messages;
+};
+
+// Frames are owned by whichever stage popped them last. A null frame marks the end.
+typedef SpscQueue<PipelineFrame*> FrameQueue;
+
+// Reads and decompresses every frame in the demo, or stops early once stop is set.
+void read_frames(Demo &demo, FrameQueue &out, const std::atomic<bool> &stop);
+
+// Parses the protobufs in each frame.
+void parse_frames(FrameQueue &in, FrameQueue &out);
+
+// Deletes frames up to the end marker, which lets the stage before finish after a later one
+// has given up.
+void drain_frames(FrameQueue &in);
+
+// Returns a message to parse a packet command into, or 0 if the decoder ignores the command.
+google::protobuf::Message *new_packet_message(uint32_t command);
+
+uint32_t read_var_int(const char *data, size_t length, size_t *offset);
+
+#endif
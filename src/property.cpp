@@ -1,9 +1,18 @@
 #include "property.h"
 
 #include <cmath>
+#include <cstdlib>
+
+#include "float_batch.h"
+#include "stats.h"
 
 #define MAX_STRING_LENGTH 0x200
 
+// Cell coords are batched as integer + fraction in a float, which is only exact while
+// the integer part leaves room for the fraction bits.
+#define MAX_BATCHED_CELL_BITS 18
+#define MAX_BATCHED_QUANTIZED_BITS 30
+
 uint32_t read_int(Bitstream &stream, const SendProp *prop) {
   if (prop->flags & SP_EncodedAgainstTickcount) {
     if (prop->flags & SP_Unsigned) {
@@ -21,32 +30,39 @@ uint32_t read_int(Bitstream &stream, const SendProp *prop) {
   }
 }
 
-float read_float_coord(Bitstream &stream) {
-  uint32_t integer = stream.get_bits(1);
-  uint32_t fraction = stream.get_bits(1);
+void read_float_coord_code(Bitstream &stream, uint32_t *integer, uint32_t *fraction,
+    uint32_t *sign) {
+  *integer = stream.get_bits(1);
+  *fraction = stream.get_bits(1);
+  *sign = 0;
 
-  if (integer || fraction) {
-    uint32_t sign = stream.get_bits(1);
+  if (*integer || *fraction) {
+    *sign = stream.get_bits(1);
 
-    if (integer) {
-      integer = stream.get_bits(0x0E) + 1;
+    if (*integer) {
+      *integer = stream.get_bits(0x0E) + 1;
     }
 
-    if (fraction) {
-      fraction = stream.get_bits(5);
+    if (*fraction) {
+      *fraction = stream.get_bits(5);
     }
+  }
+}
 
-    double d = 0.03125 * fraction;
-    d += integer;
+float read_float_coord(Bitstream &stream) {
+  uint32_t integer;
+  uint32_t fraction;
+  uint32_t sign;
+  read_float_coord_code(stream, &integer, &fraction, &sign);
 
-    if (sign) {
-      d *= -1;
-    }
+  double d = 0.03125 * fraction;
+  d += integer;
 
-    return (float) d;
-  } else {
-    return 0;
+  if (sign) {
+    d *= -1;
   }
+
+  return (float) d;
 }
 
 enum FloatType {
@@ -99,9 +115,15 @@ float read_float_no_scale(Bitstream &stream) {
   return u.f;
 }
 
+void read_float_normal_code(Bitstream &stream, uint32_t *sign, uint32_t *value) {
+  *sign = stream.get_bits(1);
+  *value = stream.get_bits(11);
+}
+
 float read_float_normal(Bitstream &stream) {
-  uint32_t sign = stream.get_bits(1);
-  uint32_t value = stream.get_bits(11);
+  uint32_t sign;
+  uint32_t value;
+  read_float_normal_code(stream, &sign, &value);
 
   float f = value;
 
@@ -118,19 +140,26 @@ float read_float_normal(Bitstream &stream) {
   return f;
 }
 
+void read_float_cell_coord_code(Bitstream &stream, FloatType type, uint32_t bits,
+    uint32_t *value, uint32_t *fraction) {
+  *value = stream.get_bits(bits);
+  *fraction = 0;
+
+  if (type == FT_None) {
+    *fraction = stream.get_bits(5);
+  } else if (type == FT_LowPrecision) {
+    *fraction = stream.get_bits(3);
+  }
+}
+
 float read_float_cell_coord(Bitstream &stream, FloatType type, uint32_t bits) {
-  uint32_t value = stream.get_bits(bits);
+  uint32_t value;
+  uint32_t fraction;
+  read_float_cell_coord_code(stream, type, bits, &value, &fraction);
 
   if (type == FT_None || type == FT_LowPrecision) {
     bool lp = type == FT_LowPrecision;
 
-    uint32_t fraction;
-    if (!lp) {
-      fraction = stream.get_bits(5);
-    } else {
-      fraction = stream.get_bits(3);
-    }
-
     double d = value + (lp ? 0.125 : 0.03125) * fraction;
     return (float) d;
   } else if (type == FT_Integral) {
@@ -177,13 +206,74 @@ float read_float(Bitstream &stream, const SendProp *prop) {
   }
 }
 
-void read_vector(float vector[3], Bitstream &stream, const SendProp *prop) {
-  vector[0] = read_float(stream, prop);
-  vector[1] = read_float(stream, prop);
+// Reads a float into out, or only its raw code if there's a batch to convert it later.
+// The flag checks follow the same order as read_float.
+void decode_float_into(float *out, Bitstream &stream, const SendProp *prop, FloatBatch *floats) {
+  if (!floats) {
+    *out = read_float(stream, prop);
+  } else if (prop->flags & SP_Coord) {
+    uint32_t integer;
+    uint32_t fraction;
+    uint32_t sign;
+    read_float_coord_code(stream, &integer, &fraction, &sign);
+
+    floats->add_fixed(out, integer, fraction, 0.03125f, sign);
+  } else if (prop->flags & (SP_CoordMp | SP_CoordMpLowPrecision | SP_CoordMpIntegral |
+      SP_NoScale)) {
+    *out = read_float(stream, prop);
+  } else if (prop->flags & SP_Normal) {
+    uint32_t sign;
+    uint32_t value;
+    read_float_normal_code(stream, &sign, &value);
+
+    floats->add_normal(out, value, sign);
+  } else if (prop->flags & (SP_CellCoord | SP_CellCoordLowPrecision)) {
+    if (prop->num_bits > MAX_BATCHED_CELL_BITS) {
+      *out = read_float(stream, prop);
+      return;
+    }
+
+    bool lp = !(prop->flags & SP_CellCoord);
+
+    uint32_t value;
+    uint32_t fraction;
+    read_float_cell_coord_code(stream, lp ? FT_LowPrecision : FT_None, prop->num_bits, &value,
+        &fraction);
+
+    floats->add_fixed(out, value, fraction, lp ? 0.125f : 0.03125f, false);
+  } else if (prop->flags & SP_CellCoordIntegral) {
+    if (prop->num_bits > 31) {
+      *out = read_float(stream, prop);
+      return;
+    }
+
+    floats->add_fixed(out, stream.get_bits(prop->num_bits), 0, 0, false);
+  } else if (prop->num_bits <= MAX_BATCHED_QUANTIZED_BITS) {
+    floats->add_quantized(out, stream.get_bits(prop->num_bits), prop);
+  } else {
+    *out = read_float(stream, prop);
+  }
+}
+
+void read_float_into(float *out, Bitstream &stream, const SendProp *prop, FloatBatch *floats) {
+  STATS_MARK(start, stream.get_position());
+  decode_float_into(out, stream, prop, floats);
+  STATS_ADD(float_bits[float_encoding(prop)], stream.get_position() - start);
+}
+
+void read_vector(float vector[3], Bitstream &stream, const SendProp *prop,
+    FloatBatch *floats) {
+  read_float_into(&vector[0], stream, prop, floats);
+  read_float_into(&vector[1], stream, prop, floats);
 
   if (prop->flags & SP_Normal) {
     uint32_t sign = stream.get_bits(1);
 
+    if (floats) {
+      floats->add_normal_z(vector, sign);
+      return;
+    }
+
     float f = vector[0] * vector[0] + vector[1] * vector[1];
 
     if (1 >= f) {
@@ -196,13 +286,14 @@ void read_vector(float vector[3], Bitstream &stream, const SendProp *prop) {
       vector[2] = -1 * vector[2];
     }
   } else {
-    vector[2] = read_float(stream, prop);
+    read_float_into(&vector[2], stream, prop, floats);
   }
 }
 
-void read_vector_xy(float vector[2], Bitstream &stream, const SendProp *prop) {
-  vector[0] = read_float(stream, prop);
-  vector[1] = read_float(stream, prop);
+void read_vector_xy(float vector[2], Bitstream &stream, const SendProp *prop,
+    FloatBatch *floats) {
+  read_float_into(&vector[0], stream, prop, floats);
+  read_float_into(&vector[1], stream, prop, floats);
 }
 
 size_t read_string(char *buf, size_t max_length, Bitstream &stream, const SendProp *prop) {
@@ -226,17 +317,21 @@ uint32_t get_array_length_bits(const SendProp *prop) {
   return bits;
 }
 
-void read_array(std::vector<ArrayPropertyElement> &elements, Bitstream &stream,
-    const SendProp *prop) {
+uint32_t read_array_length(Bitstream &stream, const SendProp *prop) {
   XASSERT(prop->array_prop, "Array prop has no inner prop.");
 
   uint32_t count = stream.get_bits(get_array_length_bits(prop));
+  XASSERT(count <= prop->num_elements, "Array too long %d > %d", count, prop->num_elements);
+
+  return count;
+}
+
+void read_array(std::vector<ArrayPropertyElement> &elements, Bitstream &stream,
+    const SendProp *prop, InternTable &strings, FloatBatch *floats) {
+  uint32_t count = read_array_length(stream, prop);
 
-  // The element's names are usually the name of the container + "element"
-  // such as "player_array_element", which is useless.
-  std::string dummy_name;
   for (uint32_t i = 0; i < count; ++i) {
-    elements.push_back(Property::read_prop(stream, prop->array_prop, dummy_name));
+    elements.push_back(Property::read_prop(stream, prop->array_prop, strings, floats));
   }
 }
 
@@ -269,35 +364,91 @@ uint64_t read_int64(Bitstream &stream, const SendProp *prop) {
   }
 }
 
-std::shared_ptr<Property> Property::read_prop(Bitstream &stream, const SendProp *prop, std::string& name) {
-  Property *out;
+// Integers never go through the float batch, the parameter only matches read_packed_array's
+// element reader.
+void read_int_element(uint32_t *out, Bitstream &stream, const SendProp *prop, FloatBatch *) {
+  *out = read_int(stream, prop);
+}
+
+void read_int64_element(uint64_t *out, Bitstream &stream, const SendProp *prop, FloatBatch *) {
+  *out = read_int64(stream, prop);
+}
+
+template<typename P, typename T, size_t C>
+Property *read_packed_array(Bitstream &stream, const SendProp *prop, FloatBatch *floats,
+    void (*read_element)(T *, Bitstream &, const SendProp *, FloatBatch *)) {
+  uint32_t count = read_array_length(stream, prop);
+
+  std::unique_ptr<P> array(new P(prop->num_elements));
+  for (uint32_t i = 0; i < count; ++i) {
+    read_element(&array->values[i * C], stream, prop->array_prop, floats);
+  }
+  array->count = count;
+
+  return array.release();
+}
+
+Property *read_array_prop(Bitstream &stream, const SendProp *prop, InternTable &strings,
+    FloatBatch *floats) {
+  XASSERT(prop->array_prop, "Array prop has no inner prop.");
+
+  SP_Types element_type = prop->array_prop->type;
+
+  if (element_type == SP_Int) {
+    return read_packed_array<IntArrayProperty, uint32_t, 1>(stream, prop, floats,
+        read_int_element);
+  } else if (element_type == SP_Float) {
+    return read_packed_array<FloatArrayProperty, float, 1>(stream, prop, floats,
+        read_float_into);
+  } else if (element_type == SP_Vector) {
+    return read_packed_array<VectorArrayProperty, float, 3>(stream, prop, floats,
+        read_vector);
+  } else if (element_type == SP_VectorXY) {
+    return read_packed_array<VectorXYArrayProperty, float, 2>(stream, prop, floats,
+        read_vector_xy);
+  } else if (element_type == SP_Int64) {
+    return read_packed_array<Int64ArrayProperty, uint64_t, 1>(stream, prop, floats,
+        read_int64_element);
+  } else {
+    std::vector<ArrayPropertyElement> elements;
+    read_array(elements, stream, prop, strings, floats);
+
+    return new ArrayProperty(elements, element_type);
+  }
+}
 
-  name = prop->in_table->net_table_name + "." + prop->var_name;
+std::shared_ptr<Property> Property::read_prop(Bitstream &stream, const SendProp *prop,
+    InternTable &strings, FloatBatch *floats) {
+  // Values that are read in place are held by a unique_ptr until then, so a failed read doesn't
+  // leak them.
+  Property *out;
 
   if (prop->type == SP_Int) {
     out = new IntProperty(read_int(stream, prop));
   } else if (prop->type == SP_Float) {
-    out = new FloatProperty(read_float(stream, prop));
+    std::unique_ptr<FloatProperty> f(new FloatProperty(0));
+    read_float_into(&f->value, stream, prop, floats);
+
+    out = f.release();
   } else if (prop->type == SP_Vector) {
-    float value[3];
-    read_vector(value, stream, prop);
+    float value[3] = { 0, 0, 0 };
+    std::unique_ptr<VectorProperty> vector(new VectorProperty(value));
+    read_vector(vector->values, stream, prop, floats);
 
-    out = new VectorProperty(value);
+    out = vector.release();
   } else if (prop->type == SP_VectorXY) {
-    float value[2];
-    read_vector_xy(value, stream, prop);
+    float value[2] = { 0, 0 };
+    std::unique_ptr<VectorXYProperty> vector(new VectorXYProperty(value));
+    read_vector_xy(vector->values, stream, prop, floats);
 
-    out = new VectorXYProperty(value);
+    out = vector.release();
   } else if (prop->type == SP_String) {
     char str[MAX_STRING_LENGTH + 1];
     size_t length = read_string(str, MAX_STRING_LENGTH, stream, prop);
 
-    out = new StringProperty(std::string(str, length));
+    out = new StringProperty(strings.intern(str, length));
   } else if (prop->type == SP_Array) {
-    std::vector<ArrayPropertyElement> elements;
-    read_array(elements, stream, prop);
-
-    out = new ArrayProperty(elements, prop->array_prop->type);
+    out = read_array_prop(stream, prop, strings, floats);
   } else if (prop->type == SP_Int64) {
     out = new Int64Property(read_int64(stream, prop));
   } else {
@@ -307,6 +458,238 @@ std::shared_ptr<Property> Property::read_prop(Bitstream &stream, const SendProp
   return std::shared_ptr<Property>(out);
 }
 
+void write_int(BitWriter &stream, const SendProp *prop, uint32_t value) {
+  if (prop->flags & SP_EncodedAgainstTickcount) {
+    if (prop->flags & SP_Unsigned) {
+      stream.write_var_uint(value);
+    } else {
+      stream.write_var_uint((value << 1) ^ (uint32_t) ((int32_t) value >> 31));
+    }
+  } else {
+    stream.put_bits(value & (uint32_t) (((uint64_t) 1 << prop->num_bits) - 1), prop->num_bits);
+  }
+}
+
+// Splits a non-negative value into its integer part and a fraction in 1 / scale steps.
+void split_fraction(double value, uint32_t scale, uint32_t *integer, uint32_t *fraction) {
+  *integer = (uint32_t) value;
+  *fraction = (uint32_t) ((value - *integer) * scale + 0.5);
+
+  if (*fraction == scale) {
+    *integer += 1;
+    *fraction = 0;
+  }
+}
+
+void write_float_coord(BitWriter &stream, float value) {
+  uint32_t integer;
+  uint32_t fraction;
+  split_fraction(fabs(value), 32, &integer, &fraction);
+  XASSERT(integer <= 0x4000, "Coord %f is out of range.", value);
+
+  stream.put_bits(integer ? 1 : 0, 1);
+  stream.put_bits(fraction ? 1 : 0, 1);
+
+  if (integer || fraction) {
+    stream.put_bits(value < 0, 1);
+
+    if (integer) {
+      stream.put_bits(integer - 1, 0x0E);
+    }
+
+    if (fraction) {
+      stream.put_bits(fraction, 5);
+    }
+  }
+}
+
+// Only the integral flavour, since that's all read_float_coord_mp understands.
+void write_float_coord_mp_integral(BitWriter &stream, float value) {
+  int32_t integer = (int32_t) lround(value);
+
+  if (!integer) {
+    stream.put_bits(0, 2);
+  } else {
+    uint32_t code = ((uint32_t) abs(integer) - 1) << 1 | (integer < 0);
+    XASSERT(code < 0x1000, "Coord %f is out of range.", value);
+
+    stream.put_bits(3, 2);
+    stream.put_bits(code, 12);
+  }
+}
+
+void write_float_cell_coord(BitWriter &stream, FloatType type, uint32_t bits, float value) {
+  XASSERT(value >= 0, "Cell coord %f is negative.", value);
+
+  if (type == FT_Integral) {
+    stream.put_bits((uint32_t) lround(value), bits);
+  } else {
+    bool lp = type == FT_LowPrecision;
+
+    uint32_t integer;
+    uint32_t fraction;
+    split_fraction(value, lp ? 8 : 32, &integer, &fraction);
+
+    stream.put_bits(integer, bits);
+    stream.put_bits(fraction, lp ? 3 : 5);
+  }
+}
+
+// The flag checks follow the same order as read_float.
+void write_float(BitWriter &stream, const SendProp *prop, float value) {
+  if (prop->flags & SP_Coord) {
+    write_float_coord(stream, value);
+  } else if (prop->flags & (SP_CoordMp | SP_CoordMpLowPrecision)) {
+    XERROR("Only integral CoordMp floats can be decoded.");
+  } else if (prop->flags & SP_CoordMpIntegral) {
+    write_float_coord_mp_integral(stream, value);
+  } else if (prop->flags & SP_NoScale) {
+    union { float f; uint32_t v; } u;
+    u.f = value;
+    stream.put_bits(u.v, 32);
+  } else if (prop->flags & SP_Normal) {
+    stream.put_bits(value < 0, 1);
+    stream.put_bits(std::min(2047L, lround(fabs(value) * 2047)), 11);
+  } else if (prop->flags & SP_CellCoord) {
+    write_float_cell_coord(stream, FT_None, prop->num_bits, value);
+  } else if (prop->flags & SP_CellCoordLowPrecision) {
+    write_float_cell_coord(stream, FT_LowPrecision, prop->num_bits, value);
+  } else if (prop->flags & SP_CellCoordIntegral) {
+    write_float_cell_coord(stream, FT_Integral, prop->num_bits, value);
+  } else {
+    uint32_t divisor = (1 << prop->num_bits) - 1;
+
+    double f = (value - prop->low_value) / (prop->high_value - prop->low_value);
+    f = std::max(0.0, std::min(1.0, f));
+
+    stream.put_bits((uint32_t) (f * divisor + 0.5), prop->num_bits);
+  }
+}
+
+void write_vector(BitWriter &stream, const SendProp *prop, const float vector[3]) {
+  write_float(stream, prop, vector[0]);
+  write_float(stream, prop, vector[1]);
+
+  if (prop->flags & SP_Normal) {
+    stream.put_bits(vector[2] < 0, 1);
+  } else {
+    write_float(stream, prop, vector[2]);
+  }
+}
+
+void write_vector_xy(BitWriter &stream, const SendProp *prop, const float vector[2]) {
+  write_float(stream, prop, vector[0]);
+  write_float(stream, prop, vector[1]);
+}
+
+void write_string(BitWriter &stream, const std::string &value) {
+  XASSERT(value.size() < 0x200, "String too long %lu.", value.size());
+
+  stream.put_bits(value.size(), 9);
+  stream.write_bits(value.data(), 8 * value.size());
+}
+
+// read_int64 puts the second chunk at the bottom of the low word, so values only survive if
+// the low word's remaining bits are clear.
+void write_int64(BitWriter &stream, const SendProp *prop, uint64_t value) {
+  XASSERT(!(SP_EncodedAgainstTickcount & prop->flags), "this sounds scary");
+
+  size_t second_bits = prop->num_bits - 32;
+
+  if (!(SP_Unsigned & prop->flags)) {
+    --second_bits;
+
+    bool negative = (int64_t) value < 0;
+    stream.put_bits(negative, 1);
+
+    if (negative) {
+      value *= -1;
+    }
+  }
+
+  stream.put_bits((uint32_t) (value >> 32), 32);
+  stream.put_bits((uint32_t) (value & (((uint64_t) 1 << second_bits) - 1)), second_bits);
+}
+
+void write_array_length(BitWriter &stream, const SendProp *prop, size_t count) {
+  XASSERT(prop->array_prop, "Array prop has no inner prop.");
+  XASSERT(count <= prop->num_elements, "Array too long %lu > %d", count, prop->num_elements);
+
+  stream.put_bits(count, get_array_length_bits(prop));
+}
+
+void write_int_element(BitWriter &stream, const SendProp *prop, const uint32_t *value) {
+  write_int(stream, prop, *value);
+}
+
+void write_float_element(BitWriter &stream, const SendProp *prop, const float *value) {
+  write_float(stream, prop, *value);
+}
+
+void write_int64_element(BitWriter &stream, const SendProp *prop, const uint64_t *value) {
+  write_int64(stream, prop, *value);
+}
+
+template<typename P, typename T, size_t C>
+void write_packed_array(BitWriter &stream, const SendProp *prop, const Property &value,
+    void (*write_element)(BitWriter &, const SendProp *, const T *)) {
+  const P &array = static_cast<const P&>(value);
+  write_array_length(stream, prop, array.count);
+
+  for (size_t i = 0; i < array.count; ++i) {
+    write_element(stream, prop->array_prop, array.element(i));
+  }
+}
+
+void write_array_prop(BitWriter &stream, const SendProp *prop, const Property &value) {
+  XASSERT(prop->array_prop, "Array prop has no inner prop.");
+
+  SP_Types element_type = prop->array_prop->type;
+
+  if (element_type == SP_Int) {
+    write_packed_array<IntArrayProperty, uint32_t, 1>(stream, prop, value, write_int_element);
+  } else if (element_type == SP_Float) {
+    write_packed_array<FloatArrayProperty, float, 1>(stream, prop, value, write_float_element);
+  } else if (element_type == SP_Vector) {
+    write_packed_array<VectorArrayProperty, float, 3>(stream, prop, value, write_vector);
+  } else if (element_type == SP_VectorXY) {
+    write_packed_array<VectorXYArrayProperty, float, 2>(stream, prop, value, write_vector_xy);
+  } else if (element_type == SP_Int64) {
+    write_packed_array<Int64ArrayProperty, uint64_t, 1>(stream, prop, value,
+        write_int64_element);
+  } else {
+    const ArrayProperty &array = static_cast<const ArrayProperty&>(value);
+    write_array_length(stream, prop, array.elements.size());
+
+    for (auto iter = array.elements.begin(); iter != array.elements.end(); ++iter) {
+      Property::write_prop(stream, prop->array_prop, **iter);
+    }
+  }
+}
+
+void Property::write_prop(BitWriter &stream, const SendProp *prop, const Property &value) {
+  XASSERT(value.type == prop->type, "Property of type %d for send prop of type %d", value.type,
+      prop->type);
+
+  if (prop->type == SP_Int) {
+    write_int(stream, prop, static_cast<const IntProperty&>(value).value);
+  } else if (prop->type == SP_Float) {
+    write_float(stream, prop, static_cast<const FloatProperty&>(value).value);
+  } else if (prop->type == SP_Vector) {
+    write_vector(stream, prop, static_cast<const VectorProperty&>(value).values);
+  } else if (prop->type == SP_VectorXY) {
+    write_vector_xy(stream, prop, static_cast<const VectorXYProperty&>(value).values);
+  } else if (prop->type == SP_String) {
+    write_string(stream, static_cast<const StringProperty&>(value).value.str());
+  } else if (prop->type == SP_Array) {
+    write_array_prop(stream, prop, value);
+  } else if (prop->type == SP_Int64) {
+    write_int64(stream, prop, static_cast<const Int64Property&>(value).value);
+  } else {
+    XERROR("Unknown send prop type %d", prop->type);
+  }
+}
+
 Property::Property(SP_Types _type) : type(_type) {
 }
 
@@ -7,11 +7,17 @@
 #include <vector>
 
 #include "bitstream.h"
+#include "float_batch.h"
+#include "intern_table.h"
 #include "state.h"
 
 class Property {
 public:
-  static std::shared_ptr<Property> read_prop(Bitstream &stream, const SendProp *prop, std::string& prop_name);
+  static std::shared_ptr<Property> read_prop(Bitstream &stream, const SendProp *prop,
+      InternTable &strings, FloatBatch *floats);
+
+  // Encodes value so that read_prop gives it back, rounded to what prop's encoding can hold.
+  static void write_prop(BitWriter &stream, const SendProp *prop, const Property &value);
 
   Property(SP_Types type);
   virtual ~Property();
@@ -60,13 +66,45 @@ public:
   SP_Types value_type;
 };
 
+// Arrays of scalar or vector elements are stored as one contiguous buffer sized for
+// num_elements rather than as one Property per element. Element i occupies
+// values[i * C] through values[i * C + C - 1].
+template<SP_Types ElementType, typename T, size_t C>
+class PackedArrayProperty : public Property {
+public:
+  PackedArrayProperty(size_t capacity) :
+      Property(SP_Array),
+      value_type(ElementType),
+      count(0),
+      values(capacity * C) {
+  }
+
+  size_t size() const {
+    return count;
+  }
+
+  const T *element(size_t i) const {
+    return &values[i * C];
+  }
+
+  SP_Types value_type;
+  size_t count;
+  std::vector<T> values;
+};
+
 typedef TypedProperty<SP_Int, uint32_t> IntProperty;
 typedef TypedProperty<SP_Float, float> FloatProperty;
 typedef FixedTypedProperty<SP_Vector, float, 3> VectorProperty;
 typedef FixedTypedProperty<SP_VectorXY, float, 2> VectorXYProperty;
-typedef TypedProperty<SP_String, std::string> StringProperty;
+typedef TypedProperty<SP_String, InternedString> StringProperty;
 typedef TypedProperty<SP_Array, ArrayPropertyElement> ArrayProperty;
 typedef TypedProperty<SP_Int64, uint64_t> Int64Property;
 
+typedef PackedArrayProperty<SP_Int, uint32_t, 1> IntArrayProperty;
+typedef PackedArrayProperty<SP_Float, float, 1> FloatArrayProperty;
+typedef PackedArrayProperty<SP_Vector, float, 3> VectorArrayProperty;
+typedef PackedArrayProperty<SP_VectorXY, float, 2> VectorXYArrayProperty;
+typedef PackedArrayProperty<SP_Int64, uint64_t, 1> Int64ArrayProperty;
+
 #endif
 
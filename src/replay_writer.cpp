@@ -0,0 +1,245 @@
+#include "replay_writer.h"
+
+#include <snappy.h>
+
+#include "debug.h"
+#include "demo.h"
+#include "property.h"
+#include "schema.h"
+#include "state.h"
+
+#define PROTODEMO_HEADER_ID "PBUFDEM"
+
+void write_var_int(std::string &out, uint32_t value) {
+  do {
+    uint8_t lower = value & 0x7F;
+    value >>= 7;
+
+    out.push_back(lower | (value ? 0x80 : 0));
+  } while (value);
+}
+
+ReplayWriter::ReplayWriter(const std::string &path) : closed(false) {
+  out.open(path.c_str(), std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+  XASSERT(out.is_open(), "Can't open %s.", path.c_str());
+
+  // The stamp's terminating null makes it 8 bytes, and there's no file info to point at.
+  int32_t fileinfo_offset = 0;
+  out.write(PROTODEMO_HEADER_ID, sizeof(PROTODEMO_HEADER_ID));
+  out.write((const char *) &fileinfo_offset, sizeof(fileinfo_offset));
+}
+
+ReplayWriter::~ReplayWriter() {
+  XASSERT(closed, "ReplayWriter wasn't closed.");
+}
+
+void ReplayWriter::write_frame(EDemoCommands command, uint32_t tick,
+    const google::protobuf::Message &message, bool compress) {
+  XASSERT(!closed, "ReplayWriter is closed.");
+
+  std::string data = message.SerializeAsString();
+  XASSERT(data.size() <= DEMO_BUFFER_SIZE, "Message longer than buffer size.");
+
+  if (compress) {
+    std::string compressed;
+    snappy::Compress(data.data(), data.size(), &compressed);
+
+    data.swap(compressed);
+  }
+
+  std::string header;
+  write_var_int(header, command | (compress ? DEM_IsCompressed : 0));
+  write_var_int(header, tick);
+  write_var_int(header, data.size());
+
+  out.write(header.data(), header.size());
+  out.write(data.data(), data.size());
+}
+
+size_t ReplayWriter::tell() {
+  return out.tellp();
+}
+
+void ReplayWriter::close(uint32_t tick) {
+  CDemoStop stop;
+  write_frame(DEM_Stop, tick, stop, false);
+
+  out.close();
+  XASSERT(!out.fail(), "Failed to write replay.");
+
+  closed = true;
+}
+
+void append_packet_message(std::string &data, uint32_t type,
+    const google::protobuf::Message &message) {
+  std::string serialized = message.SerializeAsString();
+
+  write_var_int(data, type);
+  write_var_int(data, serialized.size());
+  data += serialized;
+}
+
+void encode_send_tables(const std::vector<CSVCMsg_SendTable> &tables, CDemoSendTables &out) {
+  std::string data;
+
+  for (auto iter = tables.begin(); iter != tables.end(); ++iter) {
+    append_packet_message(data, svc_SendTable, *iter);
+  }
+
+  out.set_data(data);
+}
+
+void build_schema(const std::vector<CSVCMsg_SendTable> &tables, const CDemoClassInfo &classes,
+    Schema &schema) {
+  for (auto iter = tables.begin(); iter != tables.end(); ++iter) {
+    schema.create_send_table(*iter);
+  }
+
+  for (int i = 0; i < classes.classes_size(); ++i) {
+    const CDemoClassInfo_class_t &clazz = classes.classes(i);
+    schema.create_class(clazz.class_id(), clazz.table_name(), clazz.network_name());
+  }
+
+  schema.link();
+  schema.compile_send_tables();
+}
+
+// Keys are always written whole, never as a substring of an earlier key.
+std::string encode_string_table(const std::vector<StringTableEntry> &entries,
+    uint32_t first_entry, size_t entry_bits) {
+  BitWriter stream;
+  stream.put_bits(0, 1);
+
+  uint32_t entry_id = first_entry;
+  for (auto iter = entries.begin(); iter != entries.end(); ++iter, ++entry_id) {
+    XASSERT(entry_id < (1u << entry_bits), "Entry id too large");
+
+    if (iter == entries.begin()) {
+      stream.put_bits(0, 1);
+      stream.put_bits(entry_id, entry_bits);
+    } else {
+      stream.put_bits(1, 1);
+    }
+
+    stream.put_bits(1, 1);
+    stream.put_bits(0, 1);
+    stream.write_string(iter->key.c_str());
+
+    if (iter->value.empty()) {
+      stream.put_bits(0, 1);
+    } else {
+      XASSERT(iter->value.size() < 0x4000, "Value too long.");
+
+      stream.put_bits(1, 1);
+      stream.put_bits(iter->value.size(), 14);
+      stream.write_bits(iter->value.data(), 8 * iter->value.size());
+    }
+  }
+
+  return stream.get_bytes();
+}
+
+void write_field_number(BitWriter &stream, uint32_t &last_field, uint32_t field) {
+  uint32_t skipped = field - last_field - 1;
+
+  if (!skipped) {
+    stream.put_bits(1, 1);
+  } else {
+    stream.put_bits(0, 1);
+    stream.write_var_uint(skipped);
+  }
+
+  last_field = field;
+}
+
+void write_entity_props(BitWriter &stream, const FlatSendTable &table,
+    const ChangedProps &props) {
+  uint32_t last_field = -1;
+  for (auto iter = props.begin(); iter != props.end(); ++iter) {
+    XASSERT(iter->first < table.props.size(), "Prop %u isn't in %s.", iter->first,
+        table.net_table_name.c_str());
+    XASSERT(iter == props.begin() || iter->first > last_field, "Props are out of order.");
+
+    write_field_number(stream, last_field, iter->first);
+  }
+
+  stream.put_bits(0, 1);
+  stream.write_var_uint(0x3FFF);
+
+  for (auto iter = props.begin(); iter != props.end(); ++iter) {
+    Property::write_prop(stream, table.props[iter->first], *iter->second);
+  }
+}
+
+PacketEntitiesWriter::PacketEntitiesWriter(uint32_t _class_bits) :
+    class_bits(_class_bits),
+    last_id(-1),
+    entries(0) {
+}
+
+// The two flag bits are leave PVS and then either delete or enter PVS, which is how
+// read_entity_header reads them.
+void PacketEntitiesWriter::write_header(uint32_t id, uint32_t flags) {
+  XASSERT(entries == 0 || id > last_id, "Entities are out of order.");
+
+  uint32_t skipped = id - last_id - 1;
+
+  if (skipped < 0x10) {
+    stream.put_bits(skipped, 6);
+  } else {
+    uint32_t upper = skipped >> 4;
+    uint32_t a = upper < 0x10 ? 1 : upper < 0x100 ? 2 : 3;
+
+    stream.put_bits(a << 4 | (skipped & 0xF), 6);
+    stream.put_bits(upper, 4 * a + (a == 3 ? 16 : 0));
+  }
+
+  stream.put_bits(flags, 2);
+
+  last_id = id;
+  ++entries;
+}
+
+void PacketEntitiesWriter::enter(uint32_t id, uint32_t class_i, uint32_t serial,
+    const FlatSendTable &table, const ChangedProps &props) {
+  write_header(id, 2);
+  stream.put_bits(class_i, class_bits);
+  stream.put_bits(serial, 10);
+
+  write_entity_props(stream, table, props);
+}
+
+void PacketEntitiesWriter::update(uint32_t id, const FlatSendTable &table,
+    const ChangedProps &props) {
+  write_header(id, 0);
+  write_entity_props(stream, table, props);
+}
+
+void PacketEntitiesWriter::leave(uint32_t id, bool del) {
+  write_header(id, del ? 3 : 1);
+}
+
+void PacketEntitiesWriter::remove(uint32_t id) {
+  XASSERT(id < 0x800, "Entity %u can't be removed after the entries.", id);
+
+  removed.push_back(id);
+}
+
+void PacketEntitiesWriter::finish(bool delta, uint32_t max_entries,
+    CSVCMsg_PacketEntities &out) {
+  XASSERT(delta || removed.empty(), "Only delta packets can remove entities.");
+
+  if (delta) {
+    for (auto iter = removed.begin(); iter != removed.end(); ++iter) {
+      stream.put_bits(1, 1);
+      stream.put_bits(*iter, 11);
+    }
+
+    stream.put_bits(0, 1);
+  }
+
+  out.set_max_entries(max_entries);
+  out.set_updated_entries(entries);
+  out.set_is_delta(delta);
+  out.set_entity_data(stream.get_bytes());
+}
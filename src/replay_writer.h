@@ -0,0 +1,94 @@
+#ifndef _REPLAY_WRITER_H
+#define _REPLAY_WRITER_H
+
+#include <stdint.h>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "bitstream.h"
+#include "demo.pb.h"
+#include "entity.h"
+#include "netmessages.pb.h"
+
+class FlatSendTable;
+class Schema;
+class StringTableEntry;
+
+// Writes a .dem file that Demo can read: the header, then frames of a command, a tick and a
+// protobuf message, optionally snappy compressed. Together with the encoders below and
+// Property::write_prop this is enough to make replays from scratch, see
+// examples/generate_replay.cpp.
+class ReplayWriter {
+public:
+  ReplayWriter(const std::string &path);
+  ~ReplayWriter();
+
+  void write_frame(EDemoCommands command, uint32_t tick,
+      const google::protobuf::Message &message, bool compress);
+
+  // Where the next frame will start, which is what Demo::tell gives when it's about to read it.
+  size_t tell();
+
+  // Writes DEM_Stop and closes the file. Nothing can be written afterwards.
+  void close(uint32_t tick);
+
+private:
+  ReplayWriter(const ReplayWriter&);
+  ReplayWriter &operator=(const ReplayWriter&);
+
+  std::ofstream out;
+  bool closed;
+};
+
+// Appends a message to the data of a CDemoPacket or CDemoSendTables, as its type, its length
+// and then the message itself.
+void append_packet_message(std::string &data, uint32_t type,
+    const google::protobuf::Message &message);
+
+void encode_send_tables(const std::vector<CSVCMsg_SendTable> &tables, CDemoSendTables &out);
+
+// Compiles the tables and classes the same way the parser does, so encoders can look up the
+// flattened prop order.
+void build_schema(const std::vector<CSVCMsg_SendTable> &tables, const CDemoClassInfo &classes,
+    Schema &schema);
+
+// The string_data of a CSVCMsg_CreateStringTable or CSVCMsg_UpdateStringTable holding entries
+// at consecutive indices from first_entry. Every entry is written with its key and, unless it's
+// empty, its value. Tables with fixed size user data aren't supported.
+std::string encode_string_table(const std::vector<StringTableEntry> &entries,
+    uint32_t first_entry, size_t entry_bits);
+
+// Writes a field list and then the values of props, which have to be in increasing flat index
+// order. This is what instance baselines hold and what follows each entity's header in
+// CSVCMsg_PacketEntities.
+void write_entity_props(BitWriter &stream, const FlatSendTable &table, const ChangedProps &props);
+
+// Builds the entity_data of a CSVCMsg_PacketEntities. Entities have to be added in increasing
+// id order.
+class PacketEntitiesWriter {
+public:
+  PacketEntitiesWriter(uint32_t _class_bits);
+
+  void enter(uint32_t id, uint32_t class_i, uint32_t serial, const FlatSendTable &table,
+      const ChangedProps &props);
+  void update(uint32_t id, const FlatSendTable &table, const ChangedProps &props);
+  void leave(uint32_t id, bool del);
+
+  // Deletes that follow the entries in a delta packet, in any order.
+  void remove(uint32_t id);
+
+  void finish(bool delta, uint32_t max_entries, CSVCMsg_PacketEntities &out);
+
+private:
+  void write_header(uint32_t id, uint32_t flags);
+
+  uint32_t class_bits;
+  BitWriter stream;
+  uint32_t last_id;
+  uint32_t entries;
+  std::vector<uint32_t> removed;
+};
+
+#endif
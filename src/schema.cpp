@@ -0,0 +1,530 @@
+#include "schema.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <exception>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "demo.pb.h"
+#include "edith.pb.h"
+#include "netmessages.pb.h"
+
+#include "debug.h"
+
+#define SCHEMA_CACHE_VERSION 1
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+uint64_t fnv1a(uint64_t hash, const void *data, size_t length) {
+  const unsigned char *bytes = reinterpret_cast<const unsigned char *>(data);
+
+  for (size_t i = 0; i < length; ++i) {
+    hash ^= bytes[i];
+    hash *= FNV_PRIME;
+  }
+
+  return hash;
+}
+
+Class::Class(uint32_t _id, const std::string &_dt_name, const std::string &_name) :
+  id(_id), dt_name(_dt_name), name(_name), flat_table(0) {
+}
+
+SendProp::SendProp() {
+}
+
+SendProp::SendProp(SP_Types _type, const std::string &_var_name, uint32_t _flags,
+    uint32_t _priority, const std::string &_dt_name, uint32_t _num_elements,
+    float _low_value, float _high_value, uint32_t _num_bits) :
+  type(_type),
+  var_name(_var_name),
+  flags(_flags),
+  priority(_priority),
+  dt_name(_dt_name),
+  num_elements(_num_elements),
+  low_value(_low_value),
+  high_value(_high_value),
+  num_bits(_num_bits),
+  array_prop(0),
+  dt_table(0) {
+}
+
+SendTable::SendTable() {
+}
+
+SendTable::SendTable(const std::string _net_table_name, bool _needs_decoder) :
+  net_table_name(_net_table_name), needs_decoder(_needs_decoder) {
+}
+
+FlatSendTable::FlatSendTable() {
+}
+
+FlatSendTable::FlatSendTable(const std::string _net_table_name) : net_table_name(_net_table_name) {
+}
+
+Schema::Schema() {
+}
+
+uint64_t Schema::fingerprint(const std::string &send_tables, const CDemoClassInfo &info) {
+  uint64_t hash = FNV_OFFSET_BASIS;
+  hash = fnv1a(hash, send_tables.data(), send_tables.size());
+
+  for (int i = 0; i < info.classes_size(); ++i) {
+    const CDemoClassInfo_class_t &clazz = info.classes(i);
+
+    int32_t id = clazz.class_id();
+    hash = fnv1a(hash, &id, sizeof(id));
+    hash = fnv1a(hash, clazz.table_name().c_str(), clazz.table_name().size() + 1);
+    hash = fnv1a(hash, clazz.network_name().c_str(), clazz.network_name().size() + 1);
+  }
+
+  return hash;
+}
+
+const Class &Schema::create_class(uint32_t id, std::string dt_name, std::string name) {
+  classes.push_back(Class(id, dt_name, name));
+
+  return classes[classes.size() - 1];
+}
+
+SendTable &Schema::create_send_table(const std::string net_table_name, bool needs_decoder) {
+  return send_tables.add(SendTable(net_table_name, needs_decoder));
+}
+
+SendTable &Schema::create_send_table(const CSVCMsg_SendTable &table) {
+  SendTable &converted = create_send_table(table.net_table_name(), table.needs_decoder());
+
+  size_t prop_count = table.props_size();
+  for (size_t i = 0; i < prop_count; ++i) {
+    const CSVCMsg_SendTable_sendprop_t &prop = table.props(i);
+
+    SendProp c(
+        static_cast<SP_Types>(prop.type()),
+        prop.var_name(),
+        prop.flags(),
+        prop.priority(),
+        prop.dt_name(),
+        prop.num_elements(),
+        prop.low_value(),
+        prop.high_value(),
+        prop.num_bits());
+
+    converted.props.add(c);
+  }
+
+  return converted;
+}
+
+void Schema::link() {
+  for (auto iter = send_tables.begin(); iter != send_tables.end(); ++iter) {
+    SendTable &table = *iter;
+
+    for (size_t i = 0; i < table.props.size(); ++i) {
+      SendProp &prop = table.props[i];
+
+      prop.in_table = &table;
+      prop.qualified_name = table.net_table_name + "." + prop.var_name;
+      prop.var_name_id = names.intern(prop.var_name);
+
+      if ((prop.type == SP_DataTable || (SP_Exclude & prop.flags)) &&
+          send_tables.has(prop.dt_name)) {
+        prop.dt_table = &send_tables[prop.dt_name];
+      }
+
+      if (prop.type == SP_Array) {
+        XASSERT(i > 0, "Array prop %s is at index zero.", prop.var_name.c_str());
+        prop.array_prop = &(table.props[i - 1]);
+      }
+    }
+  }
+}
+
+const Class &Schema::get_class(size_t i) const {
+  XASSERT(i < classes.size(), "Class %ld does not exist (%ld).", i, classes.size());
+
+  return classes[i];
+}
+
+void Schema::save(CEdithSchema &out) const {
+  out.set_version(SCHEMA_CACHE_VERSION);
+
+  // Props live in a deque, so their positions have to be recorded rather than computed.
+  std::map<const SendTable *, size_t> table_indices;
+  std::map<const SendProp *, size_t> prop_indices;
+  for (size_t i = 0; i < send_tables.size(); ++i) {
+    const SendTable &table = send_tables[i];
+    table_indices[&table] = i;
+
+    CSVCMsg_SendTable *converted = out.add_send_tables();
+    converted->set_net_table_name(table.net_table_name);
+    converted->set_needs_decoder(table.needs_decoder);
+
+    for (auto iter = table.props.begin(); iter != table.props.end(); ++iter) {
+      const SendProp &prop = *iter;
+      prop_indices[&prop] = converted->props_size();
+
+      CSVCMsg_SendTable_sendprop_t *c = converted->add_props();
+      c->set_type(prop.type);
+      c->set_var_name(prop.var_name);
+      c->set_flags(prop.flags);
+      c->set_priority(prop.priority);
+      c->set_dt_name(prop.dt_name);
+      c->set_num_elements(prop.num_elements);
+      c->set_low_value(prop.low_value);
+      c->set_high_value(prop.high_value);
+      c->set_num_bits(prop.num_bits);
+    }
+  }
+
+  for (auto iter = classes.begin(); iter != classes.end(); ++iter) {
+    CDemoClassInfo_class_t *clazz = out.mutable_class_info()->add_classes();
+    clazz->set_class_id(iter->id);
+    clazz->set_table_name(iter->dt_name);
+    clazz->set_network_name(iter->name);
+  }
+
+  for (auto iter = flat_send_tables.begin(); iter != flat_send_tables.end(); ++iter) {
+    const FlatSendTable &flat = *iter;
+
+    CEdithSchema_flat_table_t *converted = out.add_flat_send_tables();
+    converted->set_net_table_name(flat.net_table_name);
+
+    for (auto prop = flat.props.begin(); prop != flat.props.end(); ++prop) {
+      const SendTable *table = (*prop)->in_table;
+
+      converted->add_prop_tables(table_indices[table]);
+      converted->add_prop_indices(prop_indices[*prop]);
+    }
+  }
+}
+
+bool Schema::load(const CEdithSchema &in) {
+  if (in.version() != SCHEMA_CACHE_VERSION) {
+    return false;
+  }
+
+  for (int i = 0; i < in.send_tables_size(); ++i) {
+    create_send_table(in.send_tables(i));
+  }
+
+  for (int i = 0; i < in.class_info().classes_size(); ++i) {
+    const CDemoClassInfo_class_t &clazz = in.class_info().classes(i);
+    create_class(clazz.class_id(), clazz.table_name(), clazz.network_name());
+  }
+
+  link();
+
+  for (int i = 0; i < in.flat_send_tables_size(); ++i) {
+    const CEdithSchema_flat_table_t &flat = in.flat_send_tables(i);
+
+    if (flat.prop_tables_size() != flat.prop_indices_size()) {
+      return false;
+    }
+
+    FlatSendTable converted(flat.net_table_name());
+    for (int j = 0; j < flat.prop_tables_size(); ++j) {
+      uint32_t table = flat.prop_tables(j);
+      uint32_t index = flat.prop_indices(j);
+
+      if (table >= send_tables.size() || index >= send_tables[table].props.size()) {
+        return false;
+      }
+
+      converted.props.push_back(&send_tables[table].props[index]);
+    }
+
+    // Nothing reads the hierarchy of a loaded table, it's only there while compiling.
+    converted.dt_prop.send_table = 0;
+    converted.dt_prop.prop_start = 0;
+    converted.dt_prop.prop_count = converted.props.size();
+
+    flat_send_tables.add(converted);
+  }
+
+  resolve_classes();
+
+  return true;
+}
+
+void Schema::gather_excludes(const SendTable &table, std::set<ExcludeKey> &excluding) const {
+  for (auto iter = table.props.begin(); iter != table.props.end(); ++iter) {
+    const SendProp &prop = *iter;
+
+    if (SP_Exclude & prop.flags) {
+      // An exclude naming a table that doesn't exist can't match anything.
+      if (prop.dt_table) {
+        excluding.insert(ExcludeKey(prop.dt_table, prop.var_name_id));
+      }
+    } else if (SP_DataTable == prop.type) {
+      XASSERT(prop.dt_table, "Send table %s does not exist.", prop.dt_name.c_str());
+      gather_excludes(*prop.dt_table, excluding);
+    }
+  }
+}
+
+void Schema::gather(const SendTable &from, DTProp &dt_prop, CompileState &state) const {
+  for (auto iter = from.props.begin();
+      iter != from.props.end();
+      ++iter) {
+    const SendProp &prop = *iter;
+
+    if ((SP_Exclude | SP_InsideArray) & prop.flags) {
+      continue;
+    } else if (state.excluding.count(ExcludeKey(&from, prop.var_name_id))) {
+      continue;
+    }
+
+    if (SP_DataTable == prop.type) {
+      XASSERT(prop.dt_table, "Send table %s does not exist.", prop.dt_name.c_str());
+      const SendTable &dt_table = *prop.dt_table;
+
+      if (SP_Collapsible & prop.flags) {
+        gather(dt_table, dt_prop, state);
+      } else {
+        DTProp new_dt_prop;
+        dt_prop.dt_props.push_back(new_dt_prop);
+
+        build_hierarchy(dt_table, new_dt_prop, state);
+      }
+    } else {
+      dt_prop.non_dt_props.push_back(&prop);
+    }
+  }
+}
+
+void Schema::build_hierarchy(const SendTable &send_table, DTProp &dt_prop,
+    CompileState &state) const {
+  dt_prop.send_table = &send_table;
+
+  dt_prop.prop_start = state.props.size();
+  gather(send_table, dt_prop, state);
+
+  for (auto iter = dt_prop.non_dt_props.begin(); iter != dt_prop.non_dt_props.end(); ++iter) {
+    state.props.push_back(*iter);
+  }
+
+  dt_prop.prop_count = state.props.size() - dt_prop.prop_start;
+}
+
+FlatSendTable Schema::compile_send_table(const SendTable &table) const {
+  CompileState state;
+  gather_excludes(table, state.excluding);
+
+  DTProp dt_prop;
+  build_hierarchy(table, dt_prop, state);
+
+  std::vector<uint32_t> priorities;
+  priorities.reserve(state.props.size() + 1);
+  priorities.push_back(64);
+  for (auto iter = state.props.begin(); iter != state.props.end(); ++iter) {
+    priorities.push_back((*iter)->priority);
+  }
+
+  std::sort(priorities.begin(), priorities.end());
+  priorities.erase(std::unique(priorities.begin(), priorities.end()), priorities.end());
+
+  // The client orders props with this exact partitioning (not a stable sort), so the
+  // field indices in packet entities only line up if we do the same thing.
+  size_t prop_offset = 0;
+  for (size_t priority_index = 0;
+      priority_index < priorities.size() && prop_offset < state.props.size();
+      ++priority_index) {
+    size_t priority = priorities[priority_index];
+
+    size_t hole = prop_offset;
+    size_t cursor = hole;
+    while (cursor < state.props.size()) {
+      const SendProp *prop = state.props[cursor];
+
+      if (prop->priority == priority ||
+          (priority == 64 && (SP_ChangesOften & prop->flags))) {
+        const SendProp *temp = state.props[hole];
+        state.props[hole] = state.props[cursor];
+        state.props[cursor] = temp;
+
+        ++hole;
+        ++prop_offset;
+      }
+
+      ++cursor;
+    }
+  }
+
+  FlatSendTable flat_table(table.net_table_name);
+  flat_table.props = state.props;
+  flat_table.dt_prop = dt_prop;
+
+  return flat_table;
+}
+
+void Schema::compile_send_tables() {
+  // Only the tables classes use are ever instantiated, most of the rest are baseclasses
+  // which get flattened into them anyway.
+  std::vector<const SendTable *> tables;
+  std::set<std::string> seen;
+  for (auto iter = classes.begin(); iter != classes.end(); ++iter) {
+    if (!flat_send_tables.has(iter->dt_name) && seen.insert(iter->dt_name).second) {
+      XASSERT(send_tables.has(iter->dt_name), "Class %s has no send table %s.",
+          iter->name.c_str(), iter->dt_name.c_str());
+      tables.push_back(&send_tables[iter->dt_name]);
+    }
+  }
+
+  std::vector<FlatSendTable> compiled(tables.size());
+  std::atomic<size_t> next(0);
+
+  // A failure on a worker is passed on from this thread once they're all done.
+  bool recover = RecoverErrors::current;
+  std::mutex error_lock;
+  std::exception_ptr error;
+
+  auto compile = [&]() {
+    RecoverErrors recover_errors(recover);
+
+    try {
+      for (size_t i = next++; i < tables.size(); i = next++) {
+        compiled[i] = compile_send_table(*tables[i]);
+      }
+    } catch (const ParseError &) {
+      std::lock_guard<std::mutex> guard(error_lock);
+      error = std::current_exception();
+      next = tables.size();
+    }
+  };
+
+  size_t thread_count = std::min<size_t>(std::thread::hardware_concurrency(), tables.size());
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < thread_count; ++i) {
+    workers.push_back(std::thread(compile));
+  }
+
+  compile();
+
+  for (auto iter = workers.begin(); iter != workers.end(); ++iter) {
+    iter->join();
+  }
+
+  if (error) {
+    std::rethrow_exception(error);
+  }
+
+  for (auto iter = compiled.begin(); iter != compiled.end(); ++iter) {
+    flat_send_tables.add(*iter);
+  }
+
+  resolve_classes();
+}
+
+void Schema::resolve_classes() {
+  for (auto iter = classes.begin(); iter != classes.end(); ++iter) {
+    iter->flat_table = flat_send_tables.find(iter->dt_name);
+  }
+}
+
+SchemaCache &SchemaCache::shared() {
+  static SchemaCache cache(16);
+
+  return cache;
+}
+
+SchemaCache::SchemaCache(size_t _capacity) : capacity(_capacity) {
+}
+
+std::shared_ptr<const Schema> SchemaCache::find(uint64_t key, const std::string &directory) {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+
+    for (auto iter = schemas.begin(); iter != schemas.end(); ++iter) {
+      if (iter->first == key) {
+        schemas.splice(schemas.begin(), schemas, iter);
+        return schemas.front().second;
+      }
+    }
+  }
+
+  if (directory.empty()) {
+    return std::shared_ptr<const Schema>();
+  }
+
+  std::ifstream file(path_for(key, directory).c_str(), std::ifstream::in | std::ifstream::binary);
+  if (!file.is_open()) {
+    return std::shared_ptr<const Schema>();
+  }
+
+  // A cache file that's unreadable or from another version is just a miss.
+  CEdithSchema cached;
+  if (!cached.ParseFromIstream(&file) || cached.key() != key) {
+    return std::shared_ptr<const Schema>();
+  }
+
+  std::shared_ptr<Schema> schema(new Schema());
+  if (!schema->load(cached)) {
+    return std::shared_ptr<const Schema>();
+  }
+
+  insert(key, schema, "");
+
+  return schema;
+}
+
+void SchemaCache::insert(uint64_t key, std::shared_ptr<const Schema> schema,
+    const std::string &directory) {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+
+    schemas.push_front(std::make_pair(key, schema));
+    if (schemas.size() > capacity) {
+      schemas.pop_back();
+    }
+  }
+
+  if (directory.empty()) {
+    return;
+  }
+
+  CEdithSchema cached;
+  cached.set_key(key);
+  schema->save(cached);
+
+  // Write to a uniquely named file and rename it so concurrent writers, in this process or
+  // others, never see or clobber half a file.
+  std::string path = path_for(key, directory);
+  std::vector<char> temp_path(path.begin(), path.end());
+  const char suffix[] = ".XXXXXX";
+  temp_path.insert(temp_path.end(), suffix, suffix + sizeof(suffix));
+
+  int fd = mkstemp(temp_path.data());
+  if (fd == -1) {
+    return;
+  }
+
+  fchmod(fd, 0644);
+  bool written = cached.SerializeToFileDescriptor(fd);
+  written &= close(fd) == 0;
+
+  if (!written || rename(temp_path.data(), path.c_str())) {
+    remove(temp_path.data());
+  }
+}
+
+// Parses holding a schema keep it, only the cache's reference goes.
+void SchemaCache::clear() {
+  std::lock_guard<std::mutex> guard(lock);
+
+  schemas.clear();
+}
+
+std::string SchemaCache::path_for(uint64_t key, const std::string &directory) const {
+  char name[32];
+  sprintf(name, "%016llx.schema", (unsigned long long) key);
+
+  return directory + "/" + name;
+}
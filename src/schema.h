@@ -0,0 +1,230 @@
+#ifndef _SCHEMA_H
+#define _SCHEMA_H
+
+#include <stdint.h>
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "dictionary_list.h"
+#include "intern_table.h"
+
+class CDemoClassInfo;
+class CEdithSchema;
+class CSVCMsg_SendTable;
+class FlatSendTable;
+
+class Class {
+public:
+  Class(uint32_t id, const std::string &dt_name, const std::string &name);
+
+  uint32_t id;
+  std::string dt_name;
+  std::string name;
+
+  // Set once the send tables are compiled.
+  const FlatSendTable *flat_table;
+};
+
+enum SP_Flags {
+  SP_Unsigned = 1 << 0,
+  SP_Coord = 1 << 1,
+  SP_NoScale = 1 << 2,
+  SP_RoundDown = 1 << 3,
+  SP_RoundUp = 1 << 4,
+  SP_Normal = 1 << 5,
+  SP_Exclude = 1 << 6,
+  SP_Xyze = 1 << 7,
+  SP_InsideArray = 1 << 8,
+
+  SP_Collapsible = 1 << 11,
+  SP_CoordMp = 1 << 12,
+  SP_CoordMpLowPrecision = 1 << 13,
+  SP_CoordMpIntegral = 1 << 14,
+  SP_CellCoord = 1 << 15,
+  SP_CellCoordLowPrecision = 1 << 16,
+  SP_CellCoordIntegral = 1 << 17,
+  SP_ChangesOften = 1 << 18,
+  SP_EncodedAgainstTickcount = 1 << 19,
+};
+
+enum SP_Types {
+  SP_Int = 0,
+  SP_Float = 1,
+  SP_Vector = 2,
+  SP_VectorXY = 3,
+  SP_String = 4,
+  SP_Array = 5,
+  SP_DataTable = 6,
+  SP_Int64 = 7,
+};
+
+class SendTable;
+
+class SendProp {
+public:
+  SendProp();
+  SendProp(SP_Types type, const std::string &var_name, uint32_t flags, uint32_t priority,
+      const std::string &dt_name, uint32_t num_elements, float low_value, float high_value,
+      uint32_t num_bits);
+
+  SP_Types type;
+  std::string var_name;
+  uint32_t flags;
+  uint32_t priority;
+
+  std::string dt_name;
+  uint32_t num_elements;
+
+  float low_value;
+  float high_value;
+  uint32_t num_bits;
+
+  SendTable *in_table;
+  SendProp *array_prop;
+
+  // Resolved when the tables are linked. qualified_name is "table.var_name", the key
+  // used in Entity::properties. var_name_id is interned so excludes can be matched
+  // without building strings, and dt_table is the table named by dt_name (for data table
+  // and exclude props) or null if there's no such table.
+  std::string qualified_name;
+  InternedString var_name_id;
+  const SendTable *dt_table;
+};
+
+class SendTable {
+public:
+  SendTable();
+  SendTable(const std::string net_table_name, bool needs_decoder);
+
+  std::string net_table_name;
+  bool needs_decoder;
+
+private:
+  struct GetSendPropName {
+    const std::string &operator()(const SendProp &prop) {
+      return prop.var_name;
+    }
+  };
+
+public:
+  DictionaryList<SendProp, std::string, GetSendPropName> props;
+};
+
+struct DTProp {
+  const SendTable *send_table;
+  std::vector<DTProp> dt_props;
+  std::vector<const SendProp *> non_dt_props;
+
+  size_t prop_start;
+  size_t prop_count;
+};
+
+class FlatSendTable {
+public:
+  FlatSendTable();
+  FlatSendTable(const std::string net_table_name);
+
+  std::string net_table_name;
+  std::vector<const SendProp *> props;
+  DTProp dt_prop;
+};
+
+
+// Everything about a replay's classes that comes from its send tables and class info:
+// the send tables themselves, the classes and the flattened tables. Nothing in here
+// changes once it's compiled, so parses of replays from the same build can share one.
+class Schema {
+public:
+  Schema();
+
+  // A hash of the raw DEM_SendTables payload and the class list, used as the cache key.
+  static uint64_t fingerprint(const std::string &send_tables, const CDemoClassInfo &info);
+
+  const Class &create_class(uint32_t id, std::string dt_name, std::string name);
+  SendTable &create_send_table(const std::string net_table_name, bool needs_decoder);
+  SendTable &create_send_table(const CSVCMsg_SendTable &table);
+
+  // Resolves the pointers between props and tables. Call once every table is created.
+  void link();
+
+  // Flattens the send table of every class, spread across a few threads.
+  void compile_send_tables();
+
+  const Class &get_class(size_t i) const;
+
+  // Converts to and from the on-disk cache format. The flattened tables are stored as
+  // prop positions so loading doesn't flatten anything.
+  void save(CEdithSchema &out) const;
+  bool load(const CEdithSchema &in);
+
+private:
+  Schema(const Schema &that);
+  Schema &operator=(const Schema &that);
+
+  typedef std::pair<const SendTable *, InternedString> ExcludeKey;
+
+  struct CompileState {
+    std::set<ExcludeKey> excluding;
+    std::vector<const SendProp *> props;
+  };
+
+  void build_hierarchy(const SendTable &table, DTProp &dt_prop, CompileState &state) const;
+  FlatSendTable compile_send_table(const SendTable &table) const;
+  void gather(const SendTable &from, DTProp &dt_prop, CompileState &state) const;
+  void gather_excludes(const SendTable &table, std::set<ExcludeKey> &excluding) const;
+  void resolve_classes();
+
+private:
+  struct GetSendTableName {
+    const std::string &operator()(const SendTable &table) {
+      return table.net_table_name;
+    }
+  };
+
+  struct GetFlatSendTableName {
+    const std::string &operator()(const FlatSendTable &table) {
+      return table.net_table_name;
+    }
+  };
+
+public:
+  DictionaryList<SendTable, std::string, GetSendTableName> send_tables;
+  DictionaryList<FlatSendTable, std::string, GetFlatSendTableName> flat_send_tables;
+
+  std::vector<Class> classes;
+
+  // Interned send prop names.
+  InternTable names;
+};
+
+// Compiled schemas keyed by Schema::fingerprint. Lookups check memory first and then,
+// if a directory is given, a file per schema in that directory. Safe to use from several
+// parses at once.
+class SchemaCache {
+public:
+  static SchemaCache &shared();
+
+  SchemaCache(size_t capacity);
+
+  std::shared_ptr<const Schema> find(uint64_t key, const std::string &directory);
+  void insert(uint64_t key, std::shared_ptr<const Schema> schema,
+      const std::string &directory);
+
+  // Forgets every schema held in memory. Files in cache directories are left alone.
+  void clear();
+
+private:
+  std::string path_for(uint64_t key, const std::string &directory) const;
+
+  size_t capacity;
+  std::mutex lock;
+  std::list<std::pair<uint64_t, std::shared_ptr<const Schema>>> schemas;
+};
+
+#endif
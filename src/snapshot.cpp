@@ -0,0 +1,193 @@
+#include "snapshot.h"
+
+#include <errno.h>
+#include <snappy.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <vector>
+
+#include "edith.pb.h"
+
+#include "debug.h"
+#include "native.h"
+#include "schema.h"
+#include "state.h"
+
+void save_state(const State &state, CEdithSnapshot &out) {
+  out.set_version(SNAPSHOT_VERSION);
+  out.set_max_classes(state.max_classes);
+  out.set_send_tables_data(state.send_tables_data);
+
+  if (state.schema) {
+    out.set_schema_key(state.schema_key);
+    state.schema->save(*out.mutable_schema());
+  }
+
+  for (auto iter = state.string_tables.begin(); iter != state.string_tables.end(); ++iter) {
+    const StringTable &table = *iter;
+
+    CEdithSnapshot_string_table_t *saved = out.add_string_tables();
+    saved->set_name(table.name);
+    saved->set_max_entries(table.max_entries);
+    saved->set_user_data_fixed_size(table.user_data_fixed_size);
+    saved->set_user_data_size(table.user_data_size);
+    saved->set_user_data_size_bits(table.user_data_size_bits);
+    saved->set_flags(table.flags);
+    saved->set_keep_values(table.keep_values);
+
+    for (size_t i = 0; i < table.count(); ++i) {
+      saved->add_keys(table.get(i).key);
+      saved->add_values(table.get(i).value);
+    }
+  }
+
+  for (size_t i = 0; i < MAX_ENTITIES; ++i) {
+    const Entity &entity = state.entities[i];
+    if (entity.id == (uint32_t) -1) {
+      continue;
+    }
+
+    CEdithSnapshot_entity_t *saved = out.add_entities();
+    saved->set_id(entity.id);
+    saved->set_class_index(entity.clazz - &state.schema->classes[0]);
+    saved->set_props(encode_entity_props(entity));
+  }
+}
+
+std::shared_ptr<const Schema> load_schema(const CEdithSnapshot &in, bool cache_schemas,
+    const std::string &schema_cache_dir) {
+  std::shared_ptr<const Schema> schema;
+  if (cache_schemas) {
+    schema = SchemaCache::shared().find(in.schema_key(), schema_cache_dir);
+  }
+
+  if (!schema) {
+    std::shared_ptr<Schema> loaded(new Schema());
+    XASSERT(loaded->load(in.schema()), "Can't load the snapshot's schema.");
+
+    schema = loaded;
+
+    if (cache_schemas) {
+      SchemaCache::shared().insert(in.schema_key(), schema, schema_cache_dir);
+    }
+  }
+
+  return schema;
+}
+
+// Values are restored even for tables that had dropped them, which only ever holds empty ones.
+State *load_state(const CEdithSnapshot &in, bool cache_schemas,
+    const std::string &schema_cache_dir) {
+  XASSERT(in.version() == SNAPSHOT_VERSION, "Snapshot has version %u, not %u.", in.version(),
+      SNAPSHOT_VERSION);
+
+  std::unique_ptr<State> state(new State(in.max_classes()));
+  state->send_tables_data = in.send_tables_data();
+
+  if (in.has_schema()) {
+    state->schema = load_schema(in, cache_schemas, schema_cache_dir);
+    state->schema_key = in.schema_key();
+  }
+
+  for (int i = 0; i < in.string_tables_size(); ++i) {
+    const CEdithSnapshot_string_table_t &saved = in.string_tables(i);
+    XASSERT(saved.keys_size() == saved.values_size(), "Table %s has %d keys but %d values.",
+        saved.name().c_str(), saved.keys_size(), saved.values_size());
+
+    StringTable &table = state->create_string_table(saved.name(), saved.max_entries(),
+        saved.user_data_fixed_size(), saved.user_data_size(), saved.user_data_size_bits(),
+        saved.flags());
+
+    bool is_baseline = table.name == INSTANCE_BASELINE_TABLE;
+
+    for (int j = 0; j < saved.keys_size(); ++j) {
+      const StringTableEntry &entry = table.put(saved.keys(j), saved.values(j));
+
+      if (is_baseline) {
+        state->set_baseline(entry);
+      }
+    }
+
+    table.keep_values = saved.keep_values();
+  }
+
+  for (int i = 0; i < in.entities_size(); ++i) {
+    const CEdithSnapshot_entity_t &saved = in.entities(i);
+    XASSERT(saved.id() < MAX_ENTITIES, "Entity %u exceeds max entities.", saved.id());
+
+    const Class &clazz = state->get_class(saved.class_index());
+    XASSERT(clazz.flat_table, "Class %s has no send table.", clazz.name.c_str());
+
+    Entity &entity = state->entities[saved.id()];
+    entity = Entity(saved.id(), clazz, *clazz.flat_table);
+    decode_entity_props(saved.props(), entity, state->interned_strings);
+  }
+
+  return state.release();
+}
+
+bool write_fully(int fd, const std::string &data) {
+  size_t offset = 0;
+
+  while (offset < data.size()) {
+    ssize_t written = write(fd, data.data() + offset, data.size() - offset);
+    if (written < 0 && errno != EINTR) {
+      return false;
+    }
+
+    offset += std::max<ssize_t>(written, 0);
+  }
+
+  return true;
+}
+
+// Written to a uniquely named file and renamed, so a checkpoint is never left half written and
+// concurrent checkpoints to the same path don't clobber each other's.
+void write_snapshot(const CEdithSnapshot &snapshot, const char *path) {
+  std::string data;
+  snapshot.SerializeToString(&data);
+
+  std::string compressed;
+  snappy::Compress(data.data(), data.size(), &compressed);
+
+  std::vector<char> temp_path(path, path + strlen(path));
+  const char suffix[] = ".XXXXXX";
+  temp_path.insert(temp_path.end(), suffix, suffix + sizeof(suffix));
+
+  int fd = mkstemp(temp_path.data());
+  XASSERT(fd != -1, "Can't create a temporary file for %s.", path);
+
+  fchmod(fd, 0644);
+  bool written = write_fully(fd, compressed);
+  written &= close(fd) == 0;
+
+  if (!written || rename(temp_path.data(), path)) {
+    remove(temp_path.data());
+    XERROR("Can't write %s.", path);
+  }
+}
+
+void read_snapshot(const char *path, CEdithSnapshot &out) {
+  std::ifstream file(path, std::ifstream::in | std::ifstream::binary);
+  XASSERT(file.is_open(), "Can't open %s.", path);
+
+  std::stringstream contents;
+  contents << file.rdbuf();
+  std::string compressed = contents.str();
+
+  size_t length;
+  XASSERT(snappy::GetUncompressedLength(compressed.data(), compressed.size(), &length),
+      "%s isn't a snapshot.", path);
+
+  std::string data(length, '\0');
+  XASSERT(snappy::RawUncompress(compressed.data(), compressed.size(), &data[0]),
+      "%s isn't a snapshot.", path);
+  XASSERT(out.ParseFromString(data), "Corrupt snapshot in %s.", path);
+}
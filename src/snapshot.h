@@ -0,0 +1,27 @@
+#ifndef _SNAPSHOT_H
+#define _SNAPSHOT_H
+
+#include <stdint.h>
+
+#include <string>
+
+#define SNAPSHOT_VERSION 1
+
+class CEdithSnapshot;
+class State;
+
+// Copies what a parse has built up into out: the schema, string tables and live entities. The
+// views and triggers bound to them and scratch space aren't included, and neither are offset
+// and tick, which only the parser knows.
+void save_state(const State &state, CEdithSnapshot &out);
+
+// Rebuilds what save_state saved. The schema is taken from the schema cache if cache_schemas is
+// set and it's there, and added to it otherwise.
+State *load_state(const CEdithSnapshot &in, bool cache_schemas,
+    const std::string &schema_cache_dir);
+
+// Snapshot files hold one snappy compressed CEdithSnapshot.
+void write_snapshot(const CEdithSnapshot &snapshot, const char *path);
+void read_snapshot(const char *path, CEdithSnapshot &out);
+
+#endif
@@ -0,0 +1,261 @@
+#include "spatial_index.h"
+
+#include <algorithm>
+
+#include "debug.h"
+#include "property.h"
+#include "schema.h"
+
+#define MAX_COORD 16384
+#define UNBOUND ((uint32_t) -1)
+#define NO_BUCKET ((uint32_t) -1)
+
+enum SeenProps {
+  SEEN_CELL_X = 1,
+  SEEN_CELL_Y = 2,
+  SEEN_ORIGIN = 4,
+  SEEN_ALL = 7,
+};
+
+SpatialIndex::SpatialIndex(float _bucket_size, const std::string &_table, uint32_t _cell_bits) :
+    bucket_size(_bucket_size),
+    table(_table),
+    cell_bits(_cell_bits),
+    count(0) {
+  XASSERT(bucket_size >= 1, "Buckets have to be at least 1 unit wide.");
+  XASSERT(cell_bits < 15, "Cells of %u bits are wider than the map.", cell_bits);
+
+  buckets_per_side = (uint32_t) ((2 * MAX_COORD + bucket_size - 1) / bucket_size);
+  buckets.resize(buckets_per_side * buckets_per_side);
+}
+
+std::vector<std::string> SpatialIndex::bind(const Schema &schema) {
+  std::vector<std::string> errors;
+
+  uint32_t max_id = 0;
+  for (auto iter = schema.classes.begin(); iter != schema.classes.end(); ++iter) {
+    max_id = std::max(max_id, iter->id);
+  }
+
+  Binding unbound = {UNBOUND, UNBOUND, UNBOUND, false};
+  bindings.assign(max_id + 1, unbound);
+
+  tracked.clear();
+  buckets.assign(buckets_per_side * buckets_per_side, std::vector<Entry>());
+  count = 0;
+
+  std::string cell_x_name = table + ".m_cellX";
+  std::string cell_y_name = table + ".m_cellY";
+  std::string origin_name = table + ".m_vecOrigin";
+
+  bool matched = false;
+
+  for (auto iter = schema.classes.begin(); iter != schema.classes.end(); ++iter) {
+    const Class &clazz = *iter;
+    if (!clazz.flat_table) {
+      continue;
+    }
+
+    Binding binding = unbound;
+    bool types_match = true;
+
+    const std::vector<const SendProp*> &props = clazz.flat_table->props;
+    for (uint32_t i = 0; i < props.size(); ++i) {
+      const SendProp &prop = *props[i];
+
+      if (prop.qualified_name == cell_x_name || prop.qualified_name == cell_y_name) {
+        types_match &= prop.type == SP_Int;
+        (prop.qualified_name == cell_x_name ? binding.cell_x : binding.cell_y) = i;
+      } else if (prop.qualified_name == origin_name) {
+        types_match &= prop.type == SP_Vector || prop.type == SP_VectorXY;
+        binding.origin = i;
+        binding.origin_xy = prop.type == SP_VectorXY;
+      }
+    }
+
+    if (binding.cell_x == UNBOUND || binding.cell_y == UNBOUND || binding.origin == UNBOUND) {
+      continue;
+    }
+
+    if (!types_match) {
+      errors.push_back("The position props of " + clazz.name + " have the wrong send prop types.");
+      continue;
+    }
+
+    matched = true;
+    bindings[clazz.id] = binding;
+  }
+
+  if (!matched && errors.empty()) {
+    errors.push_back("No class has " + cell_x_name + ", " + cell_y_name + " and " + origin_name +
+        ".");
+  }
+
+  return errors;
+}
+
+bool SpatialIndex::binds(uint32_t class_id) const {
+  return class_id < bindings.size() && bindings[class_id].cell_x != UNBOUND;
+}
+
+void SpatialIndex::reset(uint32_t entity_id) {
+  if (entity_id >= tracked.size()) {
+    Tracked empty = {0, 0, 0, 0, 0, NO_BUCKET, 0};
+    tracked.resize(entity_id + 1, empty);
+  }
+
+  Tracked &entity = tracked[entity_id];
+  if (entity.bucket != NO_BUCKET) {
+    remove(entity);
+  }
+
+  entity.seen = 0;
+}
+
+void SpatialIndex::remove(Tracked &entity) {
+  std::vector<Entry> &bucket = buckets[entity.bucket];
+
+  // Swap the last entry into the hole so removal doesn't depend on how full the bucket is.
+  if (entity.slot != bucket.size() - 1) {
+    bucket[entity.slot] = bucket.back();
+    tracked[bucket[entity.slot].id].slot = entity.slot;
+  }
+
+  bucket.pop_back();
+  entity.bucket = NO_BUCKET;
+  --count;
+}
+
+uint32_t SpatialIndex::bucket_of(float coordinate) const {
+  float offset = (coordinate + MAX_COORD) / bucket_size;
+
+  if (!(offset >= 0)) {
+    return 0;
+  } else if (offset >= buckets_per_side) {
+    return buckets_per_side - 1;
+  } else {
+    return (uint32_t) offset;
+  }
+}
+
+void SpatialIndex::update(const Entity &entity, const ChangedProps &changed) {
+  const Binding &binding = bindings[entity.clazz->id];
+
+  if (entity.id >= tracked.size()) {
+    reset(entity.id);
+  }
+
+  Tracked &position = tracked[entity.id];
+  bool moved = false;
+
+  for (auto iter = changed.begin(); iter != changed.end(); ++iter) {
+    if (iter->first == binding.cell_x) {
+      position.cell_x = static_cast<const IntProperty*>(iter->second)->value;
+      position.seen |= SEEN_CELL_X;
+    } else if (iter->first == binding.cell_y) {
+      position.cell_y = static_cast<const IntProperty*>(iter->second)->value;
+      position.seen |= SEEN_CELL_Y;
+    } else if (iter->first == binding.origin) {
+      const float *values = binding.origin_xy ?
+          static_cast<const VectorXYProperty*>(iter->second)->values :
+          static_cast<const VectorProperty*>(iter->second)->values;
+
+      position.origin_x = values[0];
+      position.origin_y = values[1];
+      position.seen |= SEEN_ORIGIN;
+    } else {
+      continue;
+    }
+
+    moved = true;
+  }
+
+  if (!moved || position.seen != SEEN_ALL) {
+    return;
+  }
+
+  float cell_width = 1 << cell_bits;
+  float x = position.cell_x * cell_width - MAX_COORD + position.origin_x;
+  float y = position.cell_y * cell_width - MAX_COORD + position.origin_y;
+  uint32_t bucket = bucket_of(y) * buckets_per_side + bucket_of(x);
+
+  if (position.bucket == bucket) {
+    Entry &entry = buckets[bucket][position.slot];
+    entry.x = x;
+    entry.y = y;
+    return;
+  }
+
+  if (position.bucket != NO_BUCKET) {
+    remove(position);
+  }
+
+  Entry entry = {entity.id, x, y};
+  position.bucket = bucket;
+  position.slot = buckets[bucket].size();
+  buckets[bucket].push_back(entry);
+  ++count;
+}
+
+bool SpatialIndex::position(uint32_t entity_id, float &x, float &y) const {
+  if (entity_id >= tracked.size() || tracked[entity_id].bucket == NO_BUCKET) {
+    return false;
+  }
+
+  const Entry &entry = buckets[tracked[entity_id].bucket][tracked[entity_id].slot];
+  x = entry.x;
+  y = entry.y;
+  return true;
+}
+
+size_t SpatialIndex::size() const {
+  return count;
+}
+
+void SpatialIndex::query_radius(float x, float y, float radius,
+    std::vector<uint32_t> &out) const {
+  out.clear();
+
+  uint32_t min_column = bucket_of(x - radius);
+  uint32_t max_column = bucket_of(x + radius);
+  uint32_t min_row = bucket_of(y - radius);
+  uint32_t max_row = bucket_of(y + radius);
+  float radius_squared = radius * radius;
+
+  for (uint32_t row = min_row; row <= max_row; ++row) {
+    for (uint32_t column = min_column; column <= max_column; ++column) {
+      const std::vector<Entry> &bucket = buckets[row * buckets_per_side + column];
+
+      for (auto iter = bucket.begin(); iter != bucket.end(); ++iter) {
+        float dx = iter->x - x;
+        float dy = iter->y - y;
+
+        if (dx * dx + dy * dy <= radius_squared) {
+          out.push_back(iter->id);
+        }
+      }
+    }
+  }
+}
+
+void SpatialIndex::query_box(float min_x, float min_y, float max_x, float max_y,
+    std::vector<uint32_t> &out) const {
+  out.clear();
+
+  uint32_t min_column = bucket_of(min_x);
+  uint32_t max_column = bucket_of(max_x);
+  uint32_t min_row = bucket_of(min_y);
+  uint32_t max_row = bucket_of(max_y);
+
+  for (uint32_t row = min_row; row <= max_row; ++row) {
+    for (uint32_t column = min_column; column <= max_column; ++column) {
+      const std::vector<Entry> &bucket = buckets[row * buckets_per_side + column];
+
+      for (auto iter = bucket.begin(); iter != bucket.end(); ++iter) {
+        if (iter->x >= min_x && iter->x <= max_x && iter->y >= min_y && iter->y <= max_y) {
+          out.push_back(iter->id);
+        }
+      }
+    }
+  }
+}
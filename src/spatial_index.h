@@ -0,0 +1,92 @@
+#ifndef _SPATIAL_INDEX_H
+#define _SPATIAL_INDEX_H
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "entity.h"
+
+class Schema;
+
+// Where every positioned entity is on the map, bucketed into a uniform grid so radius and box
+// queries only look at the entities near them. Attach one with Parser::add_spatial_index and it
+// covers every class with table.m_cellX, table.m_cellY and table.m_vecOrigin. The parser only
+// moves an entity when an update writes one of those props, and takes it out when it's deleted,
+// so queries reflect the current tick.
+//
+// World coordinates follow the Source cell encoding: cell * (1 << cell_bits) - 16384 plus the
+// offset in m_vecOrigin. Everything outside [-16384, 16384) is clamped into the edge buckets.
+class SpatialIndex {
+public:
+  SpatialIndex(float _bucket_size = 512, const std::string &_table = "DT_DOTA_BaseNPC",
+      uint32_t _cell_bits = 7);
+
+  // Returns a message for each class whose position props have the wrong types, or if no class
+  // has them at all. Only classes with all three are indexed.
+  std::vector<std::string> bind(const Schema &schema);
+  bool binds(uint32_t class_id) const;
+
+  // Takes an entity out of the index, for when it's deleted or a new one takes its id.
+  void reset(uint32_t entity_id);
+
+  // Moves an entity if any of its position props changed. It's only indexed once it has all of
+  // them.
+  void update(const Entity &entity, const ChangedProps &changed);
+
+  // Whether the entity is indexed and if so, where it is.
+  bool position(uint32_t entity_id, float &x, float &y) const;
+  size_t size() const;
+
+  // Replace out with the ids of the entities within radius of (x, y), or inside the box
+  // including its edges, in no particular order.
+  void query_radius(float x, float y, float radius, std::vector<uint32_t> &out) const;
+  void query_box(float min_x, float min_y, float max_x, float max_y,
+      std::vector<uint32_t> &out) const;
+
+private:
+  struct Entry {
+    uint32_t id;
+    float x;
+    float y;
+  };
+
+  // What's been read of an entity's position so far, and where it is in the grid.
+  struct Tracked {
+    uint32_t cell_x;
+    uint32_t cell_y;
+    float origin_x;
+    float origin_y;
+    uint8_t seen;
+    uint32_t bucket;
+    uint32_t slot;
+  };
+
+  // For each class id, the flat prop indices of m_cellX, m_cellY and m_vecOrigin, which can be
+  // either kind of vector.
+  struct Binding {
+    uint32_t cell_x;
+    uint32_t cell_y;
+    uint32_t origin;
+    bool origin_xy;
+  };
+
+  SpatialIndex(const SpatialIndex&);
+  SpatialIndex &operator=(const SpatialIndex&);
+
+  uint32_t bucket_of(float coordinate) const;
+  void remove(Tracked &tracked);
+
+  float bucket_size;
+  std::string table;
+  uint32_t cell_bits;
+  uint32_t buckets_per_side;
+
+  std::vector<Binding> bindings;
+  std::vector<Tracked> tracked;
+  std::vector<std::vector<Entry>> buckets;
+  size_t count;
+};
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef _SPSC_QUEUE_H
+#define _SPSC_QUEUE_H
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// A bounded queue between exactly one producing thread and one consuming thread. Neither side
+// takes a lock, a full or empty queue just makes the caller yield and try again.
+template<typename T>
+class SpscQueue {
+public:
+  SpscQueue(size_t capacity) : head(0), tail(0) {
+    size_t size = 1;
+    while (size < capacity) {
+      size <<= 1;
+    }
+
+    slots.resize(size);
+    mask = size - 1;
+  }
+
+  bool try_push(const T &item) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    if (t - head.load(std::memory_order_acquire) == slots.size()) {
+      return false;
+    }
+
+    slots[t & mask] = item;
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool try_pop(T *item) {
+    size_t h = head.load(std::memory_order_relaxed);
+    if (h == tail.load(std::memory_order_acquire)) {
+      return false;
+    }
+
+    *item = slots[h & mask];
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+  void push(const T &item) {
+    while (!try_push(item)) {
+      std::this_thread::yield();
+    }
+  }
+
+  T pop() {
+    T item;
+    while (!try_pop(&item)) {
+      std::this_thread::yield();
+    }
+
+    return item;
+  }
+
+private:
+  SpscQueue(const SpscQueue&);
+  SpscQueue &operator=(const SpscQueue&);
+
+  std::vector<T> slots;
+  size_t mask;
+
+  // Kept on separate cache lines so the two threads don't fight over one.
+  alignas(64) std::atomic<size_t> head;
+  alignas(64) std::atomic<size_t> tail;
+};
+
+#endif
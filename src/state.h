@@ -8,6 +8,9 @@
 
 #include "dictionary_list.h"
 #include "entity.h"
+#include "float_batch.h"
+#include "intern_table.h"
+#include "schema.h"
 
 // I'm not strict about these but if someone specially crafted a replay it could probably
 // do some damage.
@@ -15,110 +18,12 @@
 #define MAX_SEND_TABLES 0xFFFF
 #define MAX_NONDATATABLE_PROPS 0x800
 
-class Class {
-public:
-  Class(uint32_t id, const std::string &dt_name, const std::string &name);
-
-  uint32_t id;
-  std::string dt_name;
-  std::string name;
-};
-
-enum SP_Flags {
-  SP_Unsigned = 1 << 0,
-  SP_Coord = 1 << 1,
-  SP_NoScale = 1 << 2,
-  SP_RoundDown = 1 << 3,
-  SP_RoundUp = 1 << 4,
-  SP_Normal = 1 << 5,
-  SP_Exclude = 1 << 6,
-  SP_Xyze = 1 << 7,
-  SP_InsideArray = 1 << 8,
-
-  SP_Collapsible = 1 << 11,
-  SP_CoordMp = 1 << 12,
-  SP_CoordMpLowPrecision = 1 << 13,
-  SP_CoordMpIntegral = 1 << 14,
-  SP_CellCoord = 1 << 15,
-  SP_CellCoordLowPrecision = 1 << 16,
-  SP_CellCoordIntegral = 1 << 17,
-  SP_ChangesOften = 1 << 18,
-  SP_EncodedAgainstTickcount = 1 << 19,
-};
-
-enum SP_Types {
-  SP_Int = 0,
-  SP_Float = 1,
-  SP_Vector = 2,
-  SP_VectorXY = 3,
-  SP_String = 4,
-  SP_Array = 5,
-  SP_DataTable = 6,
-  SP_Int64 = 7,
-};
-
-class SendTable;
-
-class SendProp {
-public:
-  SendProp();
-  SendProp(SP_Types type, const std::string &var_name, uint32_t flags, uint32_t priority,
-      const std::string &dt_name, uint32_t num_elements, float low_value, float high_value,
-      uint32_t num_bits);
-
-  SP_Types type;
-  std::string var_name;
-  uint32_t flags;
-  uint32_t priority;
-
-  std::string dt_name;
-  uint32_t num_elements;
-
-  float low_value;
-  float high_value;
-  uint32_t num_bits;
-
-  SendTable *in_table;
-  SendProp *array_prop;
-};
-
-class SendTable {
-public:
-  SendTable();
-  SendTable(const std::string net_table_name, bool needs_decoder);
-
-  std::string net_table_name;
-  bool needs_decoder;
-
-private:
-  struct GetSendPropName {
-    const std::string &operator()(const SendProp &prop) {
-      return prop.var_name;
-    }
-  };
-
-public:
-  DictionaryList<SendProp, std::string, GetSendPropName> props;
-};
+#define INSTANCE_BASELINE_TABLE "instancebaseline"
 
-struct DTProp {
-  const SendTable *send_table;
-  std::vector<DTProp> dt_props;
-  std::vector<const SendProp *> non_dt_props;
-
-  size_t prop_start;
-  size_t prop_count;
-};
-
-class FlatSendTable {
-public:
-  FlatSendTable();
-  FlatSendTable(const std::string net_table_name);
-
-  std::string net_table_name;
-  std::vector<const SendProp *> props;
-  DTProp dt_prop;
-};
+class AggregateSet;
+class EntityViewBase;
+class SpatialIndex;
+class TriggerMatcher;
 
 class StringTableEntry {
 public:
@@ -138,9 +43,17 @@ public:
   bool contains(const std::string &key) const;
   size_t count() const;
   StringTableEntry &get(size_t i);
+  const StringTableEntry &get(size_t i) const;
   StringTableEntry &get(const std::string &key);
   StringTableEntry &put(const std::string &key, const std::string &value);
 
+  // Empties every value and stores new entries without theirs, keeping only the keys. For
+  // tables nothing reads the values of.
+  void drop_values();
+
+  // Roughly the bytes held by the table and its entries.
+  size_t memory() const;
+
   std::string name;
   uint32_t max_entries;
   bool user_data_fixed_size;
@@ -149,7 +62,8 @@ public:
   uint32_t flags;
 
   size_t entry_bits;
-  
+  bool keep_values;
+
 private:
   struct GetEntryKey {
     const std::string &operator()(const StringTableEntry &entry) {
@@ -160,20 +74,30 @@ private:
   DictionaryList<StringTableEntry, std::string, GetEntryKey> entries;
 };
 
+// The views, trigger sets, spatial indexes and aggregate sets covering one class.
+struct ClassBindings {
+  std::vector<EntityViewBase*> views;
+  std::vector<TriggerMatcher*> triggers;
+  std::vector<SpatialIndex*> indexes;
+  std::vector<AggregateSet*> aggregates;
+
+  bool empty() const {
+    return views.empty() && triggers.empty() && indexes.empty() && aggregates.empty();
+  }
+};
+
 class State {
 public:
   State(uint32_t max_classes);
   ~State();
 
-  const Class &create_class(uint32_t id, std::string dt_name, std::string name);
-  SendTable &create_send_table(const std::string net_table_name, bool needs_decoder);
   StringTable &create_string_table(const std::string &name, uint32_t max_entries,
       bool user_data_fixed_size, uint32_t user_data_size, uint32_t user_data_size_bits,
       uint32_t flags);
 
-  void compile_send_tables();
-
   const Class &get_class(size_t i) const;
+  void set_baseline(const StringTableEntry &entry);
+  const StringTableEntry &get_baseline(size_t class_i) const;
   StringTable &get_string_table(size_t i);
   StringTable &get_string_table(const std::string &name);
 
@@ -182,29 +106,6 @@ public:
   uint32_t class_bits;
 
 private:
-  struct CompileState {
-    std::set<std::string> excluding;
-    std::vector<const SendProp *> props;
-  };
-
-  void build_hierarchy(const SendTable &table, DTProp &dt_prop, CompileState &state);
-  void compile_send_table(const SendTable &table);
-  void gather(const SendTable &from, DTProp &dt_prop, CompileState &state);
-  void gather_excludes(const SendTable &table, std::set<std::string> &excluding);
-
-private:
-  struct GetSendTableName {
-    const std::string &operator()(const SendTable &table) {
-      return table.net_table_name;
-    }
-  };
-
-  struct GetFlatSendTableName {
-    const std::string &operator()(const FlatSendTable &table) {
-      return table.net_table_name;
-    }
-  };
-
   struct GetStringTableName {
     const std::string &operator()(const StringTable &table) {
       return table.name;
@@ -212,14 +113,25 @@ private:
   };
 
 public:
-  DictionaryList<SendTable, std::string, GetSendTableName> send_tables;
-  DictionaryList<FlatSendTable, std::string, GetFlatSendTableName> flat_send_tables;
+  // The raw DEM_SendTables payload, kept until DEM_ClassInfo says which schema it is.
+  std::string send_tables_data;
+  std::shared_ptr<const Schema> schema;
+  // Schema::fingerprint of the schema, its key in the schema cache.
+  uint64_t schema_key;
 
   DictionaryList<StringTable, std::string, GetStringTableName> string_tables;
 
-  std::vector<Class> classes;
+  // The instancebaseline entry for each class, filled in as the entries are created.
+  std::vector<const StringTableEntry *> baselines;
+
   Entity *entities;
+
+  // What covers each class id, and scratch space for feeding them.
+  std::vector<ClassBindings> class_bindings;
+  ChangedProps changed_props;
+
+  InternTable interned_strings;
+  FloatBatch float_batch;
 };
 
 #endif
-
@@ -0,0 +1,146 @@
+#include "stats.h"
+
+#include <string.h>
+
+#include <string>
+
+#include "demo.pb.h"
+#include "netmessages.pb.h"
+
+#include "schema.h"
+
+thread_local ParseStats *ParseStats::current = 0;
+
+const char *PROP_TYPE_NAMES[STATS_MAX_PROP_TYPES] = {
+  "int", "float", "vector", "vector_xy", "string", "array", "data_table", "int64",
+};
+
+const char *FLOAT_ENCODING_NAMES[FE_Count] = {
+  "coord", "coord_mp", "no_scale", "normal", "cell_coord", "cell_coord_integral", "quantized",
+};
+
+const char *STAGE_NAMES[PS_Count] = {
+  "read", "decompress", "protobuf", "schema", "string_tables", "entities",
+};
+
+FloatEncoding float_encoding(const SendProp *prop) {
+  if (prop->flags & SP_Coord) {
+    return FE_Coord;
+  } else if (prop->flags & (SP_CoordMp | SP_CoordMpLowPrecision | SP_CoordMpIntegral)) {
+    return FE_CoordMp;
+  } else if (prop->flags & SP_NoScale) {
+    return FE_NoScale;
+  } else if (prop->flags & SP_Normal) {
+    return FE_Normal;
+  } else if (prop->flags & (SP_CellCoord | SP_CellCoordLowPrecision)) {
+    return FE_CellCoord;
+  } else if (prop->flags & SP_CellCoordIntegral) {
+    return FE_CellCoordIntegral;
+  } else {
+    return FE_Quantized;
+  }
+}
+
+ParseStats::ParseStats() {
+  clear();
+}
+
+void ParseStats::clear() {
+  memset(frames, 0, sizeof(frames));
+  compressed_bytes = 0;
+  uncompressed_bytes = 0;
+
+  memset(messages, 0, sizeof(messages));
+
+  entities_created = 0;
+  entities_updated = 0;
+  entities_deleted = 0;
+
+  memset(prop_bits, 0, sizeof(prop_bits));
+  memset(float_bits, 0, sizeof(float_bits));
+  memset(stage_nanoseconds, 0, sizeof(stage_nanoseconds));
+}
+
+std::string message_name(uint32_t type) {
+  if (NET_Messages_IsValid(type)) {
+    return NET_Messages_Name((NET_Messages) type);
+  } else if (SVC_Messages_IsValid(type)) {
+    return SVC_Messages_Name((SVC_Messages) type);
+  } else {
+    return "message_" + std::to_string(type);
+  }
+}
+
+// Writes "name": value, with a comma first unless it's the first member of its object.
+void write_member(std::ostream &out, bool *first, const std::string &name, uint64_t value) {
+  out << (*first ? "" : ", ") << "\"" << name << "\": " << value;
+  *first = false;
+}
+
+// Only counts that aren't 0 are written.
+void ParseStats::write_json(std::ostream &out) const {
+  bool first;
+
+#ifdef EDITH_STATS
+  out << "{\"enabled\": true";
+#else
+  out << "{\"enabled\": false";
+#endif
+
+  out << ", \"frames\": {";
+  first = true;
+  for (uint32_t i = 0; i <= STATS_MAX_COMMANDS; ++i) {
+    if (frames[i]) {
+      std::string name = i == STATS_MAX_COMMANDS ? "other" :
+          EDemoCommands_IsValid(i) ? EDemoCommands_Name((EDemoCommands) i) :
+          "command_" + std::to_string(i);
+      write_member(out, &first, name, frames[i]);
+    }
+  }
+  out << "}";
+
+  out << ", \"compressed_bytes\": " << compressed_bytes;
+  out << ", \"uncompressed_bytes\": " << uncompressed_bytes;
+
+  out << ", \"messages\": {";
+  first = true;
+  for (uint32_t i = 0; i <= STATS_MAX_MESSAGES; ++i) {
+    if (messages[i]) {
+      write_member(out, &first, i == STATS_MAX_MESSAGES ? "other" : message_name(i),
+          messages[i]);
+    }
+  }
+  out << "}";
+
+  out << ", \"entities\": {";
+  first = true;
+  write_member(out, &first, "created", entities_created);
+  write_member(out, &first, "updated", entities_updated);
+  write_member(out, &first, "deleted", entities_deleted);
+  out << "}";
+
+  out << ", \"prop_bits\": {";
+  first = true;
+  for (uint32_t i = 0; i < STATS_MAX_PROP_TYPES; ++i) {
+    if (prop_bits[i]) {
+      write_member(out, &first, PROP_TYPE_NAMES[i], prop_bits[i]);
+    }
+  }
+  out << "}";
+
+  out << ", \"float_bits\": {";
+  first = true;
+  for (uint32_t i = 0; i < FE_Count; ++i) {
+    if (float_bits[i]) {
+      write_member(out, &first, FLOAT_ENCODING_NAMES[i], float_bits[i]);
+    }
+  }
+  out << "}";
+
+  out << ", \"stage_seconds\": {";
+  for (uint32_t i = 0; i < PS_Count; ++i) {
+    out << (i ? ", " : "") << "\"" << STAGE_NAMES[i] << "\": " <<
+        stage_nanoseconds[i] / 1e9;
+  }
+  out << "}}";
+}
@@ -0,0 +1,129 @@
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <stdint.h>
+
+#include <chrono>
+#include <ostream>
+
+#define STATS_MAX_COMMANDS 16
+#define STATS_MAX_MESSAGES 32
+#define STATS_MAX_PROP_TYPES 8
+
+class SendProp;
+
+enum ParseStage {
+  PS_Read,
+  PS_Decompress,
+  PS_Protobuf,
+  PS_Schema,
+  PS_StringTables,
+  // Includes the visitor calls made while decoding.
+  PS_Entities,
+  PS_Count,
+};
+
+enum FloatEncoding {
+  FE_Coord,
+  FE_CoordMp,
+  FE_NoScale,
+  FE_Normal,
+  FE_CellCoord,
+  FE_CellCoordIntegral,
+  FE_Quantized,
+  FE_Count,
+};
+
+// Returns how read_float decodes a prop, checking the flags in the same order.
+FloatEncoding float_encoding(const SendProp *prop);
+
+// What a parse did and how long each stage took. The parser only fills this in when edith is
+// built with EDITH_STATS defined (the EDITH_STATS CMake option), otherwise the counting
+// compiles away and everything stays 0.
+struct ParseStats {
+  ParseStats();
+
+  void clear();
+  void write_json(std::ostream &out) const;
+
+  // Frames by EDemoCommands, and their sizes on disk and decompressed. Types past the end are
+  // counted in the last slot.
+  uint64_t frames[STATS_MAX_COMMANDS + 1];
+  uint64_t compressed_bytes;
+  uint64_t uncompressed_bytes;
+
+  // Packet messages by NET_Messages or SVC_Messages type, whether they're handled or not, and
+  // the same last slot.
+  uint64_t messages[STATS_MAX_MESSAGES + 1];
+
+  uint64_t entities_created;
+  uint64_t entities_updated;
+  uint64_t entities_deleted;
+
+  // Bits read for top level props by SP_Types, and for each float by encoding.
+  uint64_t prop_bits[STATS_MAX_PROP_TYPES];
+  uint64_t float_bits[FE_Count];
+
+  uint64_t stage_nanoseconds[PS_Count];
+
+  // Where counts on this thread go, or null.
+  static thread_local ParseStats *current;
+};
+
+#ifdef EDITH_STATS
+
+// Adds the time until the end of the enclosing scope to a stage.
+class StageTimer {
+public:
+  StageTimer(ParseStage _stage) : stage(_stage), start(std::chrono::steady_clock::now()) {
+  }
+
+  ~StageTimer() {
+    if (ParseStats::current) {
+      ParseStats::current->stage_nanoseconds[stage] +=
+          std::chrono::duration_cast<std::chrono::nanoseconds>(
+              std::chrono::steady_clock::now() - start).count();
+    }
+  }
+
+private:
+  ParseStage stage;
+  std::chrono::steady_clock::time_point start;
+};
+
+// Points ParseStats::current at stats until the end of the enclosing scope.
+class StatsScope {
+public:
+  StatsScope(ParseStats *stats) : previous(ParseStats::current) {
+    ParseStats::current = stats;
+  }
+
+  ~StatsScope() {
+    ParseStats::current = previous;
+  }
+
+private:
+  ParseStats *previous;
+};
+
+#define STATS_ADD(field, n) do { \
+  if (ParseStats::current) { \
+    ParseStats::current->field += (n); \
+  } \
+} while (0)
+
+#define STATS_MARK(name, value) uint64_t name = (value)
+#define STATS_TIME(stage) StageTimer stage_timer(stage)
+#define STATS_SCOPE(stats) StatsScope stats_scope(stats)
+
+#else
+
+// None of the arguments are evaluated.
+#define STATS_ADD(field, n) do { } while (0)
+#define STATS_MARK(name, value) do { } while (0)
+#define STATS_TIME(stage) do { } while (0)
+#define STATS_SCOPE(stats) do { } while (0)
+
+#endif
+
+#endif
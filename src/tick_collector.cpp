@@ -0,0 +1,88 @@
+#include "tick_collector.h"
+
+#include "state.h"
+
+TickCollector::TickCollector(TickVisitor &_visitor) :
+    visitor(_visitor), in_tick(false), tick(0), marks(MAX_ENTITIES, M_None), deleted_count(0) {
+}
+
+void TickCollector::visit_replay_start(const char *file) {
+  in_tick = false;
+  visitor.visit_replay_start(file);
+}
+
+void TickCollector::visit_replay_end(const char *file) {
+  flush();
+  visitor.visit_replay_end(file);
+}
+
+void TickCollector::visit_schema(const Schema &schema) {
+  visitor.visit_schema(schema);
+}
+
+// Several frames can share a tick, so a tick is only done once a frame for another one shows up.
+void TickCollector::visit_tick(uint32_t _tick) {
+  if (in_tick && _tick == tick) {
+    return;
+  }
+
+  flush();
+
+  in_tick = true;
+  tick = _tick;
+}
+
+void TickCollector::deleted(Entity &entity) {
+  // Deletes are also reported for ids that were never set up.
+  if (entity.id == (uint32_t) -1) {
+    return;
+  }
+
+  marks[entity.id] = M_None;
+
+  if (deleted_count == deleted_entities.size()) {
+    deleted_entities.push_back(Entity());
+  }
+
+  swap(deleted_entities[deleted_count], entity);
+  ++deleted_count;
+}
+
+void TickCollector::gather(std::vector<const Entity*> &pending, Mark mark,
+    std::vector<const Entity*> &out) {
+  out.clear();
+
+  for (auto iter = pending.begin(); iter != pending.end(); ++iter) {
+    const Entity *entity = *iter;
+
+    if (entity->id != (uint32_t) -1 && marks[entity->id] == mark) {
+      marks[entity->id] = M_None;
+      out.push_back(entity);
+    }
+  }
+
+  pending.clear();
+}
+
+void TickCollector::flush() {
+  if (!in_tick) {
+    return;
+  }
+
+  gather(pending_created, M_Created, created_entities);
+  gather(pending_updated, M_Updated, updated_entities);
+
+  visitor.visit_tick(tick,
+      Span<const Entity*>(created_entities.data(), created_entities.size()),
+      Span<const Entity*>(updated_entities.data(), updated_entities.size()),
+      Span<Entity>(deleted_entities.data(), deleted_count));
+  visitor.commit_tick(tick);
+
+  // The spares go back into entity slots, which don't need their old props.
+  for (size_t i = 0; i < deleted_count; ++i) {
+    deleted_entities[i].properties.clear();
+  }
+
+  deleted_count = 0;
+  in_tick = false;
+}
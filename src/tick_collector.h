@@ -0,0 +1,71 @@
+#ifndef _TICK_COLLECTOR_H
+#define _TICK_COLLECTOR_H
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "entity.h"
+#include "visitor.h"
+
+// Gathers what happens to entities during a tick into one TickVisitor call. The parser feeds
+// entity events straight to created, updated and deleted from its decode loop rather than
+// through virtual Visitor calls, only the per-frame and per-replay calls come in as a Visitor.
+class TickCollector : public Visitor {
+public:
+  TickCollector(TickVisitor &_visitor);
+
+  void visit_replay_start(const char *file);
+  void visit_replay_end(const char *file);
+
+  void visit_schema(const Schema &schema);
+
+  void visit_tick(uint32_t tick);
+
+  void created(const Entity &entity) {
+    marks[entity.id] = M_Created;
+    pending_created.push_back(&entity);
+  }
+
+  void updated(const Entity &entity) {
+    if (marks[entity.id] == M_None) {
+      marks[entity.id] = M_Updated;
+      pending_updated.push_back(&entity);
+    }
+  }
+
+  // Takes over what the entity holds rather than copying it, leaving it empty, so the deleted
+  // entity stays valid until commit_tick even if its slot is reused within the tick.
+  void deleted(Entity &entity);
+
+private:
+  enum Mark {
+    M_None,
+    M_Created,
+    M_Updated,
+  };
+
+  void flush();
+  void gather(std::vector<const Entity*> &pending, Mark mark, std::vector<const Entity*> &out);
+
+  TickVisitor &visitor;
+
+  bool in_tick;
+  uint32_t tick;
+
+  // What happened to each entity id this tick. The pending lists can have stale or repeated
+  // entries, only ones whose mark still matches are passed on.
+  std::vector<uint8_t> marks;
+  std::vector<const Entity*> pending_created;
+  std::vector<const Entity*> pending_updated;
+
+  std::vector<const Entity*> created_entities;
+  std::vector<const Entity*> updated_entities;
+
+  // Entities deleted this tick are the first deleted_count, the rest are spares to swap into
+  // the slots they're taken from.
+  std::vector<Entity> deleted_entities;
+  size_t deleted_count;
+};
+
+#endif
@@ -0,0 +1,152 @@
+#include "trace.h"
+
+#include "aggregate.h"
+
+thread_local Tracer *Tracer::current = 0;
+
+Tracer::Tracer() : origin(std::chrono::steady_clock::now()) {
+}
+
+double Tracer::now() const {
+  return std::chrono::duration<double, std::micro>(
+      std::chrono::steady_clock::now() - origin).count();
+}
+
+uint32_t Tracer::thread_index() {
+  auto found = threads.find(std::this_thread::get_id());
+  if (found != threads.end()) {
+    return found->second;
+  }
+
+  uint32_t index = threads.size();
+  threads[std::this_thread::get_id()] = index;
+  thread_names.push_back("");
+
+  return index;
+}
+
+void Tracer::add(const char *name, double start, double end, const std::string &args) {
+  std::lock_guard<std::mutex> guard(lock);
+
+  Event event = {name, thread_index(), start, end - start, args};
+  events.push_back(event);
+}
+
+void Tracer::name_thread(const char *name) {
+  std::lock_guard<std::mutex> guard(lock);
+
+  thread_names[thread_index()] = name;
+}
+
+// Durations ("X") events with one metadata event naming each thread.
+void Tracer::write_json(std::ostream &out) const {
+  std::lock_guard<std::mutex> guard(lock);
+
+  out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+
+  bool first = true;
+  for (uint32_t i = 0; i < thread_names.size(); ++i) {
+    if (thread_names[i].empty()) {
+      continue;
+    }
+
+    out << (first ? "\n" : ",\n");
+    out << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << i <<
+        ", \"args\": {\"name\": \"" << thread_names[i] << "\"}}";
+    first = false;
+  }
+
+  std::ios::fmtflags flags = out.flags();
+  std::streamsize precision = out.precision();
+
+  out.precision(3);
+  out << std::fixed;
+
+  for (auto iter = events.begin(); iter != events.end(); ++iter) {
+    out << (first ? "\n" : ",\n");
+    out << "{\"name\": \"" << iter->name << "\", \"cat\": \"edith\", \"ph\": \"X\", " <<
+        "\"pid\": 1, \"tid\": " << iter->thread << ", \"ts\": " << iter->start <<
+        ", \"dur\": " << iter->duration;
+
+    if (!iter->args.empty()) {
+      out << ", \"args\": {" << iter->args << "}";
+    }
+
+    out << "}";
+    first = false;
+  }
+
+  out << "\n]}\n";
+
+  out.flags(flags);
+  out.precision(precision);
+}
+
+TraceScope::TraceScope(Tracer *tracer, const char *thread_name) : previous(Tracer::current) {
+  Tracer::current = tracer;
+
+  if (tracer) {
+    tracer->name_thread(thread_name);
+  }
+}
+
+TraceScope::~TraceScope() {
+  Tracer::current = previous;
+}
+
+void TracingVisitor::visit_replay_start(const char *file) {
+  TraceSpan span("visit_replay_start");
+  visitor.visit_replay_start(file);
+}
+
+void TracingVisitor::visit_replay_end(const char *file) {
+  TraceSpan span("visit_replay_end");
+  visitor.visit_replay_end(file);
+}
+
+void TracingVisitor::visit_schema(const Schema &schema) {
+  TraceSpan span("visit_schema");
+  visitor.visit_schema(schema);
+}
+
+void TracingVisitor::visit_tick(uint32_t tick) {
+  TraceSpan span("visit_tick");
+  visitor.visit_tick(tick);
+}
+
+void TracingVisitor::visit_entity_created(const Entity &entity) {
+  TraceSpan span("visit_entity_created");
+  span.arg("entity", entity.id);
+  visitor.visit_entity_created(entity);
+}
+
+void TracingVisitor::visit_entity_updated(const Entity &entity) {
+  TraceSpan span("visit_entity_updated");
+  span.arg("entity", entity.id);
+  visitor.visit_entity_updated(entity);
+}
+
+void TracingVisitor::visit_entity_deleted(const Entity &entity) {
+  TraceSpan span("visit_entity_deleted");
+  span.arg("entity", entity.id);
+  visitor.visit_entity_deleted(entity);
+}
+
+void TracingVisitor::visit_entity_changes(const Entity &entity, const ChangedProps &changed) {
+  TraceSpan span("visit_entity_changes");
+  span.arg("entity", entity.id);
+  visitor.visit_entity_changes(entity, changed);
+}
+
+void TracingVisitor::visit_trigger(uint32_t trigger, const Entity &entity) {
+  TraceSpan span("visit_trigger");
+  span.arg("trigger", trigger);
+  visitor.visit_trigger(trigger, entity);
+}
+
+void TracingVisitor::visit_aggregate(const AggregateRecord &record) {
+  TraceSpan span("visit_aggregate");
+  span.arg("aggregate", record.aggregate);
+  span.arg("entity", record.entity_id);
+  visitor.visit_aggregate(record);
+}
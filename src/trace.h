@@ -0,0 +1,120 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <stdint.h>
+
+#include <chrono>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "visitor.h"
+
+// Records a span for each stage of a parse as it happens: frames, reading, decompressing,
+// protobuf parsing, entity decoding, string table updates and visitor calls. Attach one with
+// Parser::set_tracer and then write it out in the Chrome trace event format, which
+// chrome://tracing and Perfetto open. Spans only cost a branch while no tracer is attached.
+class Tracer {
+public:
+  Tracer();
+
+  void write_json(std::ostream &out) const;
+
+  // Microseconds since the tracer was created.
+  double now() const;
+
+  void add(const char *name, double start, double end, const std::string &args);
+  void name_thread(const char *name);
+
+  // Where spans on this thread go, or null.
+  static thread_local Tracer *current;
+
+private:
+  Tracer(const Tracer&);
+  Tracer &operator=(const Tracer&);
+
+  struct Event {
+    const char *name;
+    uint32_t thread;
+    double start;
+    double duration;
+    std::string args;
+  };
+
+  uint32_t thread_index();
+
+  std::chrono::steady_clock::time_point origin;
+
+  mutable std::mutex lock;
+  std::vector<Event> events;
+  std::unordered_map<std::thread::id, uint32_t> threads;
+  std::vector<std::string> thread_names;
+};
+
+// Points Tracer::current at tracer, which can be null, until the end of the enclosing scope,
+// and names the thread in the trace.
+class TraceScope {
+public:
+  TraceScope(Tracer *tracer, const char *thread_name);
+  ~TraceScope();
+
+private:
+  Tracer *previous;
+};
+
+// Records a span from here to the end of the enclosing scope. Names have to be string literals.
+class TraceSpan {
+public:
+  TraceSpan(const char *_name) : tracer(Tracer::current), name(_name), start(0) {
+    if (tracer) {
+      start = tracer->now();
+    }
+  }
+
+  ~TraceSpan() {
+    if (tracer) {
+      tracer->add(name, start, tracer->now(), args);
+    }
+  }
+
+  // Shown with the span in the trace viewer.
+  void arg(const char *key, uint64_t value) {
+    if (tracer) {
+      args += (args.empty() ? "\"" : ", \"") + std::string(key) + "\": " +
+          std::to_string(value);
+    }
+  }
+
+private:
+  Tracer *tracer;
+  const char *name;
+  double start;
+  std::string args;
+};
+
+// Passes every call on to another visitor inside a span.
+class TracingVisitor : public Visitor {
+public:
+  TracingVisitor(Visitor &_visitor) : visitor(_visitor) {
+  }
+
+  virtual void visit_replay_start(const char *file);
+  virtual void visit_replay_end(const char *file);
+  virtual void visit_schema(const Schema &schema);
+  virtual void visit_tick(uint32_t tick);
+
+  virtual void visit_entity_created(const Entity &entity);
+  virtual void visit_entity_updated(const Entity &entity);
+  virtual void visit_entity_deleted(const Entity &entity);
+  virtual void visit_entity_changes(const Entity &entity, const ChangedProps &changed);
+  virtual void visit_trigger(uint32_t trigger, const Entity &entity);
+  virtual void visit_aggregate(const AggregateRecord &record);
+
+private:
+  Visitor &visitor;
+};
+
+#endif
@@ -0,0 +1,210 @@
+#include "trigger.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "property.h"
+#include "schema.h"
+#include "visitor.h"
+
+bool is_number_type(SP_Types type) {
+  return type == SP_Int || type == SP_Float || type == SP_Int64;
+}
+
+TriggerSet::TriggerSet() {
+}
+
+uint32_t TriggerSet::on_change(const std::string &class_prefix, const std::string &prop) {
+  return add(class_prefix, prop, TK_Change, 0, "");
+}
+
+uint32_t TriggerSet::on_rise(const std::string &class_prefix, const std::string &prop,
+    double threshold) {
+  return add(class_prefix, prop, TK_Rise, threshold, "");
+}
+
+uint32_t TriggerSet::on_fall(const std::string &class_prefix, const std::string &prop,
+    double threshold) {
+  return add(class_prefix, prop, TK_Fall, threshold, "");
+}
+
+uint32_t TriggerSet::on_equal(const std::string &class_prefix, const std::string &prop,
+    double value) {
+  return add(class_prefix, prop, TK_EqualNumber, value, "");
+}
+
+uint32_t TriggerSet::on_equal(const std::string &class_prefix, const std::string &prop,
+    const std::string &value) {
+  return add(class_prefix, prop, TK_EqualString, 0, value);
+}
+
+uint32_t TriggerSet::add(const std::string &class_prefix, const std::string &prop,
+    TriggerKind kind, double number, const std::string &string) {
+  Trigger trigger = {class_prefix, prop, kind, number, string};
+  triggers.push_back(trigger);
+
+  return triggers.size() - 1;
+}
+
+TriggerMatcher::TriggerMatcher(const TriggerSet &_set) : set(_set) {
+}
+
+// Like views, failures are reported per trigger rather than per class.
+std::vector<std::string> TriggerMatcher::bind(const Schema &schema) {
+  std::vector<std::string> errors;
+
+  uint32_t max_id = 0;
+  for (auto iter = schema.classes.begin(); iter != schema.classes.end(); ++iter) {
+    max_id = std::max(max_id, iter->id);
+  }
+
+  bindings.assign(max_id + 1, std::vector<std::vector<uint32_t>>());
+  last.assign(set.triggers.size(), std::vector<TriggerSet::Sample>());
+
+  for (uint32_t i = 0; i < set.triggers.size(); ++i) {
+    const TriggerSet::Trigger &trigger = set.triggers[i];
+
+    std::string error;
+    bool matched = false;
+
+    for (auto iter = schema.classes.begin(); iter != schema.classes.end(); ++iter) {
+      const Class &clazz = *iter;
+      if (clazz.name.compare(0, trigger.class_prefix.size(), trigger.class_prefix) != 0 ||
+          !clazz.flat_table) {
+        continue;
+      }
+
+      matched = true;
+
+      const std::vector<const SendProp*> &props = clazz.flat_table->props;
+      size_t index = 0;
+      while (index < props.size() && props[index]->qualified_name != trigger.prop) {
+        ++index;
+      }
+
+      if (index == props.size()) {
+        if (error.empty()) {
+          error = "isn't a prop of " + clazz.name;
+        }
+        continue;
+      }
+
+      SP_Types type = props[index]->type;
+      bool usable;
+      if (trigger.kind == TriggerSet::TK_Change) {
+        usable = type != SP_Array;
+      } else if (trigger.kind == TriggerSet::TK_EqualString) {
+        usable = type == SP_String;
+      } else {
+        usable = is_number_type(type);
+      }
+
+      if (!usable) {
+        if (error.empty()) {
+          error = "has send prop type " + std::to_string(type) + " in " + clazz.name +
+              ", which the trigger can't compare";
+        }
+        continue;
+      }
+
+      std::vector<std::vector<uint32_t>> &bound = bindings[clazz.id];
+      if (bound.empty()) {
+        bound.resize(props.size());
+      }
+
+      bound[index].push_back(i);
+    }
+
+    if (!matched) {
+      error = "has no class starting with " + trigger.class_prefix;
+    }
+
+    if (!error.empty()) {
+      errors.push_back("Trigger on " + trigger.prop + " " + error + ".");
+    }
+  }
+
+  return errors;
+}
+
+bool TriggerMatcher::binds(uint32_t class_id) const {
+  return class_id < bindings.size() && !bindings[class_id].empty();
+}
+
+void TriggerMatcher::reset(uint32_t entity_id) {
+  for (auto iter = last.begin(); iter != last.end(); ++iter) {
+    if (entity_id < iter->size()) {
+      (*iter)[entity_id].set = false;
+    }
+  }
+}
+
+void TriggerMatcher::check(const Entity &entity, const ChangedProps &changed, Visitor &visitor,
+    bool fire) {
+  const std::vector<std::vector<uint32_t>> &bound = bindings[entity.clazz->id];
+
+  for (auto iter = changed.begin(); iter != changed.end(); ++iter) {
+    const std::vector<uint32_t> &watching = bound[iter->first];
+    if (watching.empty()) {
+      continue;
+    }
+
+    const SendProp *prop = entity.table->props[iter->first];
+    const Property &property = *iter->second;
+
+    TriggerSet::Sample now = {true, 0, {0, 0}};
+    if (prop->type == SP_Int) {
+      uint32_t value = static_cast<const IntProperty&>(property).value;
+      now.number = (prop->flags & SP_Unsigned) ? (double) value : (double) (int32_t) value;
+      now.key[0] = value;
+    } else if (prop->type == SP_Float) {
+      now.number = static_cast<const FloatProperty&>(property).value;
+      memcpy(&now.key[0], &static_cast<const FloatProperty&>(property).value, sizeof(float));
+    } else if (prop->type == SP_Int64) {
+      uint64_t value = static_cast<const Int64Property&>(property).value;
+      now.number = (prop->flags & SP_Unsigned) ? (double) value : (double) (int64_t) value;
+      now.key[0] = value;
+    } else if (prop->type == SP_Vector) {
+      memcpy(now.key, static_cast<const VectorProperty&>(property).values, 3 * sizeof(float));
+    } else if (prop->type == SP_VectorXY) {
+      memcpy(now.key, static_cast<const VectorXYProperty&>(property).values, 2 * sizeof(float));
+    } else if (prop->type == SP_String) {
+      // Interned, so equal strings have equal addresses.
+      now.key[0] = (uintptr_t) &static_cast<const StringProperty&>(property).value.str();
+    }
+
+    for (auto trigger = watching.begin(); trigger != watching.end(); ++trigger) {
+      std::vector<TriggerSet::Sample> &samples = last[*trigger];
+      if (entity.id >= samples.size()) {
+        TriggerSet::Sample unset = {false, 0, {0, 0}};
+        samples.resize(entity.id + 1, unset);
+      }
+
+      TriggerSet::Sample &previous = samples[entity.id];
+      bool fired = fire && previous.set &&
+          set.fires(set.triggers[*trigger], previous, now, property);
+      previous = now;
+
+      if (fired) {
+        visitor.visit_trigger(*trigger, entity);
+      }
+    }
+  }
+}
+
+bool TriggerSet::fires(const Trigger &trigger, const Sample &last, const Sample &now,
+    const Property &property) const {
+  if (trigger.kind == TK_Change) {
+    return last.key[0] != now.key[0] || last.key[1] != now.key[1];
+  } else if (trigger.kind == TK_Rise) {
+    return last.number < trigger.number && now.number >= trigger.number;
+  } else if (trigger.kind == TK_Fall) {
+    return last.number > trigger.number && now.number <= trigger.number;
+  } else if (trigger.kind == TK_EqualNumber) {
+    return last.number != trigger.number && now.number == trigger.number;
+  } else {
+    return last.key[0] != now.key[0] &&
+        static_cast<const StringProperty&>(property).value.str() == trigger.string;
+  }
+}
@@ -0,0 +1,114 @@
+#ifndef _TRIGGER_H
+#define _TRIGGER_H
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "entity.h"
+
+class Schema;
+class Visitor;
+
+// Conditions on a prop of the entities of some classes, checked by the parser only when an
+// update writes that prop. When one goes from false to true for an entity the parser calls
+// Visitor::visit_trigger with the id the condition was registered under, after the update and
+// before visit_entity_updated. Attach sets with Parser::add_triggers.
+//
+// Each entity's previous value of the prop is kept, so nothing fires for the values an entity
+// is created with. Props are named by qualified name and a set covers every class whose name
+// starts with class_prefix. Numbers compare ints (signed unless the prop is unsigned), floats
+// and int64s as doubles.
+//
+// A set only holds the conditions. Each parser it's attached to keeps its own bindings and
+// previous values in a TriggerMatcher, so one set can be shared by parsers on several threads
+// as long as nothing is added to it while they run.
+class TriggerSet {
+public:
+  TriggerSet();
+
+  // Fires whenever the value changes. Works for any prop that isn't an array.
+  uint32_t on_change(const std::string &class_prefix, const std::string &prop);
+
+  // Fires when the value goes from below threshold to at least threshold.
+  uint32_t on_rise(const std::string &class_prefix, const std::string &prop, double threshold);
+
+  // Fires when the value goes from above threshold to at most threshold, so a health prop
+  // falling to 0 is on_fall(..., 0).
+  uint32_t on_fall(const std::string &class_prefix, const std::string &prop, double threshold);
+
+  // Fires when the value becomes equal to value.
+  uint32_t on_equal(const std::string &class_prefix, const std::string &prop, double value);
+  uint32_t on_equal(const std::string &class_prefix, const std::string &prop,
+      const std::string &value);
+
+private:
+  friend class TriggerMatcher;
+
+  enum TriggerKind {
+    TK_Change,
+    TK_Rise,
+    TK_Fall,
+    TK_EqualNumber,
+    TK_EqualString,
+  };
+
+  struct Trigger {
+    std::string class_prefix;
+    std::string prop;
+    TriggerKind kind;
+    double number;
+    std::string string;
+  };
+
+  // A prop value reduced to what the kind of trigger compares.
+  struct Sample {
+    bool set;
+    double number;
+    uint64_t key[2];
+  };
+
+  TriggerSet(const TriggerSet&);
+  TriggerSet &operator=(const TriggerSet&);
+
+  uint32_t add(const std::string &class_prefix, const std::string &prop, TriggerKind kind,
+      double number, const std::string &string);
+  bool fires(const Trigger &trigger, const Sample &last, const Sample &now,
+      const Property &property) const;
+
+  std::vector<Trigger> triggers;
+};
+
+// What one parser knows about the triggers of a set: where they are in its replay's schema and
+// the last value it saw for each entity.
+class TriggerMatcher {
+public:
+  TriggerMatcher(const TriggerSet &_set);
+
+  // Returns a message for each trigger that couldn't be bound. Those never fire.
+  std::vector<std::string> bind(const Schema &schema);
+  bool binds(uint32_t class_id) const;
+
+  // Forgets everything about an entity, for when a new one takes its id.
+  void reset(uint32_t entity_id);
+
+  // Records the changed props of an entity and, if fire is set, calls the visitor for every
+  // trigger that fires.
+  void check(const Entity &entity, const ChangedProps &changed, Visitor &visitor, bool fire);
+
+private:
+  TriggerMatcher(const TriggerMatcher&);
+  TriggerMatcher &operator=(const TriggerMatcher&);
+
+  const TriggerSet &set;
+
+  // For each class id, the triggers on each flat prop index. Empty for classes that aren't
+  // covered.
+  std::vector<std::vector<std::vector<uint32_t>>> bindings;
+
+  // For each trigger, the last value seen for each entity id.
+  std::vector<std::vector<TriggerSet::Sample>> last;
+};
+
+#endif
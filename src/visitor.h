@@ -1,17 +1,89 @@
 #ifndef _VISITOR_H
 #define _VISITOR_H
 
-class Entity;
+#include <stddef.h>
+#include <stdint.h>
+
+#include "entity.h"
+
+class Schema;
+struct AggregateRecord;
 
 class Visitor {
 public:
   virtual ~Visitor() { }
 
+  // Bracket each replay, which matters when one visitor sees several of them in a batch.
+  virtual void visit_replay_start(const char *file) { }
+  virtual void visit_replay_end(const char *file) { }
+
+  // Called once the replay's classes are known, before any entity shows up.
+  virtual void visit_schema(const Schema &schema) { }
+
   virtual void visit_tick(uint32_t tick) { }
 
   virtual void visit_entity_created(const Entity &entity) { }
   virtual void visit_entity_updated(const Entity &entity) { }
   virtual void visit_entity_deleted(const Entity &entity) { }
+
+  // Only called if ParseOptions::report_changes is set. Called with the props read by each
+  // update of an entity, before the created or updated call it leads to. A created entity is
+  // read from its baseline and then from the packet, so it gets two calls.
+  virtual void visit_entity_changes(const Entity &entity, const ChangedProps &changed) { }
+
+  // Called when the trigger registered as trigger in a TriggerSet attached to the parser fires.
+  virtual void visit_trigger(uint32_t trigger, const Entity &entity) { }
+
+  // Called with each window's aggregate of an entity from an AggregateSet attached to the
+  // parser, once the window is over.
+  virtual void visit_aggregate(const AggregateRecord &record) { }
+};
+
+// A read-only run of items, only valid during the call it's passed to.
+template<typename T>
+class Span {
+public:
+  Span(const T *_items, size_t _count) : items(_items), count(_count) {
+  }
+
+  const T *begin() const {
+    return items;
+  }
+
+  const T *end() const {
+    return items + count;
+  }
+
+  size_t size() const {
+    return count;
+  }
+
+  const T &operator[](size_t i) const {
+    return items[i];
+  }
+
+private:
+  const T *items;
+  size_t count;
+};
+
+// Gets everything that changed in a tick at once rather than a call per entity. visit_tick is
+// only called once the whole tick is decoded, followed by commit_tick.
+class TickVisitor {
+public:
+  virtual ~TickVisitor() { }
+
+  virtual void visit_replay_start(const char *file) { }
+  virtual void visit_replay_end(const char *file) { }
+
+  virtual void visit_schema(const Schema &schema) { }
+
+  // Created and updated are the live entities as of the end of the tick, and each entity is in
+  // at most one of them. Deleted holds the entities as they were when they were deleted, which
+  // stay valid until commit_tick returns.
+  virtual void visit_tick(uint32_t tick, Span<const Entity*> created,
+      Span<const Entity*> updated, Span<Entity> deleted) { }
+  virtual void commit_tick(uint32_t tick) { }
 };
 
 #endif
@@ -0,0 +1,259 @@
+// Checks AggregateSet against aggregates worked out from every value a parse reports, for
+// example
+//
+//   aggregates good.dem
+//
+// Entities count with the values they're created with, not the baseline values the packet that
+// creates them overwrites. Replays from generate_replay create heroes with different health
+// than their baseline, and this also checks that such values showed up. The exit status is 1 if
+// anything differs.
+
+#include <string.h>
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "aggregate.h"
+#include "edith.h"
+#include "property.h"
+#include "schema.h"
+#include "visitor.h"
+
+struct Watched {
+  const char *class_prefix;
+  const char *prop;
+  uint32_t window;
+  AggregateKind kind;
+};
+
+const Watched WATCHED[] = {
+  {"CDOTA_Unit_Hero_", "DT_DOTA_BaseNPC.m_iHealth", 30, AK_Min},
+  {"CDOTA_Unit_Hero_", "DT_DOTA_BaseNPC.m_iHealth", 30, AK_Max},
+  {"CDOTA_Unit_Hero_", "DT_DOTA_BaseNPC.m_iHealth", 7, AK_Last},
+  {"CDOTA_Unit_Hero_", "DT_DOTA_BaseNPC.m_iHealth", 100, AK_Mean},
+  {"CDOTA_BaseNPC_Creep", "DT_DOTA_BaseNPC.m_flMana", 30, AK_Mean},
+  {"CDOTA_Unit_Hero_Lina", "DT_DOTA_BaseNPC.m_nSigned64", 50, AK_Min},
+};
+const size_t WATCHED_COUNT = sizeof(WATCHED) / sizeof(WATCHED[0]);
+
+// Aggregate, first tick, entity id, samples and value.
+typedef std::tuple<uint32_t, uint32_t, uint32_t, uint32_t, double> Record;
+
+double number(const SendProp &prop, const Property &property) {
+  if (prop.type == SP_Int) {
+    uint32_t value = static_cast<const IntProperty&>(property).value;
+    return (prop.flags & SP_Unsigned) ? (double) value : (double) (int32_t) value;
+  } else if (prop.type == SP_Float) {
+    return static_cast<const FloatProperty&>(property).value;
+  } else {
+    uint64_t value = static_cast<const Int64Property&>(property).value;
+    return (prop.flags & SP_Unsigned) ? (double) value : (double) (int64_t) value;
+  }
+}
+
+// The values written to one entity's watched prop between its creation and its deletion.
+struct Life {
+  uint32_t entity_id;
+  std::vector<std::pair<uint32_t, double>> writes;
+  bool deleted;
+  uint32_t deleted_tick;
+};
+
+class CheckingVisitor : public Visitor {
+public:
+  CheckingVisitor() : tick(0), overwritten(0) {
+  }
+
+  void visit_tick(uint32_t _tick) {
+    tick = _tick;
+  }
+
+  void visit_entity_changes(const Entity &entity, const ChangedProps &changed) {
+    for (auto iter = changed.begin(); iter != changed.end(); ++iter) {
+      const SendProp &prop = *entity.table->props[iter->first];
+
+      for (uint32_t i = 0; i < WATCHED_COUNT; ++i) {
+        if (watches(i, entity, prop)) {
+          pending.push_back(std::make_pair(i, number(prop, *iter->second)));
+        }
+      }
+    }
+  }
+
+  // Only the values it was created with count, what came before is from its baseline.
+  void visit_entity_created(const Entity &entity) {
+    for (uint32_t i = 0; i < WATCHED_COUNT; ++i) {
+      auto found = entity.properties.find(WATCHED[i].prop);
+      if (found == entity.properties.end() ||
+          entity.clazz->name.compare(0, strlen(WATCHED[i].class_prefix),
+              WATCHED[i].class_prefix) != 0) {
+        continue;
+      }
+
+      const SendProp &prop = *prop_named(entity, WATCHED[i].prop);
+      double value = number(prop, *found->second);
+
+      for (auto iter = pending.begin(); iter != pending.end(); ++iter) {
+        overwritten += iter->first == i && iter->second != value;
+      }
+
+      Life life = {entity.id, std::vector<std::pair<uint32_t, double>>(), false, 0};
+      life.writes.push_back(std::make_pair(tick, value));
+
+      live[std::make_pair(i, entity.id)] = lives[i].size();
+      lives[i].push_back(life);
+    }
+
+    pending.clear();
+  }
+
+  // Replays from generate_replay have baselines with every prop, so anything updated was
+  // already there when it was created.
+  void visit_entity_updated(const Entity &entity) {
+    for (auto iter = pending.begin(); iter != pending.end(); ++iter) {
+      Life &life = lives[iter->first][live.at(std::make_pair(iter->first, entity.id))];
+      life.writes.push_back(std::make_pair(tick, iter->second));
+    }
+
+    pending.clear();
+  }
+
+  void visit_entity_deleted(const Entity &entity) {
+    for (uint32_t i = 0; i < WATCHED_COUNT; ++i) {
+      auto found = live.find(std::make_pair(i, entity.id));
+      if (found == live.end()) {
+        continue;
+      }
+
+      Life &life = lives[i][found->second];
+      life.deleted = true;
+      life.deleted_tick = tick;
+
+      live.erase(found);
+    }
+  }
+
+  void visit_aggregate(const AggregateRecord &record) {
+    got.push_back(Record(record.aggregate, record.first_tick, record.entity_id, record.samples,
+        record.value));
+  }
+
+  // Every window from the one an entity was created in to the one it was deleted in, or the
+  // last one, gets a record, starting from the last value of the window before.
+  std::vector<Record> expected() const {
+    std::vector<Record> records;
+
+    for (uint32_t i = 0; i < WATCHED_COUNT; ++i) {
+      uint32_t length = WATCHED[i].window;
+
+      for (auto life = lives[i].begin(); life != lives[i].end(); ++life) {
+        uint32_t last = life->deleted ? life->deleted_tick : tick;
+        uint32_t first = life->writes[0].first - life->writes[0].first % length;
+
+        size_t next = 0;
+        std::vector<double> values;
+
+        for (; first <= last; first += length) {
+          uint32_t samples = 0;
+          while (next < life->writes.size() && life->writes[next].first < first + length) {
+            values.push_back(life->writes[next++].second);
+            ++samples;
+          }
+
+          double value = values[0];
+          double sum = 0;
+          for (auto iter = values.begin(); iter != values.end(); ++iter) {
+            if (WATCHED[i].kind == AK_Min) {
+              value = std::min(value, *iter);
+            } else if (WATCHED[i].kind == AK_Max) {
+              value = std::max(value, *iter);
+            } else if (WATCHED[i].kind == AK_Last) {
+              value = *iter;
+            }
+
+            sum += *iter;
+          }
+
+          if (WATCHED[i].kind == AK_Mean) {
+            value = sum / values.size();
+          }
+
+          records.push_back(Record(i, first, life->entity_id, samples, value));
+          values.assign(1, values.back());
+        }
+      }
+    }
+
+    return records;
+  }
+
+  std::vector<Record> got;
+  uint32_t overwritten;
+
+private:
+  bool watches(uint32_t i, const Entity &entity, const SendProp &prop) const {
+    return prop.qualified_name == WATCHED[i].prop &&
+        entity.clazz->name.compare(0, strlen(WATCHED[i].class_prefix),
+            WATCHED[i].class_prefix) == 0;
+  }
+
+  const SendProp *prop_named(const Entity &entity, const std::string &name) const {
+    const std::vector<const SendProp*> &props = entity.table->props;
+    return *std::find_if(props.begin(), props.end(),
+        [&](const SendProp *prop) { return prop->qualified_name == name; });
+  }
+
+  uint32_t tick;
+
+  std::vector<std::pair<uint32_t, double>> pending;
+  std::vector<Life> lives[WATCHED_COUNT];
+
+  // Where the live entity with an id is in lives, for each watched prop.
+  std::map<std::pair<uint32_t, uint32_t>, size_t> live;
+};
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    std::cerr << "Usage: " << argv[0] << " good.dem" << std::endl;
+    return 1;
+  }
+
+  AggregateSet aggregates;
+  for (uint32_t i = 0; i < WATCHED_COUNT; ++i) {
+    aggregates.add(WATCHED[i].class_prefix, WATCHED[i].prop, WATCHED[i].window,
+        WATCHED[i].kind);
+  }
+
+  ParseOptions options;
+  options.report_changes = true;
+
+  Parser parser(options);
+  parser.add_aggregates(aggregates);
+
+  CheckingVisitor visitor;
+  parser.parse(argv[1], visitor);
+
+  std::vector<Record> want = visitor.expected();
+  std::vector<Record> got = visitor.got;
+  std::sort(want.begin(), want.end());
+  std::sort(got.begin(), got.end());
+
+  bool ok = true;
+
+  if (got != want) {
+    std::cerr << "Got " << got.size() << " records but expected " << want.size() << "." <<
+        std::endl;
+    ok = false;
+  }
+
+  if (!visitor.overwritten) {
+    std::cerr << "No entity was created with values other than its baseline's." << std::endl;
+    ok = false;
+  }
+
+  return ok ? 0 : 1;
+}
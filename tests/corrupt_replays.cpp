@@ -0,0 +1,141 @@
+// Parses truncated and bit flipped copies of a replay with ParseOptions::recover_errors, for
+// example
+//
+//   corrupt_replays good.dem
+//
+// Each copy has to either parse or fail with a ParseError naming the replay, sequentially and
+// pipelined, rather than crash or exit. Truncated copies have to fail too, which holds as long
+// as no cut falls exactly between two frames, as none do for the replay the tests generate. The
+// exit status is 1 if anything didn't go that way.
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+
+#include "debug.h"
+#include "edith.h"
+#include "visitor.h"
+
+#define TRUNCATIONS 40
+#define FLIPS 200
+#define SEED 1
+
+// Touches everything the parser hands out, so bad entities show up here too.
+class ReadingVisitor : public Visitor {
+public:
+  ReadingVisitor() : props(0) {
+  }
+
+  void visit_entity_created(const Entity &entity) {
+    props += entity.properties.size();
+  }
+
+  void visit_entity_updated(const Entity &entity) {
+    props += entity.properties.size();
+  }
+
+  size_t props;
+};
+
+std::string read_file(const char *path) {
+  std::ifstream in(path, std::ifstream::in | std::ifstream::binary);
+  std::stringstream contents;
+  contents << in.rdbuf();
+  return contents.str();
+}
+
+void write_file(const std::string &path, const std::string &contents) {
+  std::ofstream out(path.c_str(), std::ofstream::out | std::ofstream::binary |
+      std::ofstream::trunc);
+  out.write(contents.data(), contents.size());
+}
+
+// Parses path both ways and returns how many of them failed, or -1 if something went wrong.
+int check(const std::string &path, const std::string &what) {
+  int failures = 0;
+
+  for (int pipeline = 0; pipeline < 2; ++pipeline) {
+    ParseOptions options;
+    options.recover_errors = true;
+    options.pipeline = pipeline;
+
+    Parser parser(options);
+    ReadingVisitor visitor;
+
+    if (parser.parse(path.c_str(), visitor)) {
+      continue;
+    }
+
+    const ParseError &error = parser.error();
+    if (error.message.empty() || error.replay != path) {
+      std::cerr << what << (pipeline ? " pipelined" : "") << " failed without an error." <<
+          std::endl;
+      return -1;
+    }
+
+    ++failures;
+  }
+
+  return failures;
+}
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    std::cerr << "Usage: " << argv[0] << " good.dem" << std::endl;
+    return 1;
+  }
+
+  std::string replay = read_file(argv[1]);
+  if (replay.empty()) {
+    std::cerr << "Can't read " << argv[1] << std::endl;
+    return 1;
+  }
+
+  std::string path = "corrupt_replays." + std::to_string(getpid()) + ".dem";
+  bool ok = true;
+
+  write_file(path, replay);
+  if (check(path, "The intact replay") != 0) {
+    std::cerr << "The intact replay doesn't parse." << std::endl;
+    ok = false;
+  }
+
+  // The first cut is inside the header, the rest are spread over the frames.
+  for (size_t i = 0; i < TRUNCATIONS; ++i) {
+    size_t length = (i * 2 + 1) * replay.size() / (TRUNCATIONS * 2);
+    std::string what = "Truncation to " + std::to_string(length) + " bytes";
+
+    write_file(path, replay.substr(0, length));
+    if (check(path, what) != 2) {
+      std::cerr << what << " parsed." << std::endl;
+      ok = false;
+    }
+  }
+
+  std::mt19937 rng(SEED);
+  size_t failed = 0;
+
+  for (size_t i = 0; i < FLIPS; ++i) {
+    std::string flipped(replay);
+    size_t bit = rng() % (flipped.size() * 8);
+    flipped[bit / 8] ^= (char) (1 << (bit % 8));
+
+    write_file(path, flipped);
+    int failures = check(path, "Flipping bit " + std::to_string(bit));
+    if (failures < 0) {
+      ok = false;
+    } else {
+      failed += failures;
+    }
+  }
+
+  remove(path.c_str());
+
+  std::cout << "Bit flips failed " << failed << " of " << 2 * FLIPS << " parses." << std::endl;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,238 @@
+// Checks that the other ways of reading a replay agree with parsing it, for example
+//
+//   round_trips native good.dem
+//
+// native converts the replay with convert_to_native and expects dump_native to make the same
+// entity calls. segments parses it with dump_segmented and resume parses the first half, saves a
+// snapshot and resumes from it. Those start from created entities rather than the calls a parse
+// makes, so for them every entity has to be the same at the end of each tick they see. The exit
+// status is 1 if anything differs.
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "bitstream.h"
+#include "demo.h"
+#include "edith.h"
+#include "native.h"
+#include "property.h"
+#include "schema.h"
+#include "visitor.h"
+
+// Every entity call, and what every entity looked like at the end of each tick. Props are kept
+// by their encodings, which is exact without having to care about types.
+class RecordingVisitor : public Visitor {
+public:
+  RecordingVisitor() : tick(-1) {
+  }
+
+  void visit_tick(uint32_t _tick) {
+    end_tick();
+    tick = _tick;
+  }
+
+  void visit_replay_end(const char*) {
+    end_tick();
+  }
+
+  void visit_entity_created(const Entity &entity) {
+    record('C', entity);
+  }
+
+  void visit_entity_updated(const Entity &entity) {
+    record('U', entity);
+  }
+
+  void visit_entity_deleted(const Entity &entity) {
+    calls.push_back("D " + std::to_string(tick) + " " + std::to_string(entity.id));
+    entities.erase(entity.id);
+  }
+
+  std::vector<std::string> calls;
+  std::map<uint32_t, std::string> ticks;
+
+private:
+  void record(char type, const Entity &entity) {
+    std::string encoded = encode(entity);
+
+    calls.push_back(std::string(1, type) + " " + std::to_string(tick) + " " + encoded);
+    entities[entity.id] = encoded;
+  }
+
+  std::string encode(const Entity &entity) {
+    std::string encoded = std::to_string(entity.id) + " " + entity.clazz->name;
+    const std::vector<const SendProp*> &props = entity.table->props;
+
+    for (uint32_t i = 0; i < props.size(); ++i) {
+      auto found = entity.properties.find(props[i]->qualified_name);
+      if (found == entity.properties.end()) {
+        continue;
+      }
+
+      BitWriter value;
+      Property::write_prop(value, props[i], *found->second);
+      encoded += " " + std::to_string(i) + ":" + value.get_bytes();
+    }
+
+    return encoded;
+  }
+
+  void end_tick() {
+    if (tick == (uint32_t) -1) {
+      return;
+    }
+
+    std::string state;
+    for (auto iter = entities.begin(); iter != entities.end(); ++iter) {
+      state += iter->second + "\n";
+    }
+
+    ticks[tick] = state;
+  }
+
+  uint32_t tick;
+  std::map<uint32_t, std::string> entities;
+};
+
+// Ticks seen by both have to match, and other has to have seen some.
+bool same_ticks(const RecordingVisitor &parsed, const std::map<uint32_t, std::string> &other,
+    const std::string &what) {
+  if (other.empty()) {
+    std::cerr << what << " saw no ticks." << std::endl;
+    return false;
+  }
+
+  for (auto iter = other.begin(); iter != other.end(); ++iter) {
+    auto found = parsed.ticks.find(iter->first);
+
+    if (found == parsed.ticks.end() || found->second != iter->second) {
+      std::cerr << what << " differs at tick " << iter->first << "." << std::endl;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool check_native(const char *replay, const RecordingVisitor &parsed) {
+  std::string path = "round_trips." + std::to_string(getpid()) + ".edn";
+
+  ParseError error;
+  if (!convert_to_native(replay, path.c_str(), ParseOptions(), &error)) {
+    std::cerr << "Can't convert " << replay << ": " << error.what() << std::endl;
+    return false;
+  }
+
+  RecordingVisitor native;
+  dump_native(path.c_str(), native);
+  remove(path.c_str());
+
+  if (native.calls != parsed.calls) {
+    std::cerr << "Reading the native file made different calls." << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+bool check_segments(const char *replay, const RecordingVisitor &parsed) {
+  std::map<uint32_t, std::string> merged;
+  bool ok = true;
+
+  // Neighbouring segments both see the tick of the full packet between them.
+  std::vector<ParseError> errors = dump_segmented(replay,
+      []() { return new RecordingVisitor(); },
+      [&](Visitor &visitor) {
+        const RecordingVisitor &segment = static_cast<const RecordingVisitor&>(visitor);
+
+        for (auto iter = segment.ticks.begin(); iter != segment.ticks.end(); ++iter) {
+          auto found = merged.find(iter->first);
+          if (found != merged.end() && found->second != iter->second) {
+            std::cerr << "Segments differ at tick " << iter->first << "." << std::endl;
+            ok = false;
+          }
+
+          merged[iter->first] = iter->second;
+        }
+      }, ParseOptions());
+
+  if (!errors.empty() || merged.size() != parsed.ticks.size()) {
+    std::cerr << "Segments saw " << merged.size() << " of " << parsed.ticks.size() <<
+        " ticks." << std::endl;
+    return false;
+  }
+
+  return ok && same_ticks(parsed, merged, "The segments");
+}
+
+// The snapshot is taken at the middle frame of the replay.
+bool check_resume(const char *replay, const RecordingVisitor &parsed) {
+  std::vector<size_t> frames;
+  {
+    Demo demo(replay);
+    while (!demo.eof()) {
+      frames.push_back(demo.tell());
+
+      int tick;
+      bool compressed;
+      demo.get_message_type(&tick, &compressed);
+      demo.skip_message();
+    }
+  }
+
+  size_t middle = frames[frames.size() / 2];
+
+  std::string path = "round_trips." + std::to_string(getpid()) + ".snapshot";
+
+  Parser parser;
+  RecordingVisitor first;
+  if (!parser.parse_segment(replay, 0, middle, first)) {
+    std::cerr << "Can't parse up to " << middle << "." << std::endl;
+    return false;
+  }
+
+  parser.save_snapshot(path.c_str());
+
+  RecordingVisitor resumed;
+  bool ok = parser.resume(replay, path.c_str(), -1, resumed);
+  remove(path.c_str());
+
+  if (!ok) {
+    std::cerr << "Can't resume from " << middle << "." << std::endl;
+    return false;
+  }
+
+  return same_ticks(parsed, first.ticks, "The first half") &&
+      same_ticks(parsed, resumed.ticks, "The resumed parse") &&
+      resumed.ticks.rbegin()->first == parsed.ticks.rbegin()->first;
+}
+
+int main(int argc, char **argv) {
+  std::string mode(argc == 3 ? argv[1] : "");
+  if (mode != "native" && mode != "segments" && mode != "resume") {
+    std::cerr << "Usage: " << argv[0] << " native|segments|resume good.dem" << std::endl;
+    return 1;
+  }
+
+  const char *replay = argv[2];
+
+  RecordingVisitor parsed;
+  dump(replay, parsed);
+
+  bool ok;
+  if (mode == "native") {
+    ok = check_native(replay, parsed);
+  } else if (mode == "segments") {
+    ok = check_segments(replay, parsed);
+  } else {
+    ok = check_resume(replay, parsed);
+  }
+
+  return ok ? 0 : 1;
+}